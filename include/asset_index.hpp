@@ -0,0 +1,104 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Отпечаток анимации: точный хэш распакованного Lottie JSON + dHash нескольких кадров,
+// отрендеренных в маленьком размере. Разный JSON с одинаковой картинкой (пересжатие,
+// другой порядок ключей) даёт близкие dHash. dHash считается по яркости, поэтому к нему
+// добавлена грубая цветность: средние Cb/Cr в клетках 4x4 — цветовые варианты одной модели не сливаются.
+struct AssetFingerprint
+{
+    static constexpr std::size_t kFrames = 4;
+    // сторона кадра, по которому считаются dHash и цветность
+    static constexpr int kSide = 64;
+    // на сколько ступеней (из 16) может разойтись Cb или Cr одной клетки у одной и той же картинки
+    static constexpr int kChromaTolerance = 2;
+
+    std::uint64_t exact = 0;
+    std::size_t total_frames = 0;
+    int fps = 0;
+    std::array<std::uint64_t, kFrames> dhash{};
+    // по кадру: 16 клеток x (Cb << 4 | Cr) по 8 бит; [0] — верхние две строки клеток, [1] — нижние
+    std::array<std::array<std::uint64_t, 2>, kFrames> chroma{};
+
+    // dhash[k] и chroma[k] по кадру kSide x kSide (premultiplied ARGB)
+    void set_frame(std::size_t k, const std::vector<std::uint32_t> &argb);
+    // сумма расстояний Хэмминга по кадрам; SIZE_MAX, если длительность/частота не совпадают
+    // или цвет хотя бы одной клетки расходится больше kChromaTolerance
+    std::size_t distance(const AssetFingerprint &o) const;
+};
+
+// Индекс уникальных анимаций подарков. Каждому исходнику (unique_id стикера) и каждому
+// received_gift_id сопоставляется канонический ассет — unique_id первого исходника с такой картинкой.
+// Рендер и хранение идут по каноническим ассетам, т.е. масштабируются по числу моделей, а не копий.
+// Хранится в JSON (tmp + rename). Изменения (и bind, и resolve) сбрасывает фоновый поток не реже
+// раза в min_interval: процесс обычно убивают, а не завершают, и деструктор не успевает.
+class AssetIndex
+{
+public:
+    struct Stats
+    {
+        std::size_t assets = 0;
+        std::size_t sources = 0;
+        std::size_t gifts = 0;
+        std::size_t exact_hits = 0;
+        std::size_t perceptual_hits = 0;
+    };
+
+    explicit AssetIndex(std::filesystem::path path = "assets_index.json", std::size_t max_distance = 12);
+    ~AssetIndex();
+
+    bool load();
+    // Пишет, только если были изменения и с прошлой записи прошло min_interval (force — сразу)
+    bool save(bool force = false);
+
+    static bool fingerprint(const std::string &json, AssetFingerprint &fp);
+
+    // Канонический ассет для .tgs (ключ исходника — имя файла без расширения).
+    // Пустая строка, если файл не читается / не рендерится.
+    std::string resolve(const std::filesystem::path &tgs);
+    void bind(const std::string &received_gift_id, const std::string &asset);
+    std::optional<std::string> asset_of(const std::string &received_gift_id) const;
+    Stats stats() const;
+
+private:
+    struct Asset
+    {
+        AssetFingerprint fp;
+        std::vector<std::uint64_t> exact; // все варианты JSON, которые сюда свелись
+    };
+
+    // версия JSON; старые файлы не читаются, индекс строится заново
+    static constexpr int kFormatVersion = 2;
+
+    std::string match_locked(const std::string &source, const AssetFingerprint &fp);
+
+    const std::filesystem::path path_;
+    const std::size_t max_distance_;
+    std::chrono::seconds min_interval_{5};
+
+    std::mutex save_mutex_;
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Asset> assets_;
+    std::unordered_map<std::uint64_t, std::string> by_exact_;
+    std::unordered_map<std::string, std::string> sources_;
+    std::unordered_map<std::string, std::string> gifts_;
+    Stats stats_;
+    bool dirty_ = false;
+    std::chrono::steady_clock::time_point saved_at_{};
+
+    void flusher();
+    std::condition_variable flush_cv_;
+    bool stopping_ = false;
+    std::thread flusher_; // последним: стартует, когда всё остальное уже создано
+};
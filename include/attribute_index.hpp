@@ -0,0 +1,108 @@
+#pragma once
+#include "gift_inventory.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum class GiftAttribute
+{
+    Model,
+    Backdrop,
+    Symbol
+};
+
+// Фильтр: пустые поля не участвуют, заданные — через AND
+struct AttributeQuery
+{
+    std::optional<std::string> model;
+    std::optional<std::string> backdrop;
+    std::optional<std::string> symbol;
+    std::optional<td_api::int64> owner;
+    std::size_t limit = 50;
+};
+
+// "backdrop=Onyx Black symbol=Star owner=-100123 limit=10" — значение до следующего ключа,
+// так что пробелы в названиях не мешают
+std::optional<AttributeQuery> parse_attribute_query(const std::string &text);
+std::optional<GiftAttribute> parse_gift_attribute(const std::string &name);
+
+// Индекс улучшенных подарков по model/backdrop/symbol/owner.
+// Значения интернируются в плотные id, строки хранятся по колонкам,
+// на каждое значение атрибута — битмап строк (vector<uint64_t>); запрос — AND битмапов.
+class AttributeIndex
+{
+public:
+    struct Hit
+    {
+        std::string received_gift_id;
+        td_api::int64 owner = 0;
+        std::string model;
+        std::string backdrop;
+        std::string symbol;
+    };
+
+    struct Rarity
+    {
+        std::string value;
+        std::size_t held = 0;  // у владельца
+        std::size_t total = 0; // по всем обойдённым владельцам
+    };
+
+    // не улучшенные подарки пропускаются
+    void upsert(const InventoryEntry &e);
+    // строка уходит из всех битмапов, её номер переиспользуется
+    void remove(const std::string &received_gift_id);
+
+    // total — сколько строк подошло (в hits не больше limit)
+    std::vector<Hit> query(const AttributeQuery &q, std::size_t *total = nullptr) const;
+    // Значения атрибута у владельца, от самых редких в индексе к самым частым
+    std::vector<Rarity> rarest(GiftAttribute attr, td_api::int64 owner, std::size_t limit = 10) const;
+
+    std::size_t size() const;
+
+private:
+    using Bitmap = std::vector<std::uint64_t>;
+
+    struct Dictionary
+    {
+        std::unordered_map<std::string, std::uint32_t> ids;
+        std::vector<std::string> names;
+        std::vector<Bitmap> postings;
+        std::vector<std::uint32_t> counts;
+
+        std::uint32_t intern(const std::string &name);
+        const Bitmap *find(const std::string &name) const;
+    };
+
+    static void set_bit(Bitmap &b, std::uint32_t row);
+    static void clear_bit(Bitmap &b, std::uint32_t row);
+    void place(std::uint32_t row, std::uint32_t attr_id, Dictionary &dict, std::vector<std::uint32_t> &column);
+    void unplace(std::uint32_t row, Dictionary &dict, std::vector<std::uint32_t> &column);
+    const Dictionary &dictionary(GiftAttribute attr) const;
+    const std::vector<std::uint32_t> &column(GiftAttribute attr) const;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, std::uint32_t> rows_;
+    // занятые строки (запрос без фильтров) и освобождённые remove()
+    Bitmap live_;
+    std::vector<std::uint32_t> free_rows_;
+
+    // колонки по строкам
+    std::vector<std::string> received_ids_;
+    std::vector<std::uint32_t> owner_col_;
+    std::vector<std::uint32_t> model_col_;
+    std::vector<std::uint32_t> backdrop_col_;
+    std::vector<std::uint32_t> symbol_col_;
+
+    Dictionary models_;
+    Dictionary backdrops_;
+    Dictionary symbols_;
+    // владельцы — тоже словарь, ключ — десятичная запись id
+    Dictionary owners_;
+    std::vector<td_api::int64> owner_values_;
+};
@@ -0,0 +1,99 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Состояние одного подарка из getAvailableGifts в момент опроса
+struct CatalogPoint
+{
+    std::int64_t gift_id = 0;
+    std::int64_t price = 0;
+    std::int64_t total = 0;     // 0 — не лимитированный
+    std::int64_t remaining = 0;
+};
+
+struct CatalogSnapshot
+{
+    std::int64_t time_ms = 0; // unix time
+    std::vector<CatalogPoint> gifts;
+};
+
+// Временной ряд каталога подарков в append-only файле.
+// Формат: заголовок "GCATSER1" + version, дальше кадры: varint длина + тело.
+// Тело: флаги, zigzag-дельта времени, число записей, по каждому подарку — zigzag-дельты id
+// (отсортированы) и price/total/remaining относительно его прошлого значения.
+// В кадр попадают только изменившиеся подарки; первый кадр сессии — ключевой (все, от нуля),
+// поэтому файл можно дописывать после перезапуска и читать с обрезанным хвостом.
+// open() отрезает недописанный хвост прошлой сессии, неудачная запись откатывается
+// до последнего целого кадра, а следующий кадр после неё снова ключевой.
+class CatalogSeriesWriter
+{
+public:
+    CatalogSeriesWriter() = default;
+    ~CatalogSeriesWriter();
+    CatalogSeriesWriter(const CatalogSeriesWriter &) = delete;
+    CatalogSeriesWriter &operator=(const CatalogSeriesWriter &) = delete;
+
+    bool open(const std::string &path);
+    // Не блокирует: снимок уходит в очередь, кодирует и пишет отдельный поток.
+    // До open() снимки выбрасываются.
+    void push(CatalogSnapshot snapshot);
+
+    std::size_t frames_written() const;
+
+private:
+    struct Last
+    {
+        std::int64_t price = 0;
+        std::int64_t total = 0;
+        std::int64_t remaining = 0;
+    };
+
+    void writer();
+    void encode(CatalogSnapshot &s, std::string &frame);
+
+    int fd_ = -1;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<CatalogSnapshot> queue_;
+    bool stop_ = false;
+    std::thread thread_;
+
+    // только поток writer() (и open() до его запуска)
+    std::int64_t size_ = 0; // конец последнего целого кадра
+    bool keyframe_ = true;
+    std::int64_t last_time_ = 0;
+    std::unordered_map<std::int64_t, Last> last_;
+    std::size_t frames_ = 0;
+};
+
+// Файл ряда, размапленный и разложенный по подаркам
+class CatalogSeriesReader
+{
+public:
+    struct Sample
+    {
+        std::int64_t time_ms = 0;
+        std::int64_t price = 0;
+        std::int64_t total = 0;
+        std::int64_t remaining = 0;
+    };
+
+    bool load(const std::string &path);
+
+    const std::unordered_map<std::int64_t, std::vector<Sample>> &series() const { return series_; }
+    std::size_t frames() const { return frames_; }
+    // true, если хвост файла оборван (недописанный кадр)
+    bool truncated() const { return truncated_; }
+
+private:
+    std::unordered_map<std::int64_t, std::vector<Sample>> series_;
+    std::size_t frames_ = 0;
+    bool truncated_ = false;
+};
@@ -0,0 +1,52 @@
+#pragma once
+#include <nlohmann/json.hpp>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+class TdInterface;
+namespace td_coro
+{
+    class CancellationSource;
+}
+
+// Команды управления — общие для stdin и control-сокета.
+// Команда — JSON-объект {"cmd": "...", ...}, ответ — JSON {"ok": true/false, ...}.
+// Долгие команды (upg, buy) запускают свои потоки и отвечают сразу.
+// Для stdin есть и короткая текстовая форма: "upg 25 gifts.json", "buy -100123 1000", "stop" и т.п.
+class CommandDispatcher
+{
+public:
+    using Handler = std::function<nlohmann::json(const nlohmann::json &cmd)>;
+
+    explicit CommandDispatcher(TdInterface &td);
+
+    nlohmann::json dispatch(const nlohmann::json &cmd);
+    // строка JSON или текстовая форма -> ответ одной строкой
+    std::string dispatch_line(const std::string &line);
+    // Своя команда (или замена встроенной)
+    void add(const std::string &name, Handler handler);
+
+    static std::optional<nlohmann::json> parse_text(const std::string &line);
+
+private:
+    nlohmann::json upg(const nlohmann::json &cmd);
+    nlohmann::json targets(const nlohmann::json &cmd);
+    nlohmann::json buy(const nlohmann::json &cmd);
+    nlohmann::json stop(const nlohmann::json &cmd);
+    nlohmann::json stats(const nlohmann::json &cmd);
+    nlohmann::json query(const nlohmann::json &cmd);
+    nlohmann::json rarest(const nlohmann::json &cmd);
+    nlohmann::json check(const nlohmann::json &cmd);
+    nlohmann::json updates(const nlohmann::json &cmd);
+    nlohmann::json standby(const nlohmann::json &cmd);
+
+    TdInterface &td_;
+    std::mutex mutex_;
+    std::map<std::string, Handler> handlers_;
+    // отмена запущенных check; stop пересоздаёт
+    std::shared_ptr<td_coro::CancellationSource> checks_;
+};
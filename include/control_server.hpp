@@ -0,0 +1,32 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+// Локальный control-сокет (AF_UNIX, SOCK_STREAM): по строке-команде на запрос, по строке-ответу.
+// Все соединения обслуживает один поток через poll(); обработчик должен быть быстрым
+// (долгие команды сами уходят в свои потоки, см. CommandDispatcher).
+class ControlServer
+{
+public:
+    using Handler = std::function<std::string(const std::string &line)>;
+
+    ControlServer(std::string path, Handler handler);
+    ~ControlServer();
+    ControlServer(const ControlServer &) = delete;
+    ControlServer &operator=(const ControlServer &) = delete;
+
+    bool start();
+    const std::string &path() const { return path_; }
+
+private:
+    void run();
+
+    const std::string path_;
+    Handler handler_;
+    int listen_fd_ = -1;
+    int wake_[2] = {-1, -1};
+    std::atomic<bool> stop_{false};
+    std::thread thread_;
+};
@@ -0,0 +1,25 @@
+#pragma once
+#include "image_encoders.hpp"
+
+#include <string>
+
+class ThreadPool;
+
+// GIF-кодер для анимаций подарков:
+//  - одна глобальная палитра на всю анимацию (median cut по гистограмме всех кадров);
+//  - поиск ближайшего цвета на SSE4.1/AVX2 (выбирается в рантайме), результат кэшируется по ячейкам rgb666;
+//  - кадр хранит только прямоугольник изменений, неизменённые пиксели — прозрачные;
+//  - LZW всех кадров параллельно на пуле.
+class GifEncoder
+{
+public:
+    explicit GifEncoder(ThreadPool *pool = nullptr);
+
+    bool encode(const RenderedAnimation &anim, std::string &out);
+
+    // "avx2", "sse4.1" или "scalar"
+    static const char *simd_level();
+
+private:
+    ThreadPool *pool_;
+};
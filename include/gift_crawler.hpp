@@ -0,0 +1,61 @@
+#pragma once
+#include <td/telegram/td_api.h>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+#include <vector>
+
+namespace td_api = td::td_api;
+
+class TdInterface;
+
+struct CrawlStats
+{
+    std::size_t owners = 0;
+    std::size_t pages = 0;
+    std::size_t gifts = 0;
+    std::size_t errors = 0;
+    std::chrono::milliseconds elapsed{0};
+
+    double pages_per_sec() const
+    {
+        return elapsed.count() > 0 ? pages * 1000.0 / elapsed.count() : 0.0;
+    }
+};
+
+// Обходит getReceivedGifts сразу по многим владельцам.
+// Страницы одного владельца идут по цепочке offset'ов, поэтому параллелизм — между владельцами:
+// одновременно в полёте не больше max_in_flight страниц, каждая берёт токен у RateGovernor.
+class GiftCrawler
+{
+public:
+    // Вызывается на каждую страницу. false — больше не листать этого владельца.
+    using PageHandler = std::function<bool(td_api::int64 owner, td_api::receivedGifts &page)>;
+    using DoneHandler = std::function<void(const CrawlStats &)>;
+
+    explicit GiftCrawler(TdInterface &td, std::size_t max_in_flight = 4);
+
+    void set_max_in_flight(std::size_t k)
+    {
+        max_in_flight_.store(k == 0 ? 1 : k, std::memory_order_relaxed);
+    }
+    std::size_t max_in_flight() const
+    {
+        return max_in_flight_.load(std::memory_order_relaxed);
+    }
+
+    // Future готов, когда все владельцы догружены (или упали с ошибкой); on_done зовётся перед этим.
+    std::shared_future<CrawlStats> crawl(std::vector<td_api::int64> owners, PageHandler on_page,
+                                         DoneHandler on_done = {});
+
+private:
+    struct State;
+    void run(std::shared_ptr<State> st);
+    void fetch_page(const std::shared_ptr<State> &st, td_api::int64 owner, std::string offset);
+
+    TdInterface &td_;
+    std::atomic<std::size_t> max_in_flight_;
+};
@@ -0,0 +1,62 @@
+#pragma once
+#include <td/telegram/td_api.h>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace td_api = td::td_api;
+
+struct InventoryEntry
+{
+    std::string received_gift_id;
+    td_api::int64 owner = 0;
+    td_api::int64 gift_id = 0;
+    td_api::int64 upgrade_price = 0;
+    bool can_be_upgraded = false;
+    bool upgraded = false;
+    // только для upgraded
+    std::string model;
+    std::string backdrop;
+    std::string symbol;
+
+    bool operator==(const InventoryEntry &o) const;
+    bool operator!=(const InventoryEntry &o) const { return !(*this == o); }
+};
+
+InventoryEntry make_inventory_entry(td_api::int64 owner, const td_api::receivedGift &rg);
+
+// Кэш полученных подарков между перезапусками.
+// Формат файла: заголовок, массив записей фиксированного размера, блоб строк.
+// На старте файл мапится (mmap) целиком, записи поднимаются в память одним проходом.
+class GiftInventory
+{
+public:
+    bool load(const std::string &path);
+    // Пишет во временный файл и переименовывает; ничего не делает, если изменений не было.
+    bool save();
+
+    // true, если запись новая или изменилась
+    bool upsert(InventoryEntry e);
+    // После полного обхода владельца: убрать его подарки, которых не было в обходе
+    // (переданы, проданы). Возвращает убранные received_gift_id.
+    std::vector<std::string> evict_missing(td_api::int64 owner, const std::unordered_set<std::string> &seen);
+    std::optional<InventoryEntry> find(const std::string &received_gift_id) const;
+    std::vector<InventoryEntry> owned_by(td_api::int64 owner) const;
+    bool has_owner(td_api::int64 owner) const;
+    // под блокировкой инвентаря — внутри не звать его методы
+    void for_each(const std::function<void(const InventoryEntry &)> &fn) const;
+    std::size_t size() const;
+
+private:
+    mutable std::mutex mutex_;
+    std::string path_;
+    std::unordered_map<std::string, InventoryEntry> entries_;
+    std::unordered_map<td_api::int64, std::size_t> per_owner_;
+    bool dirty_ = false;
+};
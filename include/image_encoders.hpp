@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+enum class RenderFormat
+{
+    Gif,
+    Webp,
+    Apng,
+    Png
+};
+
+std::optional<RenderFormat> parse_render_format(const std::string &name);
+const char *render_format_extension(RenderFormat format);
+
+// Кадры в RGBA (не premultiplied), width * height * 4 байт каждый.
+struct RenderedAnimation
+{
+    int width = 0;
+    int height = 0;
+    double fps = 30;
+    std::vector<std::vector<std::uint8_t>> frames;
+};
+
+// png — только первый кадр
+bool encode_png(const RenderedAnimation &anim, std::string &out);
+bool encode_apng(const RenderedAnimation &anim, std::string &out);
+// pool — для покадровой параллельной работы (см. GifEncoder), может быть nullptr
+bool encode_gif(const RenderedAnimation &anim, std::string &out, ThreadPool *pool = nullptr);
+bool encode_webp(const RenderedAnimation &anim, std::string &out);
+
+bool encode_animation(const RenderedAnimation &anim, RenderFormat format, std::string &out, ThreadPool *pool = nullptr);
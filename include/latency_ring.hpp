@@ -0,0 +1,47 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+// Время отправки по порядковому номеру запроса (sent_/received_): кольцо без map и аллокаций.
+// Слот перезаписывается через kSize запросов — к тому времени ответ уже давно не ждём.
+class LatencyRing
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    static constexpr std::size_t kSize = 4096;
+
+    void record(std::uint64_t seq, Clock::time_point at)
+    {
+        Slot &s = slots_[seq & (kSize - 1)];
+        s.ns.store(at.time_since_epoch().count(), std::memory_order_relaxed);
+        s.seq.store(seq + 1, std::memory_order_release);
+    }
+
+    // Забрать время с момента отправки; пусто, если слот не записан или уже перезаписан
+    std::optional<Clock::duration> take(std::uint64_t seq, Clock::time_point now)
+    {
+        Slot &s = slots_[seq & (kSize - 1)];
+        std::uint64_t expected = seq + 1;
+        if (s.seq.load(std::memory_order_acquire) != expected)
+        {
+            return std::nullopt;
+        }
+        const auto ns = s.ns.load(std::memory_order_relaxed);
+        if (!s.seq.compare_exchange_strong(expected, 0, std::memory_order_acq_rel))
+        {
+            return std::nullopt;
+        }
+        return now - Clock::time_point(Clock::duration(ns));
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<std::uint64_t> seq{0};
+        std::atomic<Clock::rep> ns{0};
+    };
+    std::array<Slot, kSize> slots_{};
+};
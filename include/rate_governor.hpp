@@ -0,0 +1,84 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+// Token bucket на все "фоновые" запросы (краулер, догрузки),
+// чтобы не ловить FLOOD_WAIT. rate <= 0 — без ограничений.
+class RateGovernor
+{
+public:
+    explicit RateGovernor(double per_second = 0, double burst = 1)
+    {
+        set_rate(per_second, burst);
+    }
+
+    void set_rate(double per_second, double burst = 1)
+    {
+        std::lock_guard lk(mutex_);
+        rate_ = per_second;
+        burst_ = std::max(1.0, burst);
+        tokens_ = burst_;
+        last_ = std::chrono::steady_clock::now();
+    }
+
+    double rate() const
+    {
+        std::lock_guard lk(mutex_);
+        return rate_;
+    }
+
+    bool try_acquire()
+    {
+        std::lock_guard lk(mutex_);
+        return take_locked() == std::chrono::steady_clock::duration::zero();
+    }
+
+    // Блокирует вызывающий поток до появления токена.
+    // Не вызывать из loop()/обработчиков ответов.
+    void acquire()
+    {
+        while (true)
+        {
+            std::chrono::steady_clock::duration wait;
+            {
+                std::lock_guard lk(mutex_);
+                wait = take_locked();
+            }
+            if (wait == std::chrono::steady_clock::duration::zero())
+            {
+                return;
+            }
+            std::this_thread::sleep_for(wait);
+        }
+    }
+
+private:
+    // Возвращает zero, если токен взят, иначе сколько ждать до следующего.
+    std::chrono::steady_clock::duration take_locked()
+    {
+        using namespace std::chrono;
+        if (rate_ <= 0)
+        {
+            return steady_clock::duration::zero();
+        }
+        auto now = steady_clock::now();
+        double elapsed = duration<double>(now - last_).count();
+        last_ = now;
+        tokens_ = std::min(burst_, tokens_ + elapsed * rate_);
+        if (tokens_ >= 1.0)
+        {
+            tokens_ -= 1.0;
+            return steady_clock::duration::zero();
+        }
+        auto wait = duration_cast<steady_clock::duration>(duration<double>((1.0 - tokens_) / rate_));
+        return std::max(wait, steady_clock::duration(1));
+    }
+
+    mutable std::mutex mutex_;
+    double rate_ = 0;
+    double burst_ = 1;
+    double tokens_ = 1;
+    std::chrono::steady_clock::time_point last_ = std::chrono::steady_clock::now();
+};
@@ -0,0 +1,70 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace spdlog::sinks
+{
+    class sink;
+}
+
+// Трассировка жизненного цикла запросов в формате Chrome Trace Event (chrome://tracing, Perfetto).
+// Каждый поток пишет в свой кольцевой буфер без блокировок; выключенная трассировка — одна
+// relaxed-загрузка. Имена — только строковые литералы (хранится указатель).
+// Запрос — async-событие "query": b (поставлен), n "send"/"response", e (обработан). id события —
+// query_id, а у запросов с общим query_id (проверка, улучшения) — свой trace id, query_id тогда в args.
+class RequestTrace
+{
+public:
+    static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+    static void set_enabled(bool on);
+
+    static void begin(const char *name, std::int64_t arg = 0);
+    static void end(const char *name);
+    static void instant(const char *name, std::int64_t arg = 0);
+    static void async_begin(const char *name, std::uint64_t id, std::uint64_t query_id = 0);
+    static void async_step(const char *name, std::uint64_t id);
+    static void async_end(const char *name, std::uint64_t id);
+    // подпись дорожки текущего потока в просмотрщике
+    static void name_thread(const char *name);
+
+    // Записать всё накопленное (последние 32768 событий каждого потока); false — не открыть файл
+    static bool dump(const std::string &path, std::size_t *events = nullptr);
+    // dump будет пропускать всё, что было до этого момента
+    static void clear();
+
+private:
+    static void record(char phase, const char *name, std::uint64_t id, std::int64_t arg);
+    static inline std::atomic<bool> enabled_{false};
+    static inline std::atomic<std::int64_t> clear_before_ns_{0};
+};
+
+// Sink для spdlog: каждая строка лога — instant-событие name (arg — уровень)
+std::shared_ptr<spdlog::sinks::sink> make_trace_log_sink(const char *name);
+
+// B/E-пара на время жизни объекта; конец пишется, даже если трассировку выключили посередине
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char *name, std::int64_t arg = 0)
+        : name_(RequestTrace::enabled() ? name : nullptr)
+    {
+        if (name_)
+        {
+            RequestTrace::begin(name_, arg);
+        }
+    }
+    ~TraceSpan()
+    {
+        if (name_)
+        {
+            RequestTrace::end(name_);
+        }
+    }
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+    const char *name_;
+};
@@ -0,0 +1,79 @@
+#pragma once
+#include "td_transport.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Локальная замена TDLib для тренировки PGO и замеров: авторизация проходит сразу,
+// на запросы снайпинга (getAvailableGifts, getReceivedGift(s), upgradeGift, sendGift, getMe)
+// отвечает правдоподобными объектами с задержкой latency ± jitter.
+// Улучшение «открывается» после unlock_after запросов upgradeGift/getReceivedGift — до этого
+// STARGIFT_UPGRADE_UNAVAILABLE, как в реальном окне ожидания.
+struct SimConfig
+{
+    std::chrono::microseconds latency{300};
+    std::chrono::microseconds jitter{100};
+    std::uint64_t unlock_after = 20000;
+    int catalog_size = 24;
+    int received_gifts = 200; // на владельца, страницами по 50
+    // фоновые апдейты на каждый запрос: сообщения и прочтения в шумных каналах, статусы
+    int updates_per_request = 0;
+    unsigned seed = 1;
+};
+
+class SimTransport final : public TdTransport
+{
+public:
+    explicit SimTransport(SimConfig config = {});
+
+    std::int32_t create_client_id() override;
+    void send(std::int32_t client_id, std::uint64_t request_id, td::td_api::object_ptr<td::td_api::Function> request) override;
+    Response receive(double timeout) override;
+
+    std::uint64_t requests() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+    using Object = td::td_api::object_ptr<td::td_api::Object>;
+
+    struct Pending
+    {
+        Clock::time_point due;
+        std::uint64_t order;
+        std::int32_t client_id;
+        std::uint64_t request_id;
+        mutable Object object;
+        bool operator>(const Pending &o) const { return due != o.due ? due > o.due : order > o.order; }
+    };
+
+    // под mutex_
+    Object respond(std::int32_t client_id, td::td_api::Function &request);
+    void push(Clock::time_point due, std::int32_t client_id, std::uint64_t request_id, Object object);
+    void push_authorization(std::int32_t client_id, Object state);
+    void push_noise(std::int32_t client_id);
+    Clock::time_point due();
+    Object make_catalog();
+    Object make_received_gift(const std::string &received_gift_id, bool can_be_upgraded);
+    Object make_received_gifts(const std::string &offset, int limit);
+
+    const SimConfig config_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::priority_queue<Pending, std::vector<Pending>, std::greater<>> queue_;
+    std::uint64_t order_ = 0;
+    std::int32_t next_client_id_ = 0;
+    std::unordered_set<std::int32_t> started_;
+    std::unordered_set<std::string> upgraded_;
+    std::vector<int> remaining_;
+    std::uint64_t upgrade_attempts_ = 0;
+    std::uint64_t requests_ = 0;
+    std::uint64_t noise_ = 0;
+    std::mt19937 rng_;
+};
@@ -0,0 +1,71 @@
+#pragma once
+#include <td/telegram/td_api.h>
+#include <cstddef>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace td_api = td::td_api;
+
+class TdInterface;
+
+// Стикеры подарков по remote unique_id: один файл на стикер в cache_dir,
+// в links_dir — жёсткие ссылки <received_gift_id>.<ext> на него.
+// Скачивается не больше max_downloads файлов одновременно, уже лежащее на диске не качается.
+// Стикер без unique_id кэшируется только до конца сессии (имя file_<сессия>_<file_id>).
+class StickerCache
+{
+public:
+    struct Stats
+    {
+        std::size_t hits = 0;
+        std::size_t downloads = 0;
+        std::size_t links = 0;
+        std::size_t failures = 0;
+    };
+
+    // Стикер лежит в кэше и привязан к received_gift_id (например, чтобы отрендерить)
+    using ReadyHandler = std::function<void(const std::filesystem::path &cached, const std::string &received_gift_id)>;
+
+    StickerCache(TdInterface &td, std::filesystem::path cache_dir = "stickers",
+                 std::filesystem::path links_dir = "gifts_channel", std::size_t max_downloads = 4);
+
+    void request(const td_api::sticker &st, const std::string &received_gift_id);
+    void set_max_downloads(std::size_t n);
+    void set_on_ready(ReadyHandler handler);
+    Stats stats() const;
+
+    // hard link, а если нельзя — копия; существующий dst не трогается
+    static bool link_file(const std::filesystem::path &src, const std::filesystem::path &dst);
+
+private:
+    struct Pending
+    {
+        td_api::int32 file_id = 0;
+        std::vector<std::string> received_ids;
+    };
+
+    void scan_locked();
+    void pump();
+    void on_downloaded(const std::string &unique_id, td_api::object_ptr<td_api::Object> obj);
+    bool link(const std::filesystem::path &cached, const std::string &received_gift_id);
+
+    TdInterface &td_;
+    const std::filesystem::path cache_dir_;
+    const std::filesystem::path links_dir_;
+    const std::string session_;
+
+    mutable std::mutex mutex_;
+    bool scanned_ = false;
+    std::size_t max_downloads_;
+    std::size_t in_flight_ = 0;
+    std::unordered_map<std::string, std::filesystem::path> cached_;
+    std::unordered_map<std::string, Pending> pending_;
+    std::deque<std::string> queue_;
+    Stats stats_;
+    ReadyHandler on_ready_;
+};
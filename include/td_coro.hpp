@@ -0,0 +1,517 @@
+#pragma once
+#include "td_interface.hpp"
+
+#include <spdlog/spdlog.h>
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Корутины поверх TdInterface::send_query:
+//   auto obj = co_await td.query(td_api::make_object<td_api::getMe>());
+// Продолжение выполняется там, где пришёл ответ (поток loop()), как и обычные обработчики —
+// долгую работу после co_await уносить в свои потоки.
+namespace td_coro
+{
+    namespace detail
+    {
+        // Кадры корутин — из пула по классам размера (шаг 64 байта, до 1 КБ),
+        // свободные блоки копятся в thread_local списках. Больше 1 КБ — обычный new.
+        class FramePool
+        {
+        public:
+            static constexpr std::size_t kGranule = 64;
+            static constexpr std::size_t kClasses = 16;
+            static constexpr std::size_t kMaxCached = 256;
+
+            static void *allocate(std::size_t n)
+            {
+                const std::size_t cls = (n + kGranule - 1) / kGranule;
+                if (cls == 0 || cls > kClasses)
+                {
+                    heap_.fetch_add(1, std::memory_order_relaxed);
+                    return ::operator new(n);
+                }
+                Cache &c = cache();
+                if (Block *b = c.head[cls - 1])
+                {
+                    c.head[cls - 1] = b->next;
+                    --c.count[cls - 1];
+                    pooled_.fetch_add(1, std::memory_order_relaxed);
+                    return b;
+                }
+                heap_.fetch_add(1, std::memory_order_relaxed);
+                return ::operator new(cls * kGranule);
+            }
+
+            static void deallocate(void *p, std::size_t n) noexcept
+            {
+                const std::size_t cls = (n + kGranule - 1) / kGranule;
+                if (cls == 0 || cls > kClasses)
+                {
+                    ::operator delete(p);
+                    return;
+                }
+                Cache &c = cache();
+                if (c.count[cls - 1] >= kMaxCached)
+                {
+                    ::operator delete(p);
+                    return;
+                }
+                auto *b = static_cast<Block *>(p);
+                b->next = c.head[cls - 1];
+                c.head[cls - 1] = b;
+                ++c.count[cls - 1];
+            }
+
+            // сколько кадров взято из пула / у аллокатора
+            static std::size_t pooled() { return pooled_.load(std::memory_order_relaxed); }
+            static std::size_t heap() { return heap_.load(std::memory_order_relaxed); }
+
+        private:
+            struct Block
+            {
+                Block *next;
+            };
+            struct Cache
+            {
+                Block *head[kClasses] = {};
+                std::size_t count[kClasses] = {};
+                ~Cache()
+                {
+                    for (Block *b : head)
+                    {
+                        while (b)
+                        {
+                            Block *next = b->next;
+                            ::operator delete(b);
+                            b = next;
+                        }
+                    }
+                }
+            };
+            static Cache &cache()
+            {
+                thread_local Cache c;
+                return c;
+            }
+            static inline std::atomic<std::size_t> pooled_{0};
+            static inline std::atomic<std::size_t> heap_{0};
+        };
+
+        struct PooledFrame
+        {
+            static void *operator new(std::size_t n) { return FramePool::allocate(n); }
+            static void operator delete(void *p, std::size_t n) noexcept { FramePool::deallocate(p, n); }
+        };
+
+        struct PromiseBase : PooledFrame
+        {
+            std::coroutine_handle<> continuation;
+            std::exception_ptr error;
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+
+            struct FinalAwaiter
+            {
+                bool await_ready() noexcept { return false; }
+                template <class P>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+                {
+                    auto next = h.promise().continuation;
+                    return next ? next : std::noop_coroutine();
+                }
+                void await_resume() noexcept {}
+            };
+            FinalAwaiter final_suspend() noexcept { return {}; }
+            void unhandled_exception() { error = std::current_exception(); }
+        };
+
+        template <class T>
+        struct Promise : PromiseBase
+        {
+            std::optional<T> value;
+            void return_value(T v) { value.emplace(std::move(v)); }
+            T take()
+            {
+                if (error) std::rethrow_exception(error);
+                return std::move(*value);
+            }
+        };
+
+        template <>
+        struct Promise<void> : PromiseBase
+        {
+            void return_void() {}
+            void take()
+            {
+                if (error) std::rethrow_exception(error);
+            }
+        };
+    } // namespace detail
+
+    // Ленивая задача: стартует, когда её ждут (co_await) или отдают в spawn()
+    template <class T = void>
+    class [[nodiscard]] Task
+    {
+    public:
+        struct promise_type : detail::Promise<T>
+        {
+            Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        };
+
+        Task() = default;
+        Task(Task &&o) noexcept : h_(std::exchange(o.h_, {})) {}
+        Task &operator=(Task &&o) noexcept
+        {
+            if (this != &o)
+            {
+                if (h_) h_.destroy();
+                h_ = std::exchange(o.h_, {});
+            }
+            return *this;
+        }
+        ~Task()
+        {
+            if (h_) h_.destroy();
+        }
+
+        auto operator co_await() && noexcept { return Awaiter{h_}; }
+        auto operator co_await() & noexcept { return Awaiter{h_}; }
+
+    private:
+        explicit Task(std::coroutine_handle<promise_type> h) : h_(h) {}
+
+        struct Awaiter
+        {
+            std::coroutine_handle<promise_type> h;
+            bool await_ready() const noexcept { return !h || h.done(); }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> cont) noexcept
+            {
+                h.promise().continuation = cont;
+                return h;
+            }
+            T await_resume() { return h.promise().take(); }
+        };
+
+        std::coroutine_handle<promise_type> h_;
+    };
+
+    namespace detail
+    {
+        // Самоудаляющаяся обёртка для spawn()
+        struct Detached
+        {
+            struct promise_type : PooledFrame
+            {
+                Detached get_return_object() { return {}; }
+                std::suspend_never initial_suspend() noexcept { return {}; }
+                std::suspend_never final_suspend() noexcept { return {}; }
+                void return_void() {}
+                void unhandled_exception() {}
+            };
+        };
+
+        template <class T>
+        Detached run_detached(Task<T> task)
+        {
+            try
+            {
+                co_await std::move(task);
+            }
+            catch (const std::exception &e)
+            {
+                spdlog::get("logger")->error("[coro] detached task failed: {}", e.what());
+            }
+        }
+    } // namespace detail
+
+    // Запустить и забыть: задача живёт, пока не закончится, результат выбрасывается
+    template <class T>
+    void spawn(Task<T> task)
+    {
+        detail::run_detached(std::move(task));
+    }
+
+    namespace detail
+    {
+        struct WhenAllState
+        {
+            std::atomic<std::size_t> remaining{0};
+            std::coroutine_handle<> parent;
+            std::exception_ptr error;
+            std::mutex error_mutex;
+
+            void finish_one()
+            {
+                if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                {
+                    parent.resume();
+                }
+            }
+        };
+
+        template <class Slot, class T>
+        Detached run_one(Task<T> &task, Slot &slot, WhenAllState &state)
+        {
+            try
+            {
+                if constexpr (std::is_void_v<T>)
+                {
+                    co_await task;
+                }
+                else
+                {
+                    slot.emplace(co_await task);
+                }
+            }
+            catch (...)
+            {
+                std::lock_guard lk(state.error_mutex);
+                if (!state.error) state.error = std::current_exception();
+            }
+            state.finish_one();
+        }
+
+        template <class T>
+        struct WhenAllAwaiter
+        {
+            using Slot = std::conditional_t<std::is_void_v<T>, char, std::optional<T>>;
+
+            std::vector<Task<T>> &tasks;
+            std::vector<Slot> &slots;
+            WhenAllState &state;
+
+            bool await_ready() const noexcept { return tasks.empty(); }
+            bool await_suspend(std::coroutine_handle<> h)
+            {
+                // +1 — сами: пока не раздали все задачи, ни одна не может нас разбудить
+                state.parent = h;
+                state.remaining.store(tasks.size() + 1, std::memory_order_relaxed);
+                for (std::size_t i = 0; i < tasks.size(); ++i)
+                {
+                    run_one(tasks[i], slots[i], state);
+                }
+                return state.remaining.fetch_sub(1, std::memory_order_acq_rel) != 1;
+            }
+            void await_resume() {}
+        };
+    } // namespace detail
+
+    // Все задачи стартуют сразу (каждая до первого co_await), результат — по порядку входа.
+    // Первое исключение пробрасывается после завершения всех.
+    template <class T>
+    Task<std::vector<T>> when_all(std::vector<Task<T>> tasks)
+    {
+        std::vector<std::optional<T>> slots(tasks.size());
+        detail::WhenAllState state;
+        co_await detail::WhenAllAwaiter<T>{tasks, slots, state};
+        if (state.error) std::rethrow_exception(state.error);
+        std::vector<T> out;
+        out.reserve(slots.size());
+        for (auto &s : slots)
+        {
+            out.push_back(std::move(*s));
+        }
+        co_return out;
+    }
+
+    inline Task<void> when_all(std::vector<Task<void>> tasks)
+    {
+        std::vector<char> slots(tasks.size());
+        detail::WhenAllState state;
+        co_await detail::WhenAllAwaiter<void>{tasks, slots, state};
+        if (state.error) std::rethrow_exception(state.error);
+    }
+
+    // Ограничение параллельности: co_await sem.acquire(); ...; sem.release();
+    // release() передаёт разрешение первому ждущему и продолжает его в своём потоке.
+    class AsyncSemaphore
+    {
+    public:
+        explicit AsyncSemaphore(std::size_t permits) : permits_(permits) {}
+
+        struct Acquire
+        {
+            AsyncSemaphore &sem;
+            bool await_ready() noexcept { return false; }
+            bool await_suspend(std::coroutine_handle<> h)
+            {
+                std::lock_guard lk(sem.mutex_);
+                if (sem.permits_ > 0)
+                {
+                    --sem.permits_;
+                    return false;
+                }
+                sem.waiters_.push_back(h);
+                return true;
+            }
+            void await_resume() noexcept {}
+        };
+
+        Acquire acquire() { return Acquire{*this}; }
+
+        void release()
+        {
+            std::coroutine_handle<> next;
+            {
+                std::lock_guard lk(mutex_);
+                if (waiters_.empty())
+                {
+                    ++permits_;
+                    return;
+                }
+                next = waiters_.front();
+                waiters_.pop_front();
+            }
+            next.resume();
+        }
+
+    private:
+        std::mutex mutex_;
+        std::size_t permits_;
+        std::deque<std::coroutine_handle<>> waiters_;
+    };
+
+    namespace detail
+    {
+        // Флаг отмены и запросы, которые сейчас в полёте под этим токеном
+        struct CancelState
+        {
+            std::mutex mutex;
+            bool cancelled = false;
+            std::vector<std::pair<TdInterface *, std::uint64_t>> in_flight;
+        };
+    } // namespace detail
+
+    class CancellationToken
+    {
+    public:
+        CancellationToken() = default;
+        bool cancelled() const
+        {
+            if (!state_) return false;
+            std::lock_guard lk(state_->mutex);
+            return state_->cancelled;
+        }
+
+    private:
+        friend class CancellationSource;
+        friend class QueryAwaiter;
+        explicit CancellationToken(std::shared_ptr<detail::CancelState> s) : state_(std::move(s)) {}
+        std::shared_ptr<detail::CancelState> state_;
+    };
+
+    // Отмена: новые запросы под токеном не уходят, запросы в полёте сразу получают
+    // error(499, "Request cancelled"); поздний ответ TDLib на них просто выбрасывается.
+    class CancellationSource
+    {
+    public:
+        CancellationSource() : state_(std::make_shared<detail::CancelState>()) {}
+        CancellationToken token() const { return CancellationToken(state_); }
+
+        void cancel()
+        {
+            std::vector<std::pair<TdInterface *, std::uint64_t>> in_flight;
+            {
+                std::lock_guard lk(state_->mutex);
+                if (state_->cancelled) return;
+                state_->cancelled = true;
+                in_flight.swap(state_->in_flight);
+            }
+            for (auto [td, query_id] : in_flight)
+            {
+                td->cancel_query(query_id, "Request cancelled");
+            }
+        }
+
+    private:
+        std::shared_ptr<detail::CancelState> state_;
+    };
+
+    // co_await td.query(f) -> TdInterface::Object (ответ или td_api::error).
+    // Обработчик держит только указатель на awaiter — std::function без аллокации.
+    class QueryAwaiter
+    {
+    public:
+        QueryAwaiter(TdInterface &td, td_api::object_ptr<td_api::Function> f, CancellationToken token = {})
+            : td_(td), f_(std::move(f)), token_(std::move(token))
+        {
+        }
+
+        bool await_ready() const noexcept { return false; }
+
+        bool await_suspend(std::coroutine_handle<> h)
+        {
+            handle_ = h;
+            query_id_ = td_.next_query_id();
+            if (auto &s = token_.state_)
+            {
+                std::lock_guard lk(s->mutex);
+                if (s->cancelled)
+                {
+                    result_ = td_api::make_object<td_api::error>(499, "Request cancelled");
+                    return false;
+                }
+                s->in_flight.emplace_back(&td_, query_id_);
+            }
+            // после отправки this может быть уже разрушен (ответ пришёл в другом потоке) — не трогаем
+            td_.send_query_with_id(query_id_, std::move(f_), [this](TdInterface::Object obj)
+                                   {
+                result_ = std::move(obj);
+                handle_.resume(); });
+            return true;
+        }
+
+        TdInterface::Object await_resume()
+        {
+            if (auto &s = token_.state_)
+            {
+                std::lock_guard lk(s->mutex);
+                auto &v = s->in_flight;
+                for (std::size_t i = 0; i < v.size(); ++i)
+                {
+                    if (v[i].second == query_id_)
+                    {
+                        v[i] = v.back();
+                        v.pop_back();
+                        break;
+                    }
+                }
+            }
+            return std::move(result_);
+        }
+
+    private:
+        TdInterface &td_;
+        td_api::object_ptr<td_api::Function> f_;
+        CancellationToken token_;
+        std::coroutine_handle<> handle_;
+        std::uint64_t query_id_ = 0;
+        TdInterface::Object result_;
+    };
+
+    // Ответ нужного типа или nullptr (ошибку, если была, кладёт в error)
+    template <class T>
+    td_api::object_ptr<T> expect(TdInterface::Object obj, td_api::object_ptr<td_api::error> *error = nullptr)
+    {
+        if (obj && obj->get_id() == T::ID)
+        {
+            return td::move_tl_object_as<T>(obj);
+        }
+        if (error)
+        {
+            *error = obj && obj->get_id() == td_api::error::ID
+                         ? td::move_tl_object_as<td_api::error>(obj)
+                         : td_api::make_object<td_api::error>(500, "Unexpected response " + std::to_string(obj ? obj->get_id() : 0));
+        }
+        return nullptr;
+    }
+} // namespace td_coro
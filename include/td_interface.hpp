@@ -2,12 +2,29 @@
 #include <td/telegram/Client.h>
 #include <td/telegram/td_api.h>
 #include <td/telegram/td_api.hpp>
+#include <deque>
 #include <functional>
 #include <map>
 #include <memory>
 #include <string>
 #include <atomic>
+#include <future>
 #include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#include "attribute_index.hpp"
+#include "catalog_series.hpp"
+#include "gift_crawler.hpp"
+#include "gift_inventory.hpp"
+#include "latency_ring.hpp"
+#include "rate_governor.hpp"
+#include "sticker_cache.hpp"
+#include "td_transport.hpp"
+#include "update_filter.hpp"
+#include "upgrade_pipeline.hpp"
+#include "upgrade_template.hpp"
+#include "work_pool.hpp"
 
 namespace td_api = td::td_api;
 
@@ -19,21 +36,72 @@ enum class AgentState
     Testing
 };
 
+// Набор баз и опций TDLib. Lean — для снайпинга: без истории сообщений, секретных чатов
+// и файловой базы, с опциями, урезающими фоновую работу. Full — прежнее поведение плюс file/chat-info базы.
+enum class SessionProfile
+{
+    Lean,
+    Full
+};
+
+std::optional<SessionProfile> parse_session_profile(const std::string &name);
+const char *session_profile_name(SessionProfile profile);
+
+// Где выполняется обработчик ответа. Critical — сразу в потоке loop() (снайпинг, детект,
+// корутины), Bulk — в WorkPool: разбор страниц, файловые операции, логи на сотни строк.
+enum class HandlerClass
+{
+    Critical,
+    Bulk
+};
+
+namespace td_coro
+{
+    template <class T>
+    class Task;
+    class QueryAwaiter;
+    class CancellationToken;
+    class AsyncSemaphore;
+}
+
 class TdInterface
 {
 public:
-    TdInterface(int32_t api_id, const std::string &api_hash);
+    using Object = td::td_api::object_ptr<td::td_api::Object>;
+
+    // transport == nullptr — настоящий ClientManager
+    TdInterface(int32_t api_id, const std::string &api_hash, std::unique_ptr<TdTransport> transport = nullptr);
     void loop();
+    // loop() выходит после ближайшего ответа; будим его безобидным запросом
+    void stop();
     void set_on_authorized_callback(std::function<void()> callback)
     {
         on_authorized_callback_ = std::move(callback);
     }
     void test();
     void test(td_api::int64);
+    // incremental: владелец дочитывается до первой страницы, где всё уже есть в inventory.
+    // Первый раз за сессию и не реже full_refresh_interval владелец обходится целиком:
+    // изменения на старых страницах доходят, а ушедшие подарки вычищаются из inventory/attributes.
+    std::shared_future<CrawlStats> crawl_gifts(std::vector<td_api::int64> owners, bool incremental = false);
+    void set_full_refresh_interval(std::chrono::seconds interval)
+    {
+        std::lock_guard lk(full_crawl_mutex_);
+        full_refresh_interval_ = interval;
+    }
     void check_for_upgrade();
     void upgrade_loop(int);
     void buy_loop(int, td_api::int64);
-    void upgrade_loop(int, const std::vector<std::pair<std::string, std::int64_t>>&);
+    // Цели: (received_gift_id, цена). Можно заменить на лету — цикл подхватит на следующей итерации.
+    using UpgradeTargets = std::vector<std::pair<std::string, std::int64_t>>;
+    void upgrade_loop(int, const UpgradeTargets &);
+    // Замкнутый вариант: depth запросов в полёте на цель, доливка по ответу, не больше rate в секунду
+    void upgrade_pipeline_loop(int depth, double rate, const UpgradeTargets &);
+    const UpgradePipeline &upgrade_pipeline() const { return upgrade_pipeline_; }
+    // какие апдейты доходят до process_update
+    UpdateFilter &update_filter() { return update_filter_; }
+    void set_upgrade_targets(UpgradeTargets targets);
+    std::shared_ptr<const UpgradeTargets> upgrade_targets() const;
 
     std::atomic<bool> checking{false};
     std::atomic<bool> buying{false};  
@@ -41,35 +109,183 @@ public:
     std::atomic<int> received_{0};
     
     void send_query_upgrade(const std::string&, int price);
+    // горячий путь upgrade_loop: без разбора id, только сборка объекта и отправка
+    void send_upgrade(const UpgradeTemplate &t);
+    // то же под своим request_id (пайплайн различает по нему свои запросы)
+    void send_upgrade(const UpgradeTemplate &t, std::uint64_t request_id);
+    void send_query(td::td_api::object_ptr<td::td_api::Function> f, std::function<void(Object)> = {},
+                    HandlerClass handler_class = HandlerClass::Critical);
+    td_api::object_ptr<td_api::MessageSender> make_sender(td_api::int64);
+    // co_await td.query(f) — см. td_coro.hpp
+    td_coro::QueryAwaiter query(td::td_api::object_ptr<td::td_api::Function> f);
+    td_coro::QueryAwaiter query(td::td_api::object_ptr<td::td_api::Function> f, td_coro::CancellationToken token);
+    // Снять обработчик и сразу вызвать его с error(499, reason); false — ответ уже пришёл
+    bool cancel_query(std::uint64_t query_id, const std::string &reason);
+    // getReceivedGift и, если подарок можно улучшить, upgradeGift; true — улучшен
+    td_coro::Task<bool> check_then_upgrade(std::string received_gift_id, std::int64_t price, td_coro::CancellationToken token);
+
+    GiftCrawler &crawler() { return crawler_; }
+    GiftInventory &inventory() { return inventory_; }
+    AttributeIndex &attributes() { return attributes_; }
+    CatalogSeriesWriter &catalog() { return catalog_; }
+    StickerCache &sticker_cache() { return sticker_cache_; }
+    RateGovernor &rate_governor() { return rate_governor_; }
+
+    // Тёплый резерв: второй клиент в том же ClientManager со своей базой (и своей сессией),
+    // авторизуется после основного и простаивает. Когда основной закрывается, активным
+    // атомарно становится резервный, а закрытый пересоздаётся как новый резерв.
+    void enable_standby(std::string database_directory);
+    // Резерв, пересозданный после отказа, stdin не читает (в loop() нельзя, а stdin уже занят командами):
+    // если его база требует входа, он остаётся неготовым до ответа командой standby.
+    // Чего ждёт: "phone", "code", "password", ... или пустая строка
+    std::string standby_waiting_for() const;
+    // Ответ на то, чего ждёт резерв (для registration — "имя фамилия"); false — резерв ничего не ждёт
+    bool standby_login(std::string input);
+
+    // до loop(); действует и на резервный клиент
+    void set_profile(SessionProfile profile) { profile_ = profile; }
+    SessionProfile profile() const { return profile_; }
+    // через сколько после авторизации снять «установившийся» RSS
+    void set_rss_sample_delay(std::chrono::seconds delay) { rss_sample_delay_ = delay; }
+    // resident set из /proc/self/statm
+    static std::size_t rss_bytes();
+    // 0 — Bulk-обработчики тоже в loop() (как раньше); до loop()
+    void set_handler_workers(std::size_t workers);
+    WorkPool::Stats bulk_stats() const;
+    // Сколько loop() был занят разбором ответов (а не ждал TDLib)
+    struct LoopStats
+    {
+        std::uint64_t responses = 0;
+        double busy_ms = 0;
+        double max_stall_ms = 0;
+        std::uint64_t stalls_over_1ms = 0;
+        std::uint64_t stalls_over_10ms = 0;
+    };
+    LoopStats loop_stats() const;
+    bool standby_ready() const { return standby_ready_.load(std::memory_order_relaxed); }
+    int failovers() const { return failovers_.load(std::memory_order_relaxed); }
 private:
-    std::unordered_map<int, std::chrono::steady_clock::time_point> times;
-    std::mutex times_mutex_;
+    friend class td_coro::QueryAwaiter;
+
+    struct Session
+    {
+        std::int32_t client_id = 0;
+        std::string database_directory;
+        td::td_api::object_ptr<td::td_api::AuthorizationState> authorization_state;
+        bool are_authorized = false;
+        bool closing = false;
+        std::uint64_t authentication_query_id = 0;
+    };
+    struct PendingQuery
+    {
+        std::int32_t client_id = 0;
+        std::function<void(Object)> handler;
+        HandlerClass handler_class = HandlerClass::Critical;
+    };
+
+    std::shared_ptr<const UpgradeTargets> upgrade_targets_ = std::make_shared<UpgradeTargets>();
+    mutable std::mutex targets_mutex_;
+    // шаблоны к upgrade_targets_, пересобираются вместе с ними
+    std::shared_ptr<const std::vector<UpgradeTemplate>> upgrade_templates_ = std::make_shared<std::vector<UpgradeTemplate>>();
+    UpgradePipeline upgrade_pipeline_{[this](const UpgradeTemplate &t, std::uint64_t request_id)
+                                      { send_upgrade(t, request_id); }};
+    LatencyRing send_times_;
+    void mark_sent();
+    std::mutex shared_traces_mutex_;
+    std::unordered_map<std::uint64_t, std::deque<std::uint64_t>> shared_traces_;
+    std::atomic<std::size_t> shared_traces_open_{0};
+    std::atomic<std::uint64_t> shared_trace_seq_{0};
     std::string bb = "";
     std::string id = "689019";
-    using Object = td::td_api::object_ptr<td::td_api::Object>;
     void on_authorized();
     std::function<void()> on_authorized_callback_;
-    std::unique_ptr<td::ClientManager> client_manager_;
-    std::int32_t client_id_;
-    std::uint64_t current_query_id_ = 0;
-    std::uint64_t authentication_query_id_ = 0;
+    std::unique_ptr<TdTransport> transport_;
+    // активный клиент; меняется при failover, читается из любых потоков
+    std::atomic<std::int32_t> client_id_{0};
+    std::atomic<std::uint64_t> current_query_id_{0};
     int32_t api_id_;
     std::string api_hash_;
-    td::td_api::object_ptr<td::td_api::AuthorizationState> authorization_state_;
-    bool are_authorized_ = false;
+    // сессии трогает только поток loop()
+    std::map<std::int32_t, std::unique_ptr<Session>> sessions_;
+    std::int32_t standby_id_ = 0;
+    std::string standby_directory_;
+    std::atomic<bool> standby_ready_{false};
+    // id состояния авторизации, на котором резерв ждёт ввода (0 — не ждёт)
+    std::atomic<std::int32_t> standby_waiting_{0};
+    std::mutex standby_input_mutex_;
+    std::optional<std::string> standby_input_;
+    std::atomic<bool> has_standby_input_{false};
+    std::atomic<int> failovers_{0};
+    // момент отказа (steady_clock, нс) — до первого запроса в новый клиент, для метрики
+    std::atomic<std::int64_t> failed_at_ns_{0};
+    std::int64_t failure_started_ns_ = 0;
+    bool authorized_once_ = false;
+    SessionProfile profile_ = SessionProfile::Lean;
+    std::chrono::steady_clock::time_point started_at_ = std::chrono::steady_clock::now();
+    std::chrono::seconds rss_sample_delay_{60};
+    bool startup_reported_ = false;
+    void report_startup();
+    std::string restart_directory_ = "ai_agent_td";
     bool need_restart_ = false;
-    std::map<std::uint64_t, std::function<void(Object)>> handlers_;
+    std::atomic<bool> stopping_{false};
+    std::map<std::uint64_t, PendingQuery> handlers_;
+    std::mutex handlers_mutex_;
+    RateGovernor rate_governor_{20, 5};
+    UpdateFilter update_filter_;
+    GiftCrawler crawler_{*this};
+    std::mutex full_crawl_mutex_;
+    std::unordered_map<td_api::int64, std::chrono::steady_clock::time_point> last_full_crawl_;
+    std::chrono::seconds full_refresh_interval_{3600};
+    GiftInventory inventory_;
+    AttributeIndex attributes_;
+    CatalogSeriesWriter catalog_;
+    StickerCache sticker_cache_{*this};
+    // после всего, что трогают Bulk-обработчики: разрушается первым и дорабатывает очередь
+    std::unique_ptr<WorkPool> bulk_pool_ = std::make_unique<WorkPool>(2);
+    std::atomic<std::uint64_t> loop_responses_{0};
+    std::atomic<std::int64_t> loop_busy_ns_{0};
+    std::atomic<std::int64_t> loop_max_ns_{0};
+    std::atomic<std::uint64_t> loop_stalls_1ms_{0};
+    std::atomic<std::uint64_t> loop_stalls_10ms_{0};
+    void record_loop_busy(std::chrono::steady_clock::duration busy);
+    // в bulk_pool_, а без него — сразу на месте
+    void offload(WorkJob job);
     void restart();
+    Session &create_session(std::string database_directory);
+    void create_standby();
+    void failover(Session &failed);
+    void on_closed(std::int32_t client_id);
+    void mark_recovered();
+    // true — сессия резервная после первой авторизации: не спрашиваем, ждём команды standby
+    bool defer_standby_login(Session &session, bool active);
+    // в loop(): отправить ввод из standby_login() резервной сессии
+    void apply_standby_input();
+    void fail_pending(std::int32_t client_id, const std::string &reason);
+    // trace_id — id async-события в трассе (0 — сам query_id)
+    void send_raw(std::int32_t client_id, std::uint64_t query_id, td::td_api::object_ptr<td::td_api::Function> f,
+                  std::uint64_t trace_id = 0);
+    // Запросы с общим query_id (123456789, 987654321, 900000000+N) в трассе различаются своим id:
+    // открытые лежат в очереди по query_id, ответ закрывает самый старый. 0 — трассировка выключена / нет открытого.
+    static constexpr std::uint64_t kSharedTraceBase = 1ULL << 56;
+    static bool shared_query_id(std::uint64_t query_id);
+    std::uint64_t begin_shared_trace(std::uint64_t query_id);
+    std::uint64_t end_shared_trace(std::uint64_t query_id);
+    void send_to(Session &session, td::td_api::object_ptr<td::td_api::Function> f, std::function<void(Object)> handler);
     std::uint64_t next_query_id();
-    td_api::object_ptr<td_api::MessageSender> make_sender(td_api::int64);
-    void send_query(td::td_api::object_ptr<td::td_api::Function> f, std::function<void(Object)> = {});
+    void send_query_with_id(std::uint64_t query_id, td::td_api::object_ptr<td::td_api::Function> f, std::function<void(Object)> handler,
+                            HandlerClass handler_class = HandlerClass::Critical);
+    td_coro::Task<void> test_flow();
+    td_coro::Task<bool> upgrade_gift(std::string received_gift_id, std::int64_t price, td_coro::CancellationToken token);
+    td_coro::Task<void> buy_gifts(std::vector<td_api::int64> gift_ids, td_api::int64 owner_id);
+    td_coro::Task<bool> buy_gift(td_api::int64 gift_id, td_api::int64 owner_id, td_coro::AsyncSemaphore &limit);
     void send_query_check();
     void send_query_upgrade();
-    void process_response(td::ClientManager::Response response);
+    void process_response(TdTransport::Response response);
+    void on_received_gift(td_api::int64 owner, td_api::receivedGift &rg);
     void process_update(td::td_api::object_ptr<td::td_api::Object> update);
-    void on_authorization_state_update();
-    void check_authentication_error(Object object);
-    std::function<void(TdInterface::Object)> create_authentication_query_handler();
+    void on_authorization_state_update(Session &session);
+    void check_authentication_error(std::int32_t client_id, Object object);
+    std::function<void(TdInterface::Object)> create_authentication_query_handler(Session &session);
     std::string get_user_name(std::int64_t user_id) const;
     std::string get_chat_title(std::int64_t chat_id) const;
 };
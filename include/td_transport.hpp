@@ -0,0 +1,32 @@
+#pragma once
+#include <td/telegram/Client.h>
+#include <td/telegram/td_api.h>
+#include <cstdint>
+
+// То, через что TdInterface говорит с TDLib: create_client_id/send/receive ClientManager'а.
+// Подменяется SimTransport'ом для прогонов без аккаунта (PGO-тренировка, замеры).
+class TdTransport
+{
+public:
+    using Response = td::ClientManager::Response;
+
+    virtual ~TdTransport() = default;
+    virtual std::int32_t create_client_id() = 0;
+    virtual void send(std::int32_t client_id, std::uint64_t request_id, td::td_api::object_ptr<td::td_api::Function> request) = 0;
+    // как ClientManager::receive: пустой object — таймаут
+    virtual Response receive(double timeout) = 0;
+};
+
+class ClientManagerTransport final : public TdTransport
+{
+public:
+    std::int32_t create_client_id() override { return manager_.create_client_id(); }
+    void send(std::int32_t client_id, std::uint64_t request_id, td::td_api::object_ptr<td::td_api::Function> request) override
+    {
+        manager_.send(client_id, request_id, std::move(request));
+    }
+    Response receive(double timeout) override { return manager_.receive(timeout); }
+
+private:
+    td::ClientManager manager_;
+};
@@ -0,0 +1,65 @@
+#pragma once
+#include "image_encoders.hpp"
+#include "thread_pool.hpp"
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class AssetIndex;
+
+struct RenderOptions
+{
+    RenderFormat format = RenderFormat::Gif;
+    int width = 512;
+    int height = 512;
+    // кадры исходника прореживаются до этой частоты (в GIF задержка кратна 10 мс)
+    int fps = 30;
+};
+
+// TGS (gzip'нутый Lottie JSON) -> GIF/WebP/APNG/PNG через rlottie.
+// Кадры одной анимации рендерятся параллельно на пуле: у каждого потока свой rlottie::Animation.
+class TgsRenderer
+{
+public:
+    using Done = std::function<void(const std::filesystem::path &out)>;
+
+    explicit TgsRenderer(std::size_t threads = std::thread::hardware_concurrency());
+    ~TgsRenderer();
+
+    static bool gunzip(const std::filesystem::path &src, std::string &json);
+    bool render_frames(const std::string &json, const RenderOptions &opts, RenderedAnimation &out);
+    bool convert(const std::filesystem::path &src, const std::filesystem::path &dst, const RenderOptions &opts);
+
+    // Ставит конвертацию в очередь (по одной анимации за раз, каждая — на всех ядрах).
+    // done вызывается, когда dst готов; если dst уже есть — сразу.
+    // С индексом ассетов done получает путь канонического ассета рядом с dst
+    // (<asset>.<ext>), и одинаковые анимации рендерятся один раз.
+    void convert_async(std::filesystem::path src, std::filesystem::path dst, RenderOptions opts, Done done);
+    void set_asset_index(AssetIndex *index);
+
+private:
+    struct Job
+    {
+        std::filesystem::path src;
+        std::filesystem::path dst;
+        RenderOptions opts;
+    };
+    void dispatcher();
+
+    ThreadPool pool_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Job> jobs_;
+    std::unordered_map<std::string, std::vector<Done>> waiting_;
+    bool stop_ = false;
+    AssetIndex *assets_ = nullptr;
+    std::thread dispatcher_;
+};
@@ -0,0 +1,90 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Простой пул потоков с общей очередью для CPU-задач (рендер, кодирование).
+class ThreadPool
+{
+public:
+    explicit ThreadPool(std::size_t threads = std::thread::hardware_concurrency())
+    {
+        if (threads == 0)
+        {
+            threads = 1;
+        }
+        workers_.reserve(threads);
+        for (std::size_t i = 0; i < threads; ++i)
+        {
+            workers_.emplace_back([this]
+                                  { worker(); });
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard lk(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto &t : workers_)
+        {
+            t.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    std::size_t size() const { return workers_.size(); }
+
+    template <class F>
+    auto submit(F &&f) -> std::future<std::invoke_result_t<std::decay_t<F>>>
+    {
+        using R = std::invoke_result_t<std::decay_t<F>>;
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+        auto result = task->get_future();
+        {
+            std::lock_guard lk(mutex_);
+            tasks_.emplace_back([task]
+                                { (*task)(); });
+        }
+        cv_.notify_one();
+        return result;
+    }
+
+private:
+    void worker()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock lk(mutex_);
+                cv_.wait(lk, [this]
+                         { return stop_ || !tasks_.empty(); });
+                if (tasks_.empty())
+                {
+                    return;
+                }
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+};
@@ -0,0 +1,94 @@
+#pragma once
+#include <td/telegram/td_api.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace td_api = td::td_api;
+
+// Что делать с апдейтом данного типа до process_update
+enum class UpdateRule : std::uint8_t
+{
+    Drop,
+    Pass,
+    // только из чатов списка (и личных, если allow_private)
+    Chats
+};
+
+const char *update_rule_name(UpdateRule rule);
+std::optional<UpdateRule> parse_update_rule(const std::string &s);
+
+// Фильтр апдейтов на потоке loop(): по id типа (open addressing, без аллокаций и мьютексов;
+// список чатов — снимок через atomic<shared_ptr>)
+// решает, разбирать ли объект дальше. Для Chats берётся только chat_id — одно поле,
+// без downcast_call. Заодно считает, сколько апдейтов каждого типа пришло и сколько отброшено.
+class UpdateFilter
+{
+public:
+    struct TypeStats
+    {
+        std::int32_t id = 0;
+        std::string name;
+        UpdateRule rule = UpdateRule::Drop;
+        std::uint64_t seen = 0;
+        std::uint64_t dropped = 0;
+    };
+
+    // Правила по умолчанию: updateNewMessage — только управляющий чат и личка, остальное process_update
+    // всё равно не разбирает и отбрасывается сразу
+    UpdateFilter();
+
+    // true — апдейт нужен process_update
+    bool pass(const td_api::Object &update);
+
+    void set_rule(std::int32_t type_id, UpdateRule rule);
+    // для типов без своего правила
+    void set_default_rule(UpdateRule rule) { default_rule_.store(rule, std::memory_order_relaxed); }
+    UpdateRule default_rule() const { return default_rule_.load(std::memory_order_relaxed); }
+    void allow_chat(std::int64_t chat_id);
+    void deny_chat(std::int64_t chat_id);
+    void set_allow_private(bool allow) { allow_private_.store(allow, std::memory_order_relaxed); }
+    bool allow_private() const { return allow_private_.load(std::memory_order_relaxed); }
+    std::vector<std::int64_t> chats() const;
+
+    // "updateChatReadInbox" или число; имена — из известных типов и уже встреченных
+    std::optional<std::int32_t> type_id(const std::string &name) const;
+    // по убыванию seen
+    std::vector<TypeStats> stats() const;
+    // апдейты, типу которых не хватило слота (считались по правилу по умолчанию)
+    std::uint64_t overflow() const { return overflow_.load(std::memory_order_relaxed); }
+    void reset_counters();
+
+private:
+    static constexpr std::size_t kSlots = 512; // типов апдейтов в TDLib ~200
+    static constexpr std::size_t kNameSize = 48;
+
+    struct Slot
+    {
+        std::atomic<std::int32_t> id{0}; // 0 — пусто: у TL-конструкторов id не бывает нулём
+        std::atomic<std::uint8_t> rule{0};   // 0 — своего правила нет, иначе UpdateRule + 1
+        std::atomic<std::uint8_t> naming{0}; // 0 — без имени, 1 — пишется, 2 — готово
+        char name[kNameSize] = {};
+        std::atomic<std::uint64_t> seen{0};
+        std::atomic<std::uint64_t> dropped{0};
+    };
+
+    // найти или занять слот; nullptr — таблица полна
+    Slot *slot(std::int32_t id);
+    // имя пишет тот, кто первым перевёл naming 0 -> 1
+    static void set_name(Slot &s, const std::string &name);
+    bool chat_allowed(std::int64_t chat_id) const;
+
+    std::array<Slot, kSlots> slots_;
+    std::atomic<UpdateRule> default_rule_{UpdateRule::Drop};
+    std::atomic<bool> allow_private_{true};
+    std::atomic<std::uint64_t> overflow_{0};
+    // писатели (команды) сериализуются мьютексом и публикуют копию; loop() берёт снимок без блокировки
+    std::mutex chats_mutex_;
+    std::atomic<std::shared_ptr<const std::vector<std::int64_t>>> chats_{std::make_shared<const std::vector<std::int64_t>>()};
+};
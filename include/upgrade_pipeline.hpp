@@ -0,0 +1,98 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "rate_governor.hpp"
+#include "upgrade_template.hpp"
+
+// Замкнутый режим улучшений: по каждой цели в полёте ровно depth запросов.
+// Ответ на запрос цели сразу выпускает следующий (если есть токен общего лимита),
+// иначе «долг» забирает pacer-поток, дождавшись токена.
+// У запросов пайплайна свои request_id (от kRequestBase): query_id шаблона общий с таймерным
+// upgrade_loop и ручными send_upgrade, и их ответы иначе сбивали бы счёт в полёте.
+// Цели с одинаковым query_id делят одну полосу с depth на каждую.
+// Ответ может не прийти (клиент закрылся, TDLib потерял запрос): по kRequestTimeout слот
+// освобождается сам, а при failover/закрытии клиента TdInterface сбрасывает все сразу.
+class UpgradePipeline
+{
+public:
+    static constexpr std::uint64_t kRequestBase = 1ULL << 48;
+    static constexpr std::chrono::seconds kRequestTimeout{10};
+    using Send = std::function<void(const UpgradeTemplate &, std::uint64_t request_id)>;
+
+    struct Stats
+    {
+        std::uint64_t sent = 0;
+        std::uint64_t responses = 0;
+        // ответ пришёл, а токена не было — запрос ушёл через pacer
+        std::uint64_t deferred = 0;
+        // слоты, освобождённые без ответа: по таймауту и reset_in_flight
+        std::uint64_t expired = 0;
+        std::size_t lanes = 0;
+        std::size_t in_flight = 0;
+    };
+
+    explicit UpgradePipeline(Send send) : send_(std::move(send)) {}
+
+    // Pacer в вызывающем потоке: заполняет полосы и доплачивает отложенное,
+    // пока running == true. rate — запросов в секунду на все цели (<= 0 — без лимита).
+    void run(std::shared_ptr<const std::vector<UpgradeTemplate>> templates, int depth, double rate,
+             const std::atomic<bool> &running);
+    // Новый список целей на ходу: полосы с тем же query_id сохраняют счётчик в полёте
+    void retarget(std::shared_ptr<const std::vector<UpgradeTemplate>> templates);
+    // Из process_response. Для своего запроса доливает полосу и возвращает query_id шаблона
+    // (по нему ответ логируется), чужой request_id возвращает как есть.
+    std::uint64_t on_response(std::uint64_t request_id);
+    // Клиент, которому ушли запросы, закрыт: ответов не будет, полосы снова должны по capacity
+    void reset_in_flight();
+
+    bool active() const { return active_.load(std::memory_order_relaxed); }
+    Stats stats() const;
+
+private:
+    struct Lane
+    {
+        std::vector<UpgradeTemplate> templates;
+        std::size_t next = 0;
+        int capacity = 0;
+        int in_flight = 0;
+        int owed = 0;
+    };
+    struct Sent
+    {
+        std::uint64_t query_id;
+        std::uint64_t generation;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    void rebuild_locked(const std::vector<UpgradeTemplate> &templates);
+    // следующий шаблон полосы: учесть в полёте и отправить (под mutex_, шаблоны не копируются)
+    void issue_locked(Lane &lane);
+    // запросы без ответа дольше kRequestTimeout: убрать из sent_ и вернуть слот в долг полосы
+    void expire_locked(std::chrono::steady_clock::time_point now);
+
+    Send send_;
+    RateGovernor rate_;
+    std::atomic<bool> active_{false};
+    const std::atomic<bool> *running_ = nullptr;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<Lane> lanes_;
+    std::unordered_map<std::uint64_t, std::size_t> lane_of_;
+    // request_id -> чей запрос; ответы прошлого запуска (другое поколение) полосы не трогают
+    std::unordered_map<std::uint64_t, Sent> sent_;
+    std::uint64_t next_request_ = kRequestBase;
+    std::uint64_t generation_ = 0;
+    int depth_ = 1;
+    int owed_ = 0;
+    std::size_t scan_ = 0;
+    std::chrono::steady_clock::time_point next_expire_{};
+    Stats stats_;
+};
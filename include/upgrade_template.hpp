@@ -0,0 +1,18 @@
+#pragma once
+#include <td/telegram/td_api.h>
+#include <cstdint>
+#include <string>
+
+// Запрос улучшения, собранный заранее для одной цели: id разобран, query_id посчитан.
+// На отправку остаётся один make_object<upgradeGift> с копией строк — объект потом
+// удаляет сам TDLib обычным delete, так что в пул или арену его не положить.
+struct UpgradeTemplate
+{
+    std::string received_gift_id;
+    std::int64_t price = 0;
+    // 900000000 + числовой id (или его последние 6 цифр) — по нему ответ узнаётся в process_response
+    std::uint64_t query_id = 0;
+
+    static UpgradeTemplate make(const std::string &received_gift_id, std::int64_t price);
+    td::td_api::object_ptr<td::td_api::upgradeGift> build(const std::string &business_connection_id) const;
+};
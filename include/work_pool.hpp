@@ -0,0 +1,87 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Задача без копирования (держит object_ptr ответа) — std::function так не умеет
+class WorkJob
+{
+public:
+    WorkJob() = default;
+    template <class F>
+        requires(!std::is_same_v<std::decay_t<F>, WorkJob>)
+    WorkJob(F f) : impl_(std::make_unique<Impl<F>>(std::move(f)))
+    {
+    }
+
+    void operator()() { impl_->call(); }
+    explicit operator bool() const { return impl_ != nullptr; }
+
+private:
+    struct Base
+    {
+        virtual ~Base() = default;
+        virtual void call() = 0;
+    };
+    template <class F>
+    struct Impl final : Base
+    {
+        explicit Impl(F fn) : f(std::move(fn)) {}
+        void call() override { f(); }
+        F f;
+    };
+    std::unique_ptr<Base> impl_;
+};
+
+// Пул для «тяжёлых» обработчиков ответов (страницы краулера, копирование стикеров),
+// чтобы поток loop() только раскладывал ответы. У каждого воркера своя очередь: submit кладёт
+// по кругу, воркер берёт свою с головы, а опустев — ворует с хвоста чужих.
+class WorkPool
+{
+public:
+    struct Stats
+    {
+        std::uint64_t submitted = 0;
+        std::uint64_t executed = 0;
+        std::uint64_t stolen = 0;
+        std::size_t queued = 0;
+    };
+
+    explicit WorkPool(std::size_t threads);
+    // дорабатывает всё, что уже в очередях
+    ~WorkPool();
+    WorkPool(const WorkPool &) = delete;
+    WorkPool &operator=(const WorkPool &) = delete;
+
+    void submit(WorkJob job);
+    std::size_t threads() const { return threads_.size(); }
+    Stats stats() const;
+
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<WorkJob> jobs;
+    };
+
+    void run(std::size_t index);
+    bool take(std::size_t index, WorkJob &job);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+    std::atomic<std::size_t> next_{0};
+    // сколько задач лежит во всех очередях; под sleep_mutex_ меняется только вместе с notify
+    std::size_t pending_ = 0;
+    bool stop_ = false;
+    mutable std::mutex sleep_mutex_;
+    std::condition_variable cv_;
+    std::atomic<std::uint64_t> submitted_{0};
+    std::atomic<std::uint64_t> executed_{0};
+    std::atomic<std::uint64_t> stolen_{0};
+};
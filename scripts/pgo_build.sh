@@ -0,0 +1,55 @@
+#!/usr/bin/env bash
+# Сборка tg_gifts с LTO + PGO и сравнение горячего пути с обычной сборкой.
+#   1. build-base: Release без LTO/PGO
+#   2. build-pgo:  инструментированная (GENERATE), тренировка на tg_gifts_sim
+#   3. build-pgo:  тот же каталог (пути объектников в профилях GCC), USE + LTO;
+#      общий код — в tg_gifts_core, поэтому профиль с tg_gifts_sim достаётся и tg_gifts
+#      (main.cpp профиля не получает — его в тренировке нет)
+#   4. tg_gifts_sim на обеих сборках без задержки «сети»: перцентили round trip и send_upgrade
+#   scripts/pgo_build.sh [секунд тренировки] [запросов на фазу]
+set -euo pipefail
+
+SECONDS_TRAIN=${1:-10}
+REQUESTS=${2:-20000}
+SRC=$(realpath "$(dirname "$0")/..")
+BASE="$SRC/build-base"
+PGO="$SRC/build-pgo"
+PROFILES="$PGO/pgo-profiles"
+JOBS=$(nproc)
+
+configure() {
+    local dir=$1
+    shift
+    cmake -S "$SRC" -B "$dir" -DCMAKE_BUILD_TYPE=Release "$@" >/dev/null
+}
+
+echo "== baseline"
+configure "$BASE" -DTG_GIFTS_LTO=OFF -DTG_GIFTS_PGO=OFF
+cmake --build "$BASE" -j"$JOBS" --target tg_gifts tg_gifts_sim
+
+echo "== instrumented"
+rm -rf "$PROFILES"
+configure "$PGO" -DTG_GIFTS_LTO=ON -DTG_GIFTS_PGO=GENERATE -DTG_GIFTS_PGO_DIR="$PROFILES"
+cmake --build "$PGO" -j"$JOBS" --target tg_gifts_sim
+"$PGO/tg_gifts_sim" --seconds "$SECONDS_TRAIN" --requests "$REQUESTS"
+
+if ls "$PROFILES"/*.profraw >/dev/null 2>&1; then
+    llvm-profdata merge -o "$PROFILES/default.profdata" "$PROFILES"/*.profraw
+fi
+
+echo "== optimized"
+configure "$PGO" -DTG_GIFTS_LTO=ON -DTG_GIFTS_PGO=USE -DTG_GIFTS_PGO_DIR="$PROFILES"
+# объектники инструментированной сборки под USE не годятся
+cmake --build "$PGO" --target clean
+cmake --build "$PGO" -j"$JOBS" --target tg_gifts tg_gifts_sim
+
+report="$PGO/pgo_report.txt"
+{
+    for build in base pgo; do
+        dir=$BASE
+        [ "$build" = pgo ] && dir=$PGO
+        echo "-- $build"
+        "$dir/tg_gifts_sim" --seconds 3 --requests "$REQUESTS" --latency-us 0 | grep -E '^(roundtrip|send_upgrade|total)'
+    done
+} | tee "$report"
+echo "report: $report, binary: $PGO/tg_gifts"
@@ -0,0 +1,29 @@
+#!/usr/bin/env bash
+# Время до авторизации и RSS для профилей TDLib (lean/full).
+# Каждый профиль запускается на своей копии базы, чтобы переключение профиля не трогало рабочую.
+#   scripts/profile_bench.sh [путь к tg_gifts] [секунд до снятия RSS] [база]
+set -euo pipefail
+
+BIN=${1:-build/tg_gifts}
+SAMPLE_SEC=${2:-60}
+DB=${3:-ai_agent_td}
+: "${TG_API_ID:?TG_API_ID not set}"
+: "${TG_API_HASH:?TG_API_HASH not set}"
+
+BIN=$(realpath "$BIN")
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+for profile in lean full; do
+    dir="$work/$profile"
+    mkdir -p "$dir"
+    cp -r "$DB" "$dir/ai_agent_td"
+    # stdin пустой: команд нет, сокет выключен, ждём второй замер RSS
+    (cd "$dir" && TG_PROFILE=$profile TG_CONTROL_SOCKET=none TG_RSS_SAMPLE_SEC=$SAMPLE_SEC \
+        timeout $((SAMPLE_SEC + 10)) "$BIN" </dev/null 2>"$dir/log" >/dev/null) || true
+    if ! grep -F '[profile]' "$dir/log"; then
+        echo "$profile: no [profile] lines (база не авторизована?), хвост лога:"
+        tail -n 5 "$dir/log"
+    fi
+    echo "$profile: database $(du -sh "$dir/ai_agent_td" | cut -f1)"
+done
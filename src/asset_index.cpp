@@ -0,0 +1,442 @@
+#include "asset_index.hpp"
+#include "tgs_renderer.hpp"
+
+#include <nlohmann/json.hpp>
+#include <rlottie.h>
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    // Размер рендера для dHash: 64x64 хватает, чтобы отличать модели, и стоит ~1 мс на кадр
+    constexpr int kHashSide = AssetFingerprint::kSide;
+
+    std::uint64_t fnv1a(const std::string &s)
+    {
+        std::uint64_t h = 1469598103934665603ull;
+        for (unsigned char c : s)
+        {
+            h ^= c;
+            h *= 1099511628211ull;
+        }
+        return h;
+    }
+
+    std::string to_hex(std::uint64_t v)
+    {
+        char buf[17];
+        std::snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(v));
+        return buf;
+    }
+
+    std::uint64_t from_hex(const std::string &s)
+    {
+        return std::stoull(s, nullptr, 16);
+    }
+
+    // premultiplied ARGB -> яркость (поверх чёрного) -> сетка 9x8 -> бит "левее темнее правого"
+    std::uint64_t dhash(const std::vector<std::uint32_t> &argb)
+    {
+        std::uint32_t cells[8][9] = {};
+        for (int cy = 0; cy < 8; ++cy)
+        {
+            const int y0 = cy * kHashSide / 8, y1 = (cy + 1) * kHashSide / 8;
+            for (int cx = 0; cx < 9; ++cx)
+            {
+                const int x0 = cx * kHashSide / 9, x1 = (cx + 1) * kHashSide / 9;
+                std::uint32_t sum = 0;
+                for (int y = y0; y < y1; ++y)
+                {
+                    for (int x = x0; x < x1; ++x)
+                    {
+                        const std::uint32_t p = argb[static_cast<std::size_t>(y) * kHashSide + x];
+                        sum += (77 * ((p >> 16) & 0xFF) + 150 * ((p >> 8) & 0xFF) + 29 * (p & 0xFF)) >> 8;
+                    }
+                }
+                cells[cy][cx] = sum / static_cast<std::uint32_t>((y1 - y0) * (x1 - x0));
+            }
+        }
+        std::uint64_t bits = 0;
+        for (int cy = 0; cy < 8; ++cy)
+        {
+            for (int cx = 0; cx < 8; ++cx)
+            {
+                bits = (bits << 1) | (cells[cy][cx] < cells[cy][cx + 1] ? 1u : 0u);
+            }
+        }
+        return bits;
+    }
+
+    // premultiplied ARGB -> средние Cb/Cr (BT.601, поверх чёрного) в клетках 4x4 -> по 4 бита;
+    // 16 клеток по 8 бит — 128 бит, по 64 на каждые две строки клеток
+    std::array<std::uint64_t, 2> chroma(const std::vector<std::uint32_t> &argb)
+    {
+        constexpr int kCell = kHashSide / 4;
+        std::array<std::uint64_t, 2> packed{};
+        for (int cy = 0; cy < 4; ++cy)
+        {
+            for (int cx = 0; cx < 4; ++cx)
+            {
+                std::int32_t cb = 0, cr = 0;
+                for (int y = cy * kCell; y < (cy + 1) * kCell; ++y)
+                {
+                    for (int x = cx * kCell; x < (cx + 1) * kCell; ++x)
+                    {
+                        const std::uint32_t p = argb[static_cast<std::size_t>(y) * kHashSide + x];
+                        const auto r = static_cast<std::int32_t>((p >> 16) & 0xFF);
+                        const auto g = static_cast<std::int32_t>((p >> 8) & 0xFF);
+                        const auto b = static_cast<std::int32_t>(p & 0xFF);
+                        cb += (-43 * r - 85 * g + 128 * b) >> 8;
+                        cr += (128 * r - 107 * g - 21 * b) >> 8;
+                    }
+                }
+                const auto q = [](std::int32_t sum)
+                { return static_cast<std::uint64_t>(std::clamp(sum / (kCell * kCell) + 128, 0, 255) >> 4); };
+                std::uint64_t &half = packed[cy / 2];
+                half = (half << 8) | (q(cb) << 4) | q(cr);
+            }
+        }
+        return packed;
+    }
+
+    // максимум по клеткам |dCb|, |dCr| в ступенях квантования
+    int chroma_step(const std::array<std::uint64_t, 2> &a, const std::array<std::uint64_t, 2> &b)
+    {
+        int worst = 0;
+        for (std::size_t half = 0; half < a.size(); ++half)
+        {
+            for (int shift = 0; shift < 64; shift += 4)
+            {
+                const int d = std::abs(static_cast<int>((a[half] >> shift) & 0xF) - static_cast<int>((b[half] >> shift) & 0xF));
+                worst = std::max(worst, d);
+            }
+        }
+        return worst;
+    }
+} // namespace
+
+void AssetFingerprint::set_frame(std::size_t k, const std::vector<std::uint32_t> &argb)
+{
+    dhash[k] = ::dhash(argb);
+    chroma[k] = ::chroma(argb);
+}
+
+std::size_t AssetFingerprint::distance(const AssetFingerprint &o) const
+{
+    if (total_frames != o.total_frames || fps != o.fps)
+    {
+        return std::numeric_limits<std::size_t>::max();
+    }
+    std::size_t d = 0;
+    for (std::size_t i = 0; i < kFrames; ++i)
+    {
+        if (chroma_step(chroma[i], o.chroma[i]) > kChromaTolerance)
+        {
+            return std::numeric_limits<std::size_t>::max();
+        }
+        d += std::bitset<64>(dhash[i] ^ o.dhash[i]).count();
+    }
+    return d;
+}
+
+AssetIndex::AssetIndex(fs::path path, std::size_t max_distance)
+    : path_(std::move(path)), max_distance_(max_distance), flusher_([this]
+                                                                    { flusher(); })
+{
+}
+
+AssetIndex::~AssetIndex()
+{
+    {
+        std::lock_guard lk(mutex_);
+        stopping_ = true;
+    }
+    flush_cv_.notify_all();
+    flusher_.join();
+    save(true);
+}
+
+void AssetIndex::flusher()
+{
+    std::unique_lock lk(mutex_);
+    while (!stopping_)
+    {
+        flush_cv_.wait_for(lk, min_interval_);
+        if (stopping_ || !dirty_)
+        {
+            continue;
+        }
+        lk.unlock();
+        save(); // сам пропустит, если bind() записал недавно
+        lk.lock();
+    }
+}
+
+bool AssetIndex::fingerprint(const std::string &json, AssetFingerprint &fp)
+{
+    fp.exact = fnv1a(json);
+    auto anim = rlottie::Animation::loadFromData(json, "", "", false);
+    if (!anim)
+    {
+        return false;
+    }
+    fp.total_frames = anim->totalFrame();
+    fp.fps = static_cast<int>(std::lround(anim->frameRate()));
+    if (fp.total_frames == 0)
+    {
+        return false;
+    }
+    // кадры из середин четвертей: первый кадр у многих моделей одинаково пустой
+    std::vector<std::uint32_t> argb(static_cast<std::size_t>(kHashSide) * kHashSide);
+    for (std::size_t k = 0; k < AssetFingerprint::kFrames; ++k)
+    {
+        std::fill(argb.begin(), argb.end(), 0u);
+        rlottie::Surface surface(argb.data(), kHashSide, kHashSide, kHashSide * 4);
+        anim->renderSync(fp.total_frames * (2 * k + 1) / (2 * AssetFingerprint::kFrames), surface);
+        fp.set_frame(k, argb);
+    }
+    return true;
+}
+
+std::string AssetIndex::resolve(const fs::path &tgs)
+{
+    const std::string source = tgs.stem().string();
+    {
+        std::lock_guard lk(mutex_);
+        auto it = sources_.find(source);
+        if (it != sources_.end())
+        {
+            return it->second;
+        }
+    }
+
+    std::string json;
+    AssetFingerprint fp;
+    if (!TgsRenderer::gunzip(tgs, json) || !fingerprint(json, fp))
+    {
+        spdlog::get("logger")->warn("[assets] can't fingerprint {}", tgs.string());
+        return {};
+    }
+
+    std::lock_guard lk(mutex_);
+    return match_locked(source, fp);
+}
+
+std::string AssetIndex::match_locked(const std::string &source, const AssetFingerprint &fp)
+{
+    auto known = sources_.find(source);
+    if (known != sources_.end())
+    {
+        return known->second; // параллельный resolve того же файла успел раньше
+    }
+
+    std::string asset;
+    auto exact = by_exact_.find(fp.exact);
+    if (exact != by_exact_.end())
+    {
+        asset = exact->second;
+        ++stats_.exact_hits;
+    }
+    else
+    {
+        // ассетов порядка числа моделей (сотни), линейный проход дешевле рендера
+        std::size_t best = std::numeric_limits<std::size_t>::max();
+        for (const auto &[key, a] : assets_)
+        {
+            const std::size_t d = a.fp.distance(fp);
+            if (d <= max_distance_ && d < best)
+            {
+                best = d;
+                asset = key;
+            }
+        }
+        if (!asset.empty())
+        {
+            ++stats_.perceptual_hits;
+            assets_[asset].exact.push_back(fp.exact);
+            by_exact_.emplace(fp.exact, asset);
+            spdlog::get("logger")->info("[assets] {} ~ {} (distance {})", source, asset, best);
+        }
+        else
+        {
+            asset = source;
+            assets_.emplace(asset, Asset{fp, {fp.exact}});
+            by_exact_.emplace(fp.exact, asset);
+        }
+    }
+    sources_.emplace(source, asset);
+    dirty_ = true;
+    return asset;
+}
+
+void AssetIndex::bind(const std::string &received_gift_id, const std::string &asset)
+{
+    {
+        std::lock_guard lk(mutex_);
+        auto [it, inserted] = gifts_.try_emplace(received_gift_id, asset);
+        if (!inserted && it->second == asset)
+        {
+            return;
+        }
+        it->second = asset;
+        dirty_ = true;
+    }
+    save();
+}
+
+std::optional<std::string> AssetIndex::asset_of(const std::string &received_gift_id) const
+{
+    std::lock_guard lk(mutex_);
+    auto it = gifts_.find(received_gift_id);
+    if (it == gifts_.end())
+    {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+AssetIndex::Stats AssetIndex::stats() const
+{
+    std::lock_guard lk(mutex_);
+    Stats s = stats_;
+    s.assets = assets_.size();
+    s.sources = sources_.size();
+    s.gifts = gifts_.size();
+    return s;
+}
+
+bool AssetIndex::load()
+{
+    std::ifstream f(path_);
+    if (!f)
+    {
+        spdlog::get("logger")->info("[assets] {} not found, starting empty", path_.string());
+        return false;
+    }
+    try
+    {
+        nlohmann::json j;
+        f >> j;
+        // до версии 2 цветности не было или она хранилась урезанной до нижней половины кадра:
+        // такие отпечатки и склейки по ним не годятся — индекс строится заново по мере рендера
+        if (j.value("version", 1) < kFormatVersion)
+        {
+            spdlog::get("logger")->warn("[assets] {} is format {}, rebuilding with {}", path_.string(),
+                                        j.value("version", 1), kFormatVersion);
+            return false;
+        }
+        std::lock_guard lk(mutex_);
+        for (const auto &[key, a] : j.at("assets").items())
+        {
+            Asset asset;
+            asset.fp.total_frames = a.at("frames").get<std::size_t>();
+            asset.fp.fps = a.at("fps").get<int>();
+            const auto &dh = a.at("dhash");
+            for (std::size_t i = 0; i < AssetFingerprint::kFrames && i < dh.size(); ++i)
+            {
+                asset.fp.dhash[i] = from_hex(dh[i].get<std::string>());
+            }
+            const auto &ch = a.at("chroma");
+            for (std::size_t i = 0; i < AssetFingerprint::kFrames && i < ch.size(); ++i)
+            {
+                const std::string hex = ch[i].get<std::string>();
+                asset.fp.chroma[i] = {from_hex(hex.substr(0, 16)), from_hex(hex.substr(16))};
+            }
+            for (const auto &e : a.at("exact"))
+            {
+                asset.exact.push_back(from_hex(e.get<std::string>()));
+                by_exact_.emplace(asset.exact.back(), key);
+            }
+            if (!asset.exact.empty())
+            {
+                asset.fp.exact = asset.exact.front();
+            }
+            assets_.emplace(key, std::move(asset));
+        }
+        for (const auto &[source, asset] : j.at("sources").items())
+        {
+            sources_.emplace(source, asset.get<std::string>());
+        }
+        for (const auto &[rid, asset] : j.at("gifts").items())
+        {
+            gifts_.emplace(rid, asset.get<std::string>());
+        }
+        spdlog::get("logger")->info("[assets] loaded {}: {} assets, {} sources, {} gifts",
+                                    path_.string(), assets_.size(), sources_.size(), gifts_.size());
+        return true;
+    }
+    catch (const std::exception &e)
+    {
+        spdlog::get("logger")->warn("[assets] can't parse {}: {}", path_.string(), e.what());
+        return false;
+    }
+}
+
+bool AssetIndex::save(bool force)
+{
+    std::lock_guard save_lk(save_mutex_); // один писатель tmp-файла
+    nlohmann::json j;
+    {
+        std::lock_guard lk(mutex_);
+        const auto now = std::chrono::steady_clock::now();
+        if (!dirty_ || (!force && now - saved_at_ < min_interval_))
+        {
+            return true;
+        }
+        auto &assets = j["assets"] = nlohmann::json::object();
+        for (const auto &[key, a] : assets_)
+        {
+            nlohmann::json dh = nlohmann::json::array();
+            for (auto h : a.fp.dhash)
+            {
+                dh.push_back(to_hex(h));
+            }
+            nlohmann::json exact = nlohmann::json::array();
+            for (auto h : a.exact)
+            {
+                exact.push_back(to_hex(h));
+            }
+            nlohmann::json ch = nlohmann::json::array();
+            for (const auto &h : a.fp.chroma)
+            {
+                ch.push_back(to_hex(h[0]) + to_hex(h[1]));
+            }
+            assets[key] = {{"frames", a.fp.total_frames}, {"fps", a.fp.fps}, {"dhash", dh}, {"chroma", ch}, {"exact", exact}};
+        }
+        j["version"] = kFormatVersion;
+        j["sources"] = sources_;
+        j["gifts"] = gifts_;
+        dirty_ = false;
+        saved_at_ = now;
+    }
+
+    const fs::path tmp = path_.string() + ".tmp";
+    {
+        std::ofstream f(tmp, std::ios::trunc);
+        f << j.dump();
+        if (!f)
+        {
+            spdlog::get("logger")->warn("[assets] can't write {}", tmp.string());
+            std::lock_guard lk(mutex_);
+            dirty_ = true;
+            return false;
+        }
+    }
+    std::error_code ec;
+    fs::rename(tmp, path_, ec);
+    if (ec)
+    {
+        spdlog::get("logger")->warn("[assets] can't move {} -> {}: {}", tmp.string(), path_.string(), ec.message());
+        std::lock_guard lk(mutex_);
+        dirty_ = true;
+        return false;
+    }
+    return true;
+}
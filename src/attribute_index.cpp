@@ -0,0 +1,316 @@
+#include "attribute_index.hpp"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+
+namespace
+{
+    constexpr std::uint32_t kNone = std::numeric_limits<std::uint32_t>::max();
+
+    std::string trim(const std::string &s)
+    {
+        const auto b = s.find_first_not_of(' ');
+        if (b == std::string::npos)
+        {
+            return {};
+        }
+        return s.substr(b, s.find_last_not_of(' ') - b + 1);
+    }
+} // namespace
+
+std::optional<GiftAttribute> parse_gift_attribute(const std::string &name)
+{
+    if (name == "model") return GiftAttribute::Model;
+    if (name == "backdrop") return GiftAttribute::Backdrop;
+    if (name == "symbol") return GiftAttribute::Symbol;
+    return std::nullopt;
+}
+
+std::optional<AttributeQuery> parse_attribute_query(const std::string &text)
+{
+    static const std::array<std::string, 5> keys = {"model=", "backdrop=", "symbol=", "owner=", "limit="};
+
+    // начала всех "key=" в строке (только на границе слова)
+    std::vector<std::pair<std::size_t, std::size_t>> marks; // позиция, номер ключа
+    for (std::size_t k = 0; k < keys.size(); ++k)
+    {
+        for (auto pos = text.find(keys[k]); pos != std::string::npos; pos = text.find(keys[k], pos + 1))
+        {
+            if (pos == 0 || text[pos - 1] == ' ')
+            {
+                marks.emplace_back(pos, k);
+            }
+        }
+    }
+    std::sort(marks.begin(), marks.end());
+    if (marks.empty() && !trim(text).empty())
+    {
+        return std::nullopt;
+    }
+
+    AttributeQuery q;
+    try
+    {
+        for (std::size_t i = 0; i < marks.size(); ++i)
+        {
+            const auto [pos, k] = marks[i];
+            const std::size_t from = pos + keys[k].size();
+            const std::size_t to = i + 1 < marks.size() ? marks[i + 1].first : text.size();
+            const std::string value = trim(text.substr(from, to - from));
+            switch (k)
+            {
+            case 0: q.model = value; break;
+            case 1: q.backdrop = value; break;
+            case 2: q.symbol = value; break;
+            case 3: q.owner = std::stoll(value); break;
+            case 4: q.limit = std::stoul(value); break;
+            }
+        }
+    }
+    catch (const std::exception &)
+    {
+        return std::nullopt;
+    }
+    return q;
+}
+
+std::uint32_t AttributeIndex::Dictionary::intern(const std::string &name)
+{
+    auto [it, inserted] = ids.try_emplace(name, static_cast<std::uint32_t>(names.size()));
+    if (inserted)
+    {
+        names.push_back(name);
+        postings.emplace_back();
+        counts.push_back(0);
+    }
+    return it->second;
+}
+
+const AttributeIndex::Bitmap *AttributeIndex::Dictionary::find(const std::string &name) const
+{
+    auto it = ids.find(name);
+    return it == ids.end() ? nullptr : &postings[it->second];
+}
+
+void AttributeIndex::set_bit(Bitmap &b, std::uint32_t row)
+{
+    const std::size_t word = row >> 6;
+    if (b.size() <= word)
+    {
+        b.resize(word + 1, 0);
+    }
+    b[word] |= std::uint64_t{1} << (row & 63);
+}
+
+void AttributeIndex::clear_bit(Bitmap &b, std::uint32_t row)
+{
+    const std::size_t word = row >> 6;
+    if (word < b.size())
+    {
+        b[word] &= ~(std::uint64_t{1} << (row & 63));
+    }
+}
+
+void AttributeIndex::place(std::uint32_t row, std::uint32_t attr_id, Dictionary &dict, std::vector<std::uint32_t> &column)
+{
+    if (column[row] == attr_id)
+    {
+        return;
+    }
+    unplace(row, dict, column);
+    set_bit(dict.postings[attr_id], row);
+    ++dict.counts[attr_id];
+    column[row] = attr_id;
+}
+
+void AttributeIndex::unplace(std::uint32_t row, Dictionary &dict, std::vector<std::uint32_t> &column)
+{
+    const std::uint32_t old = column[row];
+    if (old != kNone)
+    {
+        clear_bit(dict.postings[old], row);
+        --dict.counts[old];
+        column[row] = kNone;
+    }
+}
+
+const AttributeIndex::Dictionary &AttributeIndex::dictionary(GiftAttribute attr) const
+{
+    switch (attr)
+    {
+    case GiftAttribute::Backdrop: return backdrops_;
+    case GiftAttribute::Symbol: return symbols_;
+    default: return models_;
+    }
+}
+
+const std::vector<std::uint32_t> &AttributeIndex::column(GiftAttribute attr) const
+{
+    switch (attr)
+    {
+    case GiftAttribute::Backdrop: return backdrop_col_;
+    case GiftAttribute::Symbol: return symbol_col_;
+    default: return model_col_;
+    }
+}
+
+void AttributeIndex::upsert(const InventoryEntry &e)
+{
+    if (!e.upgraded)
+    {
+        return;
+    }
+    std::lock_guard lk(mutex_);
+    const auto next_row = free_rows_.empty() ? static_cast<std::uint32_t>(received_ids_.size()) : free_rows_.back();
+    auto [it, inserted] = rows_.try_emplace(e.received_gift_id, next_row);
+    const std::uint32_t row = it->second;
+    if (inserted)
+    {
+        if (row == received_ids_.size())
+        {
+            received_ids_.push_back(e.received_gift_id);
+            owner_col_.push_back(kNone);
+            model_col_.push_back(kNone);
+            backdrop_col_.push_back(kNone);
+            symbol_col_.push_back(kNone);
+        }
+        else
+        {
+            free_rows_.pop_back();
+            received_ids_[row] = e.received_gift_id;
+        }
+        set_bit(live_, row);
+    }
+    const std::uint32_t owner = owners_.intern(std::to_string(e.owner));
+    if (owner == owner_values_.size())
+    {
+        owner_values_.push_back(e.owner);
+    }
+    place(row, owner, owners_, owner_col_);
+    place(row, models_.intern(e.model), models_, model_col_);
+    place(row, backdrops_.intern(e.backdrop), backdrops_, backdrop_col_);
+    place(row, symbols_.intern(e.symbol), symbols_, symbol_col_);
+}
+
+void AttributeIndex::remove(const std::string &received_gift_id)
+{
+    std::lock_guard lk(mutex_);
+    auto it = rows_.find(received_gift_id);
+    if (it == rows_.end())
+    {
+        return;
+    }
+    const std::uint32_t row = it->second;
+    rows_.erase(it);
+    unplace(row, owners_, owner_col_);
+    unplace(row, models_, model_col_);
+    unplace(row, backdrops_, backdrop_col_);
+    unplace(row, symbols_, symbol_col_);
+    received_ids_[row].clear();
+    clear_bit(live_, row);
+    free_rows_.push_back(row);
+}
+
+std::vector<AttributeIndex::Hit> AttributeIndex::query(const AttributeQuery &q, std::size_t *total) const
+{
+    std::vector<Hit> hits;
+    if (total)
+    {
+        *total = 0;
+    }
+    std::lock_guard lk(mutex_);
+
+    std::vector<const Bitmap *> filters;
+    auto add = [&filters](const Dictionary &dict, const std::optional<std::string> &value)
+    {
+        if (value)
+        {
+            filters.push_back(dict.find(*value));
+        }
+    };
+    add(models_, q.model);
+    add(backdrops_, q.backdrop);
+    add(symbols_, q.symbol);
+    if (q.owner)
+    {
+        add(owners_, std::to_string(*q.owner));
+    }
+    if (std::find(filters.begin(), filters.end(), nullptr) != filters.end())
+    {
+        return hits; // такого значения нет вообще
+    }
+    if (filters.empty())
+    {
+        filters.push_back(&live_); // без фильтров — все живые строки
+    }
+
+    // короче битмап — меньше слов перебирать (хвосты за его концом нулевые)
+    std::sort(filters.begin(), filters.end(), [](const Bitmap *a, const Bitmap *b)
+              { return a->size() < b->size(); });
+    const std::size_t words = filters.front()->size();
+
+    std::size_t matched = 0;
+    for (std::size_t w = 0; w < words; ++w)
+    {
+        std::uint64_t bits = ~std::uint64_t{0};
+        for (const Bitmap *f : filters)
+        {
+            bits &= w < f->size() ? (*f)[w] : 0;
+        }
+        matched += static_cast<std::size_t>(__builtin_popcountll(bits));
+        while (bits && hits.size() < q.limit)
+        {
+            const auto row = static_cast<std::uint32_t>(w * 64 + __builtin_ctzll(bits));
+            bits &= bits - 1;
+            hits.push_back(Hit{received_ids_[row], owner_values_[owner_col_[row]],
+                               models_.names[model_col_[row]], backdrops_.names[backdrop_col_[row]],
+                               symbols_.names[symbol_col_[row]]});
+        }
+    }
+    if (total)
+    {
+        *total = matched;
+    }
+    return hits;
+}
+
+std::vector<AttributeIndex::Rarity> AttributeIndex::rarest(GiftAttribute attr, td_api::int64 owner, std::size_t limit) const
+{
+    std::vector<Rarity> result;
+    std::lock_guard lk(mutex_);
+    const Bitmap *owned = owners_.find(std::to_string(owner));
+    if (!owned)
+    {
+        return result;
+    }
+    const Dictionary &dict = dictionary(attr);
+    const std::vector<std::uint32_t> &col = column(attr);
+
+    std::unordered_map<std::uint32_t, std::size_t> held;
+    for (std::size_t w = 0; w < owned->size(); ++w)
+    {
+        for (std::uint64_t bits = (*owned)[w]; bits; bits &= bits - 1)
+        {
+            ++held[col[w * 64 + __builtin_ctzll(bits)]];
+        }
+    }
+    result.reserve(held.size());
+    for (const auto &[id, n] : held)
+    {
+        result.push_back(Rarity{dict.names[id], n, dict.counts[id]});
+    }
+    std::sort(result.begin(), result.end(), [](const Rarity &a, const Rarity &b)
+              { return a.total != b.total ? a.total < b.total : a.value < b.value; });
+    if (result.size() > limit)
+    {
+        result.resize(limit);
+    }
+    return result;
+}
+
+std::size_t AttributeIndex::size() const
+{
+    std::lock_guard lk(mutex_);
+    return rows_.size();
+}
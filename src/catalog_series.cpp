@@ -0,0 +1,410 @@
+#include "catalog_series.hpp"
+
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    constexpr char kMagic[8] = {'G', 'C', 'A', 'T', 'S', 'E', 'R', '1'};
+    constexpr std::uint32_t kVersion = 1;
+    constexpr std::size_t kHeaderSize = 16; // magic + version + reserved
+
+    constexpr std::uint8_t kKeyframe = 1u << 0;
+
+    void put_varint(std::string &out, std::uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            out.push_back(static_cast<char>(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back(static_cast<char>(v));
+    }
+
+    void put_zigzag(std::string &out, std::int64_t v)
+    {
+        put_varint(out, (static_cast<std::uint64_t>(v) << 1) ^ static_cast<std::uint64_t>(v >> 63));
+    }
+
+    bool get_varint(const std::uint8_t *&p, const std::uint8_t *end, std::uint64_t &v)
+    {
+        v = 0;
+        for (int shift = 0; shift < 64 && p < end; shift += 7)
+        {
+            const std::uint8_t b = *p++;
+            v |= static_cast<std::uint64_t>(b & 0x7F) << shift;
+            if (!(b & 0x80))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool get_zigzag(const std::uint8_t *&p, const std::uint8_t *end, std::int64_t &v)
+    {
+        std::uint64_t u;
+        if (!get_varint(p, end, u))
+        {
+            return false;
+        }
+        v = static_cast<std::int64_t>(u >> 1) ^ -static_cast<std::int64_t>(u & 1);
+        return true;
+    }
+
+    bool write_all(int fd, const char *data, std::size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t n = ::write(fd, data, size);
+            if (n < 0)
+            {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += n;
+            size -= static_cast<std::size_t>(n);
+        }
+        return true;
+    }
+
+    // Длина файла до конца последнего целого кадра (по varint-длинам, тело не разбирается)
+    std::size_t complete_prefix(const std::uint8_t *data, std::size_t size)
+    {
+        const std::uint8_t *p = data + kHeaderSize;
+        const std::uint8_t *end = data + size;
+        const std::uint8_t *good = p;
+        while (p < end)
+        {
+            std::uint64_t len;
+            if (!get_varint(p, end, len) || len > static_cast<std::uint64_t>(end - p))
+            {
+                break;
+            }
+            p += len;
+            good = p;
+        }
+        return static_cast<std::size_t>(good - data);
+    }
+} // namespace
+
+CatalogSeriesWriter::~CatalogSeriesWriter()
+{
+    {
+        std::lock_guard lk(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+    if (fd_ >= 0)
+    {
+        ::close(fd_);
+    }
+}
+
+bool CatalogSeriesWriter::open(const std::string &path)
+{
+    if (fd_ >= 0)
+    {
+        return true;
+    }
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0)
+    {
+        spdlog::get("logger")->warn("[catalog] can't open {}: {}", path, std::strerror(errno));
+        return false;
+    }
+    struct stat st{};
+    if (::fstat(fd, &st) != 0)
+    {
+        spdlog::get("logger")->warn("[catalog] can't stat {}: {}", path, std::strerror(errno));
+        ::close(fd);
+        return false;
+    }
+    if (st.st_size > 0)
+    {
+        const std::size_t size = static_cast<std::size_t>(st.st_size);
+        std::size_t keep = 0;
+        if (size >= kHeaderSize)
+        {
+            void *map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED)
+            {
+                spdlog::get("logger")->warn("[catalog] can't map {}: {}", path, std::strerror(errno));
+                ::close(fd);
+                return false;
+            }
+            const auto *data = static_cast<const std::uint8_t *>(map);
+            if (std::memcmp(data, kMagic, sizeof(kMagic)) != 0)
+            {
+                ::munmap(map, size);
+                spdlog::get("logger")->warn("[catalog] {} is not a catalog series, not appending", path);
+                ::close(fd);
+                return false;
+            }
+            keep = complete_prefix(data, size);
+            ::munmap(map, size);
+        }
+        // оборванный заголовок — файл пишется заново; оборванный кадр — отрезается,
+        // иначе следующие кадры легли бы за мусором и читатель бы их не увидел
+        if (keep < size)
+        {
+            if (::ftruncate(fd, static_cast<off_t>(keep)) != 0)
+            {
+                spdlog::get("logger")->warn("[catalog] can't truncate {}: {}", path, std::strerror(errno));
+                ::close(fd);
+                return false;
+            }
+            spdlog::get("logger")->warn("[catalog] {}: dropped {} bytes of incomplete tail", path, size - keep);
+            st.st_size = static_cast<off_t>(keep);
+        }
+    }
+    if (st.st_size == 0)
+    {
+        char header[kHeaderSize] = {};
+        std::memcpy(header, kMagic, sizeof(kMagic));
+        std::memcpy(header + 8, &kVersion, sizeof(kVersion));
+        if (!write_all(fd, header, sizeof(header)))
+        {
+            spdlog::get("logger")->warn("[catalog] can't write header to {}", path);
+            ::close(fd);
+            return false;
+        }
+    }
+    fd_ = fd;
+    size_ = st.st_size == 0 ? static_cast<std::int64_t>(kHeaderSize) : static_cast<std::int64_t>(st.st_size);
+    thread_ = std::thread([this]
+                          { writer(); });
+    spdlog::get("logger")->info("[catalog] appending snapshots to {} ({} bytes)", path, static_cast<long long>(size_));
+    return true;
+}
+
+void CatalogSeriesWriter::push(CatalogSnapshot snapshot)
+{
+    {
+        std::lock_guard lk(mutex_);
+        if (fd_ < 0)
+        {
+            return;
+        }
+        queue_.push_back(std::move(snapshot));
+    }
+    cv_.notify_one();
+}
+
+std::size_t CatalogSeriesWriter::frames_written() const
+{
+    std::lock_guard lk(mutex_);
+    return frames_;
+}
+
+void CatalogSeriesWriter::encode(CatalogSnapshot &s, std::string &frame)
+{
+    std::sort(s.gifts.begin(), s.gifts.end(), [](const CatalogPoint &a, const CatalogPoint &b)
+              { return a.gift_id < b.gift_id; });
+
+    std::string body;
+    std::size_t count = 0;
+    std::string entries;
+    std::int64_t prev_id = 0;
+    for (const auto &g : s.gifts)
+    {
+        auto [it, inserted] = last_.try_emplace(g.gift_id);
+        Last &last = it->second;
+        if (!keyframe_ && !inserted && last.price == g.price && last.total == g.total && last.remaining == g.remaining)
+        {
+            continue;
+        }
+        if (keyframe_)
+        {
+            last = Last{}; // ключевой кадр — от нуля
+        }
+        put_zigzag(entries, g.gift_id - prev_id);
+        put_zigzag(entries, g.price - last.price);
+        put_zigzag(entries, g.total - last.total);
+        put_zigzag(entries, g.remaining - last.remaining);
+        prev_id = g.gift_id;
+        last = Last{g.price, g.total, g.remaining};
+        ++count;
+    }
+    frame.clear();
+    if (count == 0)
+    {
+        return; // ничего не поменялось — кадр не пишем
+    }
+
+    body.push_back(static_cast<char>(keyframe_ ? kKeyframe : 0));
+    put_zigzag(body, keyframe_ ? s.time_ms : s.time_ms - last_time_);
+    put_varint(body, count);
+    body += entries;
+    put_varint(frame, body.size());
+    frame += body;
+
+    keyframe_ = false;
+    last_time_ = s.time_ms;
+}
+
+void CatalogSeriesWriter::writer()
+{
+    std::string frame;
+    while (true)
+    {
+        std::deque<CatalogSnapshot> batch;
+        {
+            std::unique_lock lk(mutex_);
+            cv_.wait(lk, [this]
+                     { return stop_ || !queue_.empty(); });
+            if (queue_.empty() && stop_)
+            {
+                return;
+            }
+            batch.swap(queue_);
+        }
+
+        std::string out;
+        std::size_t written = 0;
+        for (auto &s : batch)
+        {
+            encode(s, frame);
+            if (!frame.empty())
+            {
+                out += frame;
+                ++written;
+            }
+        }
+        // один write на пачку: O_APPEND + целые кадры, обрыв может испортить только хвост
+        if (!out.empty() && !write_all(fd_, out.data(), out.size()))
+        {
+            spdlog::get("logger")->warn("[catalog] write failed: {}", std::strerror(errno));
+            // encode() уже сдвинул last_ на незаписанные кадры: часть пачки могла лечь в файл —
+            // отрезаем её, а следующий кадр делаем ключевым, он не зависит от last_
+            if (::ftruncate(fd_, static_cast<off_t>(size_)) != 0)
+            {
+                spdlog::get("logger")->warn("[catalog] can't roll back to {} bytes: {}", size_, std::strerror(errno));
+            }
+            keyframe_ = true;
+            last_.clear();
+            continue;
+        }
+        size_ += static_cast<std::int64_t>(out.size());
+        std::lock_guard lk(mutex_);
+        frames_ += written;
+    }
+}
+
+bool CatalogSeriesReader::load(const std::string &path)
+{
+    series_.clear();
+    frames_ = 0;
+    truncated_ = false;
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < kHeaderSize)
+    {
+        ::close(fd);
+        return false;
+    }
+    const std::size_t size = static_cast<std::size_t>(st.st_size);
+    void *map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+    const auto *data = static_cast<const std::uint8_t *>(map);
+    if (std::memcmp(data, kMagic, sizeof(kMagic)) != 0)
+    {
+        ::munmap(map, size);
+        return false;
+    }
+
+    const std::uint8_t *p = data + kHeaderSize;
+    const std::uint8_t *end = data + size;
+    std::int64_t time = 0;
+    std::unordered_map<std::int64_t, Sample> last;
+    while (p < end)
+    {
+        std::uint64_t len;
+        const std::uint8_t *frame_start = p;
+        if (!get_varint(p, end, len) || len > static_cast<std::uint64_t>(end - p))
+        {
+            truncated_ = true;
+            p = frame_start;
+            break;
+        }
+        const std::uint8_t *q = p;
+        const std::uint8_t *frame_end = p + len;
+        p = frame_end;
+
+        if (q >= frame_end)
+        {
+            continue;
+        }
+        const std::uint8_t flags = *q++;
+        std::int64_t dt;
+        std::uint64_t count;
+        if (!get_zigzag(q, frame_end, dt) || !get_varint(q, frame_end, count))
+        {
+            truncated_ = true;
+            break;
+        }
+        const bool key = flags & kKeyframe;
+        time = key ? dt : time + dt;
+        if (key)
+        {
+            // писатель после ключевого кадра (новая сессия, откат) начинает с пустого last_:
+            // подарок, которого в нём нет, позже придёт дельтой от нуля, а не от прошлой сессии
+            last.clear();
+        }
+        // кадр разбирается целиком до применения: битый не должен оставить ряд наполовину обновлённым
+        struct Entry
+        {
+            std::int64_t id, price, total, remaining;
+        };
+        std::vector<Entry> entries;
+        entries.reserve(static_cast<std::size_t>(std::min<std::uint64_t>(count, len)));
+        std::int64_t id = 0;
+        bool ok = true;
+        for (std::uint64_t i = 0; i < count; ++i)
+        {
+            std::int64_t did, dprice, dtotal, dremaining;
+            if (!get_zigzag(q, frame_end, did) || !get_zigzag(q, frame_end, dprice) ||
+                !get_zigzag(q, frame_end, dtotal) || !get_zigzag(q, frame_end, dremaining))
+            {
+                ok = false;
+                break;
+            }
+            id += did;
+            entries.push_back(Entry{id, dprice, dtotal, dremaining});
+        }
+        if (!ok)
+        {
+            truncated_ = true; // дальше дельты считались бы от неверного состояния
+            break;
+        }
+        for (const auto &e : entries)
+        {
+            Sample &prev = last[e.id];
+            Sample s{time, prev.price + e.price, prev.total + e.total, prev.remaining + e.remaining};
+            prev = s;
+            series_[e.id].push_back(s);
+        }
+        ++frames_;
+    }
+    ::munmap(map, size);
+    return true;
+}
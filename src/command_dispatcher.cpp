@@ -0,0 +1,613 @@
+#include "command_dispatcher.hpp"
+#include "td_interface.hpp"
+#include "td_coro.hpp"
+
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <unordered_set>
+
+using nlohmann::json;
+
+namespace
+{
+    json fail(const std::string &error)
+    {
+        return {{"ok", false}, {"error", error}};
+    }
+
+    // ожидаем вид "-100XXXXXXXXX_YYYY..."
+    std::optional<long long> parse_chat_id(const std::string &s)
+    {
+        if (s.rfind("-100", 0) == 0)
+        {
+            auto pos = s.find('_');
+            if (pos != std::string::npos)
+            {
+                try
+                {
+                    return std::stoll(s.substr(0, pos));
+                }
+                catch (...)
+                {
+                }
+            }
+        }
+        return std::nullopt;
+    }
+
+    // "gifts": [{"id", "price"}] прямо в команде или "gifts_file" (по умолчанию gifts.json)
+    bool load_targets(const json &cmd, TdInterface::UpgradeTargets &gifts, std::string &error)
+    {
+        try
+        {
+            json list;
+            if (cmd.contains("gifts"))
+            {
+                list = cmd.at("gifts");
+            }
+            else
+            {
+                const std::string file = cmd.value("gifts_file", std::string("gifts.json"));
+                std::ifstream in(file);
+                if (!in.is_open())
+                {
+                    error = "can't open " + file;
+                    return false;
+                }
+                in >> list;
+            }
+            for (const auto &e : list)
+            {
+                gifts.emplace_back(e.at("id").get<std::string>(), e.at("price").get<std::int64_t>());
+            }
+            return true;
+        }
+        catch (const std::exception &e)
+        {
+            error = e.what();
+            return false;
+        }
+    }
+
+    // Уже улучшенные (по кэшу) не трогаем
+    void drop_upgraded(TdInterface &td, TdInterface::UpgradeTargets &gifts)
+    {
+        gifts.erase(std::remove_if(gifts.begin(), gifts.end(), [&td](const auto &g)
+                                   {
+            auto cached = td.inventory().find(g.first);
+            if (cached && cached->upgraded) {
+                spdlog::get("logger")->info("[upg] {} already upgraded ({}), skipping", g.first, cached->model);
+                return true;
+            }
+            return false; }),
+                    gifts.end());
+    }
+
+    json hit_to_json(const AttributeIndex::Hit &h)
+    {
+        return {{"id", h.received_gift_id}, {"owner", h.owner}, {"model", h.model}, {"backdrop", h.backdrop}, {"symbol", h.symbol}};
+    }
+
+    // {"filter": "backdrop=.. symbol=.."} или те же поля отдельными ключами
+    std::optional<AttributeQuery> query_from_json(const json &cmd)
+    {
+        std::optional<AttributeQuery> q = parse_attribute_query(cmd.value("filter", std::string{}));
+        if (!q)
+        {
+            return std::nullopt;
+        }
+        if (cmd.contains("model")) q->model = cmd.at("model").get<std::string>();
+        if (cmd.contains("backdrop")) q->backdrop = cmd.at("backdrop").get<std::string>();
+        if (cmd.contains("symbol")) q->symbol = cmd.at("symbol").get<std::string>();
+        if (cmd.contains("owner")) q->owner = cmd.at("owner").get<std::int64_t>();
+        if (cmd.contains("limit")) q->limit = cmd.at("limit").get<std::size_t>();
+        return q;
+    }
+} // namespace
+
+CommandDispatcher::CommandDispatcher(TdInterface &td)
+    : td_(td), checks_(std::make_shared<td_coro::CancellationSource>())
+{
+    handlers_["upg"] = [this](const json &c)
+    { return upg(c); };
+    handlers_["targets"] = [this](const json &c)
+    { return targets(c); };
+    handlers_["buy"] = [this](const json &c)
+    { return buy(c); };
+    handlers_["stop"] = [this](const json &c)
+    { return stop(c); };
+    handlers_["stats"] = [this](const json &c)
+    { return stats(c); };
+    handlers_["query"] = [this](const json &c)
+    { return query(c); };
+    handlers_["rarest"] = [this](const json &c)
+    { return rarest(c); };
+    handlers_["upgrade"] = [this](const json &c)
+    {
+        td_.send_query_upgrade(c.at("id").get<std::string>(), c.at("price").get<int>());
+        return json{{"ok", true}};
+    };
+    handlers_["check"] = [this](const json &c)
+    { return check(c); };
+    handlers_["updates"] = [this](const json &c)
+    { return updates(c); };
+    handlers_["standby"] = [this](const json &c)
+    { return standby(c); };
+    handlers_["test"] = [this](const json &c)
+    {
+        if (c.contains("owner"))
+        {
+            td_.test(c.at("owner").get<std::int64_t>());
+        }
+        else
+        {
+            td_.test();
+        }
+        return json{{"ok", true}};
+    };
+    handlers_["on"] = [](const json &)
+    {
+        spdlog::get("output")->info("[State] Set to ACTIVE");
+        return json{{"ok", true}};
+    };
+}
+
+void CommandDispatcher::add(const std::string &name, Handler handler)
+{
+    std::lock_guard lk(mutex_);
+    handlers_[name] = std::move(handler);
+}
+
+json CommandDispatcher::dispatch(const json &cmd)
+{
+    if (!cmd.is_object() || !cmd.contains("cmd") || !cmd.at("cmd").is_string())
+    {
+        return fail("expected {\"cmd\": \"...\"}");
+    }
+    const std::string name = cmd.at("cmd").get<std::string>();
+    Handler handler;
+    {
+        std::lock_guard lk(mutex_);
+        auto it = handlers_.find(name);
+        if (it == handlers_.end())
+        {
+            return fail("unknown command " + name);
+        }
+        handler = it->second;
+    }
+    try
+    {
+        return handler(cmd);
+    }
+    catch (const std::exception &e)
+    {
+        return fail(name + ": " + e.what());
+    }
+}
+
+std::string CommandDispatcher::dispatch_line(const std::string &line)
+{
+    const auto start = line.find_first_not_of(" \t\r");
+    if (start == std::string::npos)
+    {
+        return fail("empty command").dump();
+    }
+    if (line[start] == '{')
+    {
+        json cmd = json::parse(line, nullptr, /*allow_exceptions*/ false);
+        if (cmd.is_discarded())
+        {
+            return fail("bad json").dump();
+        }
+        return dispatch(cmd).dump();
+    }
+    auto cmd = parse_text(line.substr(start));
+    if (!cmd)
+    {
+        return fail("unknown command: " + line).dump();
+    }
+    return dispatch(*cmd).dump();
+}
+
+std::optional<json> CommandDispatcher::parse_text(const std::string &line)
+{
+    std::istringstream in(line);
+    std::string word;
+    in >> word;
+    std::vector<std::string> args;
+    std::string rest;
+    std::getline(in, rest);
+    {
+        std::istringstream a(rest);
+        for (std::string s; a >> s;)
+        {
+            args.push_back(s);
+        }
+    }
+    auto arg = [&args](std::size_t i) -> const std::string *
+    { return i < args.size() ? &args[i] : nullptr; };
+
+    try
+    {
+        if (word == "upg" || word == "targets")
+        {
+            // upg [interval_ms] [gifts_file] [depth]; targets [gifts_file]
+            json cmd{{"cmd", word}};
+            std::size_t next = 0;
+            if (word == "upg" && arg(0))
+            {
+                cmd["interval_ms"] = std::stoi(*arg(next++));
+            }
+            if (arg(next))
+            {
+                cmd["gifts_file"] = *arg(next++);
+            }
+            if (word == "upg" && arg(next))
+            {
+                cmd["depth"] = std::stoi(*arg(next));
+            }
+            return cmd;
+        }
+        if (word == "buy" && arg(0))
+        {
+            json cmd{{"cmd", "buy"}, {"owner", std::stoll(*arg(0))}};
+            if (arg(1))
+            {
+                cmd["interval_ms"] = std::stoi(*arg(1));
+            }
+            return cmd;
+        }
+        if (word == "upgrade" && arg(1))
+        {
+            return json{{"cmd", "upgrade"}, {"id", *arg(0)}, {"price", std::stoi(*arg(1))}};
+        }
+        if (word == "check" && arg(1))
+        {
+            return json{{"cmd", "check"}, {"id", *arg(0)}, {"price", std::stoll(*arg(1))}};
+        }
+        if (word == "test")
+        {
+            json cmd{{"cmd", "test"}};
+            if (arg(0))
+            {
+                cmd["owner"] = std::stoll(*arg(0));
+            }
+            return cmd;
+        }
+        if (word == "stop" || word == "stop_buy" || word == "stop_upg" || word == "stop_check")
+        {
+            // stop [upg|buy|check|all] или stop_upg/stop_buy/stop_check; что-то другое не глушит всё молча
+            if (word != "stop")
+            {
+                return arg(0) ? std::nullopt : std::optional<json>(json{{"cmd", "stop"}, {"what", word.substr(5)}});
+            }
+            if (arg(1))
+            {
+                return std::nullopt;
+            }
+            return json{{"cmd", "stop"}, {"what", arg(0) ? *arg(0) : std::string("all")}};
+        }
+        if (word == "standby")
+        {
+            // standby — чего ждёт резерв; standby <ввод> — ответ (пароль может быть с пробелами)
+            json cmd{{"cmd", "standby"}};
+            const auto from = rest.find_first_not_of(" \t");
+            if (from != std::string::npos)
+            {
+                cmd["input"] = rest.substr(from, rest.find_last_not_of(" \t\r") - from + 1);
+            }
+            return cmd;
+        }
+        if (word == "query")
+        {
+            return json{{"cmd", "query"}, {"filter", rest}};
+        }
+        if (word == "rarest" && arg(0))
+        {
+            return json{{"cmd", "rarest"}, {"attr", *arg(0)}, {"filter", rest.substr(rest.find(*arg(0)) + arg(0)->size())}};
+        }
+        if (word == "stats" || word == "on")
+        {
+            return json{{"cmd", word}};
+        }
+        if (!word.empty())
+        {
+            // свои команды (add): {"cmd": word, "args": [...]}
+            return json{{"cmd", word}, {"args", args}};
+        }
+    }
+    catch (const std::exception &)
+    {
+    }
+    return std::nullopt;
+}
+
+json CommandDispatcher::upg(const json &cmd)
+{
+    const int millis = cmd.value("interval_ms", 25);
+    // depth > 0 — замкнутый режим; лимит по умолчанию тот же, что дал бы таймер
+    const int depth = cmd.value("depth", 0);
+    const double rate = cmd.value("rate", millis > 0 ? 1000.0 / millis : 0.0);
+    // флаг занимаем сразу: между проверкой и стартом цикла второй upg успел бы запустить свой
+    bool idle = false;
+    if (!td_.checking.compare_exchange_strong(idle, true, std::memory_order_acq_rel))
+    {
+        return fail("already checking for upgrades (use targets to replace the list)");
+    }
+    TdInterface::UpgradeTargets gifts;
+    std::string error;
+    if (!load_targets(cmd, gifts, error))
+    {
+        td_.checking.store(false, std::memory_order_release);
+        spdlog::get("logger")->error("[upg] failed to read targets: {}", error);
+        return fail(error);
+    }
+
+    // Находим канальные received_gift_id и дочитываем эти каналы
+    std::unordered_set<long long> channels;
+    for (const auto &[id, price] : gifts)
+    {
+        if (auto cid = parse_chat_id(id))
+        {
+            channels.insert(*cid);
+        }
+    }
+    drop_upgraded(td_, gifts);
+
+    std::vector<td_api::int64> owners(channels.begin(), channels.end());
+    const bool cached = std::all_of(owners.begin(), owners.end(), [this](td_api::int64 owner)
+                                    { return td_.inventory().has_owner(owner); });
+    spdlog::get("logger")->info("[channels] refreshing {} channels ({})", owners.size(), cached ? "cached, not waiting" : "cold");
+    std::shared_future<CrawlStats> loaded;
+    try
+    {
+        loaded = td_.crawl_gifts(std::move(owners), /*incremental*/ true);
+    }
+    catch (...)
+    {
+        td_.checking.store(false, std::memory_order_release);
+        throw;
+    }
+
+    // Стартуем апгрейд-цикл: сразу, если каналы есть в кэше, иначе — как догрузятся
+    const std::size_t count = gifts.size();
+    std::thread([td = &td_, millis, depth, rate, gifts = std::move(gifts), loaded, cached]() mutable
+                {
+        if (!cached) loaded.wait();
+        if (depth > 0) td->upgrade_pipeline_loop(depth, rate, gifts);
+        else td->upgrade_loop(millis, gifts); })
+        .detach();
+    json r{{"ok", true}, {"targets", count}, {"channels", channels.size()}, {"cached", cached}, {"interval_ms", millis}};
+    if (depth > 0)
+    {
+        r["depth"] = depth;
+        r["rate"] = rate;
+    }
+    return r;
+}
+
+json CommandDispatcher::targets(const json &cmd)
+{
+    TdInterface::UpgradeTargets gifts;
+    std::string error;
+    if (!load_targets(cmd, gifts, error))
+    {
+        return fail(error);
+    }
+    drop_upgraded(td_, gifts);
+    const std::size_t count = gifts.size();
+    td_.set_upgrade_targets(std::move(gifts));
+    spdlog::get("logger")->info("[upg] targets replaced: {}", count);
+    return {{"ok", true}, {"targets", count}};
+}
+
+json CommandDispatcher::buy(const json &cmd)
+{
+    const auto owner = cmd.at("owner").get<std::int64_t>();
+    const int millis = cmd.value("interval_ms", 1000);
+    bool idle = false;
+    if (!td_.buying.compare_exchange_strong(idle, true, std::memory_order_acq_rel))
+    {
+        return fail("already buying");
+    }
+    std::thread([td = &td_, millis, owner]()
+                { td->buy_loop(millis, static_cast<td_api::int64>(owner)); })
+        .detach();
+    return {{"ok", true}, {"owner", owner}, {"interval_ms", millis}};
+}
+
+json CommandDispatcher::stop(const json &cmd)
+{
+    const std::string what = cmd.value("what", std::string("all"));
+    if (what != "all" && what != "upg" && what != "buy" && what != "check")
+    {
+        return fail("usage: stop [upg|buy|check|all]");
+    }
+    if (what == "all" || what == "upg")
+    {
+        td_.checking.store(false, std::memory_order_relaxed);
+    }
+    if (what == "all" || what == "buy")
+    {
+        td_.buying.store(false, std::memory_order_relaxed);
+    }
+    if (what == "all" || what == "check")
+    {
+        std::shared_ptr<td_coro::CancellationSource> running;
+        {
+            std::lock_guard lk(mutex_);
+            running = std::exchange(checks_, std::make_shared<td_coro::CancellationSource>());
+        }
+        running->cancel();
+    }
+    return {{"ok", true}};
+}
+
+// Вход резервного клиента после отказа: ввод уходит в loop(), итог — в лог
+json CommandDispatcher::standby(const json &cmd)
+{
+    if (!cmd.contains("input"))
+    {
+        return {{"ok", true}, {"ready", td_.standby_ready()}, {"waiting_for", td_.standby_waiting_for()}};
+    }
+    const std::string waiting = td_.standby_waiting_for();
+    if (!td_.standby_login(cmd.at("input").get<std::string>()))
+    {
+        return fail("standby is not waiting for login input");
+    }
+    return {{"ok", true}, {"sent", waiting}};
+}
+
+// getReceivedGift -> upgradeGift, если можно; отвечает сразу, итог — в лог
+json CommandDispatcher::check(const json &cmd)
+{
+    td_coro::CancellationToken token;
+    {
+        std::lock_guard lk(mutex_);
+        token = checks_->token();
+    }
+    td_coro::spawn(td_.check_then_upgrade(cmd.at("id").get<std::string>(), cmd.at("price").get<std::int64_t>(), std::move(token)));
+    return {{"ok", true}};
+}
+
+json CommandDispatcher::stats(const json &)
+{
+    const auto stickers = td_.sticker_cache().stats();
+    const auto loop = td_.loop_stats();
+    const auto bulk = td_.bulk_stats();
+    const auto pipeline = td_.upgrade_pipeline().stats();
+    return {
+        {"ok", true},
+        {"checking", td_.checking.load()},
+        {"buying", td_.buying.load()},
+        {"profile", session_profile_name(td_.profile())},
+        {"rss_mb", td_.rss_bytes() / 1048576.0},
+        {"standby_ready", td_.standby_ready()},
+        {"failovers", td_.failovers()},
+        {"sent", td_.sent_.load()},
+        {"received", td_.received_.load()},
+        {"targets", td_.upgrade_targets()->size()},
+        {"rate_limit", td_.rate_governor().rate()},
+        {"inventory", td_.inventory().size()},
+        {"upgraded_indexed", td_.attributes().size()},
+        {"catalog_frames", td_.catalog().frames_written()},
+        {"loop", {{"responses", loop.responses}, {"busy_ms", loop.busy_ms}, {"max_stall_ms", loop.max_stall_ms}, {"stalls_over_1ms", loop.stalls_over_1ms}, {"stalls_over_10ms", loop.stalls_over_10ms}}},
+        {"bulk_pool", {{"submitted", bulk.submitted}, {"executed", bulk.executed}, {"stolen", bulk.stolen}, {"queued", bulk.queued}}},
+        {"pipeline", {{"active", td_.upgrade_pipeline().active()}, {"lanes", pipeline.lanes}, {"in_flight", pipeline.in_flight}, {"sent", pipeline.sent}, {"responses", pipeline.responses}, {"deferred", pipeline.deferred}}},
+        {"coro_frames", {{"pooled", td_coro::detail::FramePool::pooled()}, {"heap", td_coro::detail::FramePool::heap()}}},
+        {"stickers", {{"hits", stickers.hits}, {"downloads", stickers.downloads}, {"links", stickers.links}, {"failures", stickers.failures}}},
+    };
+}
+
+json CommandDispatcher::query(const json &cmd)
+{
+    auto q = query_from_json(cmd);
+    if (!q)
+    {
+        return fail("usage: query [model=..] [backdrop=..] [symbol=..] [owner=..] [limit=N]");
+    }
+    auto started = std::chrono::steady_clock::now();
+    std::size_t total = 0;
+    auto hits = td_.attributes().query(*q, &total);
+    auto took = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+    json list = json::array();
+    for (const auto &h : hits)
+    {
+        list.push_back(hit_to_json(h));
+    }
+    return {{"ok", true}, {"total", total}, {"of", td_.attributes().size()}, {"us", took.count()}, {"gifts", list}};
+}
+
+json CommandDispatcher::rarest(const json &cmd)
+{
+    auto attr = parse_gift_attribute(cmd.value("attr", std::string("model")));
+    auto q = query_from_json(cmd);
+    if (!attr || !q || !q->owner)
+    {
+        return fail("usage: rarest model|backdrop|symbol owner=<id> [limit=N]");
+    }
+    auto started = std::chrono::steady_clock::now();
+    auto rows = td_.attributes().rarest(*attr, *q->owner, q->limit);
+    auto took = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+    json list = json::array();
+    for (const auto &r : rows)
+    {
+        list.push_back({{"value", r.value}, {"held", r.held}, {"total", r.total}});
+    }
+    return {{"ok", true}, {"us", took.count()}, {"values", list}};
+}
+
+// updates [list] | drop|pass|chats <тип|default> | allow|deny <chat_id> | private on|off | reset
+json CommandDispatcher::updates(const json &cmd)
+{
+    auto &filter = td_.update_filter();
+    const auto args = cmd.value("args", json::array());
+    // поле JSON-формы или позиционный аргумент текстовой
+    auto arg = [&cmd, &args](std::size_t i, const char *key) -> std::string
+    {
+        if (cmd.contains(key))
+        {
+            return cmd.at(key).is_string() ? cmd.at(key).get<std::string>() : cmd.at(key).dump();
+        }
+        return i < args.size() ? args[i].get<std::string>() : std::string{};
+    };
+    const std::string action = arg(0, "action").empty() ? "list" : arg(0, "action");
+
+    if (auto rule = parse_update_rule(action))
+    {
+        const std::string type = arg(1, "type");
+        if (type == "default")
+        {
+            filter.set_default_rule(*rule);
+            return {{"ok", true}, {"default", update_rule_name(*rule)}};
+        }
+        auto id = filter.type_id(type);
+        if (!id)
+        {
+            return fail("unknown update type: " + type + " (name seen in 'updates' or numeric id)");
+        }
+        filter.set_rule(*id, *rule);
+        return {{"ok", true}, {"type", type}, {"id", *id}, {"rule", update_rule_name(*rule)}};
+    }
+    if ((action == "allow" || action == "deny") && !arg(1, "chat").empty())
+    {
+        const auto chat = std::stoll(arg(1, "chat"));
+        action == "allow" ? filter.allow_chat(chat) : filter.deny_chat(chat);
+        return {{"ok", true}, {"chats", filter.chats()}};
+    }
+    if (action == "private" && !arg(1, "value").empty())
+    {
+        filter.set_allow_private(arg(1, "value") == "on" || arg(1, "value") == "true");
+        return {{"ok", true}, {"private", filter.allow_private()}};
+    }
+    if (action == "reset")
+    {
+        filter.reset_counters();
+        return {{"ok", true}};
+    }
+    if (action != "list")
+    {
+        return fail("usage: updates [list] | drop|pass|chats <type|default> | allow|deny <chat_id> | private on|off | reset");
+    }
+    json types = json::array();
+    std::uint64_t seen = 0, dropped = 0;
+    for (const auto &t : filter.stats())
+    {
+        seen += t.seen;
+        dropped += t.dropped;
+        types.push_back({{"type", t.name}, {"id", t.id}, {"rule", update_rule_name(t.rule)}, {"seen", t.seen}, {"dropped", t.dropped}});
+    }
+    return {
+        {"ok", true},
+        {"seen", seen},
+        {"dropped", dropped},
+        {"overflow", filter.overflow()},
+        {"default", update_rule_name(filter.default_rule())},
+        {"chats", filter.chats()},
+        {"private", filter.allow_private()},
+        {"types", types},
+    };
+}
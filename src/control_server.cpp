@@ -0,0 +1,230 @@
+#include "control_server.hpp"
+#include "request_trace.hpp"
+
+#include <spdlog/spdlog.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+    // строка длиннее — мусор или не наш клиент, соединение закрываем
+    constexpr std::size_t kMaxLine = 1 << 20;
+
+    // ответы, которые клиент не читает: больше — закрываем, а не копим
+    constexpr std::size_t kMaxBacklog = 16 << 20;
+
+    struct Client
+    {
+        int fd;
+        std::string buffer;
+        // ещё не отправленные ответы; пока не пусто, новые команды клиента не читаем
+        std::string out;
+    };
+
+    // Отправляет сколько примет сокет (он неблокирующий), остаток ждёт POLLOUT в run()
+    bool flush(Client &c)
+    {
+        std::size_t sent = 0;
+        while (sent < c.out.size())
+        {
+            ssize_t n = ::send(c.fd, c.out.data() + sent, c.out.size() - sent, MSG_NOSIGNAL);
+            if (n < 0)
+            {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                return false;
+            }
+            sent += static_cast<std::size_t>(n);
+        }
+        c.out.erase(0, sent);
+        return true;
+    }
+} // namespace
+
+ControlServer::ControlServer(std::string path, Handler handler)
+    : path_(std::move(path)), handler_(std::move(handler))
+{
+}
+
+ControlServer::~ControlServer()
+{
+    stop_ = true;
+    if (wake_[1] >= 0)
+    {
+        char c = 0;
+        [[maybe_unused]] auto n = ::write(wake_[1], &c, 1);
+    }
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+    for (int fd : {listen_fd_, wake_[0], wake_[1]})
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+    }
+    if (listen_fd_ >= 0)
+    {
+        ::unlink(path_.c_str());
+    }
+}
+
+bool ControlServer::start()
+{
+    sockaddr_un addr{};
+    if (path_.size() >= sizeof(addr.sun_path))
+    {
+        spdlog::get("logger")->error("[control] socket path too long: {}", path_);
+        return false;
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path_.c_str(), path_.size() + 1);
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        spdlog::get("logger")->error("[control] socket: {}", std::strerror(errno));
+        return false;
+    }
+    // сокет от прошлого (упавшего) запуска
+    ::unlink(path_.c_str());
+    if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || ::listen(fd, 16) != 0)
+    {
+        spdlog::get("logger")->error("[control] bind/listen {}: {}", path_, std::strerror(errno));
+        ::close(fd);
+        return false;
+    }
+    ::chmod(path_.c_str(), 0600); // команды тратят звёзды — только владелец
+    if (::pipe2(wake_, O_CLOEXEC) != 0)
+    {
+        spdlog::get("logger")->error("[control] pipe: {}", std::strerror(errno));
+        ::close(fd);
+        ::unlink(path_.c_str());
+        return false;
+    }
+    listen_fd_ = fd;
+    thread_ = std::thread([this]
+                          { run(); });
+    spdlog::get("logger")->info("[control] listening on {}", path_);
+    return true;
+}
+
+void ControlServer::run()
+{
+    RequestTrace::name_thread("control");
+    std::vector<Client> clients;
+    std::vector<pollfd> fds;
+    char buf[4096];
+
+    while (!stop_)
+    {
+        fds.clear();
+        fds.push_back({wake_[0], POLLIN, 0});
+        fds.push_back({listen_fd_, POLLIN, 0});
+        for (const auto &c : clients)
+        {
+            fds.push_back({c.fd, static_cast<short>(c.out.empty() ? POLLIN : POLLOUT), 0});
+        }
+        if (::poll(fds.data(), fds.size(), -1) < 0)
+        {
+            if (errno == EINTR) continue;
+            spdlog::get("logger")->error("[control] poll: {}", std::strerror(errno));
+            break;
+        }
+        if (fds[0].revents)
+        {
+            break;
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            int cfd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if (cfd >= 0)
+            {
+                clients.push_back(Client{cfd, {}, {}});
+            }
+        }
+
+        // fds[2 + i] соответствует clients[i] на момент poll; новые клиенты — в конце и сюда не попали
+        std::vector<bool> closed(clients.size(), false);
+        for (std::size_t i = 0; i + 2 < fds.size(); ++i)
+        {
+            if (!fds[i + 2].revents)
+            {
+                continue;
+            }
+            Client &c = clients[i];
+            if (!c.out.empty())
+            {
+                // POLLOUT (или ошибка/HUP — тогда send тоже не пройдёт)
+                if (!flush(c))
+                {
+                    closed[i] = true;
+                }
+                continue;
+            }
+            ssize_t n = ::recv(c.fd, buf, sizeof(buf), 0);
+            if (n <= 0)
+            {
+                if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+                closed[i] = true;
+                continue;
+            }
+            c.buffer.append(buf, static_cast<std::size_t>(n));
+            std::size_t pos;
+            while ((pos = c.buffer.find('\n')) != std::string::npos)
+            {
+                std::string line = c.buffer.substr(0, pos);
+                c.buffer.erase(0, pos + 1);
+                if (!line.empty() && line.back() == '\r')
+                {
+                    line.pop_back();
+                }
+                if (line.empty())
+                {
+                    continue;
+                }
+                c.out += handler_(line);
+                c.out += '\n';
+                if (c.out.size() > kMaxBacklog)
+                {
+                    break;
+                }
+            }
+            if (c.out.size() > kMaxBacklog)
+            {
+                spdlog::get("logger")->warn("[control] client doesn't read replies ({} bytes queued), dropping", c.out.size());
+                closed[i] = true;
+            }
+            else if (!flush(c))
+            {
+                closed[i] = true;
+            }
+            else if (c.buffer.size() > kMaxLine)
+            {
+                spdlog::get("logger")->warn("[control] line too long, dropping client");
+                closed[i] = true;
+            }
+        }
+        for (std::size_t i = closed.size(); i-- > 0;)
+        {
+            if (closed[i])
+            {
+                ::close(clients[i].fd);
+                clients.erase(clients.begin() + static_cast<std::ptrdiff_t>(i));
+            }
+        }
+    }
+    for (const auto &c : clients)
+    {
+        ::close(c.fd);
+    }
+}
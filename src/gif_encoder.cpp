@@ -0,0 +1,651 @@
+#include "gif_encoder.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TG_GIFTS_GIF_X86 1
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    constexpr std::uint8_t kTransparent = 255;
+    constexpr int kMaxColors = 255;
+    // пустые слоты палитры: расстояние до них всегда больше любого реального
+    constexpr std::int32_t kFarAway = 4096;
+
+    void put_u16le(std::string &out, std::uint32_t v)
+    {
+        out.push_back(static_cast<char>(v & 0xFF));
+        out.push_back(static_cast<char>((v >> 8) & 0xFF));
+    }
+
+    // ===== палитра =====
+
+    struct Palette
+    {
+        int size = 0;
+        std::uint8_t rgb[256][3] = {};
+    };
+
+    // SoA для SIMD, дополнено до 256 записей
+    struct alignas(32) PaletteSoA
+    {
+        std::int32_t r[256];
+        std::int32_t g[256];
+        std::int32_t b[256];
+        int padded = 0;
+
+        explicit PaletteSoA(const Palette &p)
+        {
+            padded = (p.size + 7) & ~7;
+            for (int i = 0; i < 256; ++i)
+            {
+                bool used = i < p.size;
+                r[i] = used ? p.rgb[i][0] : kFarAway;
+                g[i] = used ? p.rgb[i][1] : kFarAway;
+                b[i] = used ? p.rgb[i][2] : kFarAway;
+            }
+        }
+    };
+
+    struct Bin
+    {
+        std::uint16_t key = 0; // rgb555
+        std::uint32_t count = 0;
+        std::uint64_t sum[3] = {0, 0, 0};
+
+        int channel(int c) const { return (key >> (10 - 5 * c)) & 31; }
+    };
+
+    struct Box
+    {
+        std::size_t begin = 0;
+        std::size_t end = 0;
+        std::uint64_t count = 0;
+        int lo[3] = {31, 31, 31};
+        int hi[3] = {0, 0, 0};
+
+        int longest_axis() const
+        {
+            int axis = 0;
+            for (int c = 1; c < 3; ++c)
+            {
+                if (hi[c] - lo[c] > hi[axis] - lo[axis]) axis = c;
+            }
+            return axis;
+        }
+        std::uint64_t score() const
+        {
+            int axis = longest_axis();
+            return end - begin < 2 ? 0 : count * static_cast<std::uint64_t>(hi[axis] - lo[axis] + 1);
+        }
+    };
+
+    void fit(Box &box, const std::vector<Bin> &bins)
+    {
+        box.count = 0;
+        for (int c = 0; c < 3; ++c)
+        {
+            box.lo[c] = 31;
+            box.hi[c] = 0;
+        }
+        for (std::size_t i = box.begin; i < box.end; ++i)
+        {
+            box.count += bins[i].count;
+            for (int c = 0; c < 3; ++c)
+            {
+                box.lo[c] = std::min(box.lo[c], bins[i].channel(c));
+                box.hi[c] = std::max(box.hi[c], bins[i].channel(c));
+            }
+        }
+    }
+
+    // Median cut по гистограмме rgb555 непрозрачных пикселей всех кадров
+    Palette build_palette(const RenderedAnimation &anim)
+    {
+        std::vector<Bin> hist(1 << 15);
+        for (const auto &frame : anim.frames)
+        {
+            for (std::size_t p = 0; p + 3 < frame.size(); p += 4)
+            {
+                if (frame[p + 3] < 128) continue;
+                const std::uint16_t key = static_cast<std::uint16_t>(((frame[p] >> 3) << 10) | ((frame[p + 1] >> 3) << 5) | (frame[p + 2] >> 3));
+                Bin &bin = hist[key];
+                ++bin.count;
+                bin.sum[0] += frame[p];
+                bin.sum[1] += frame[p + 1];
+                bin.sum[2] += frame[p + 2];
+            }
+        }
+
+        std::vector<Bin> bins;
+        for (std::size_t key = 0; key < hist.size(); ++key)
+        {
+            if (hist[key].count == 0) continue;
+            hist[key].key = static_cast<std::uint16_t>(key);
+            bins.push_back(hist[key]);
+        }
+
+        Palette palette;
+        if (bins.empty())
+        {
+            return palette;
+        }
+
+        std::vector<Box> boxes(1);
+        boxes[0].end = bins.size();
+        fit(boxes[0], bins);
+        while (boxes.size() < static_cast<std::size_t>(kMaxColors))
+        {
+            auto it = std::max_element(boxes.begin(), boxes.end(), [](const Box &a, const Box &b)
+                                       { return a.score() < b.score(); });
+            if (it->score() == 0) break;
+
+            Box box = *it;
+            const int axis = box.longest_axis();
+            std::sort(bins.begin() + box.begin, bins.begin() + box.end, [axis](const Bin &a, const Bin &b)
+                      { return a.channel(axis) < b.channel(axis); });
+            std::uint64_t half = box.count / 2, acc = 0;
+            std::size_t mid = box.begin;
+            while (mid < box.end - 1 && acc + bins[mid].count <= half)
+            {
+                acc += bins[mid++].count;
+            }
+            if (mid == box.begin) ++mid;
+
+            Box left = box, right = box;
+            left.end = mid;
+            right.begin = mid;
+            fit(left, bins);
+            fit(right, bins);
+            *it = left;
+            boxes.push_back(right);
+        }
+
+        for (const Box &box : boxes)
+        {
+            std::uint64_t sum[3] = {0, 0, 0};
+            for (std::size_t i = box.begin; i < box.end; ++i)
+            {
+                for (int c = 0; c < 3; ++c) sum[c] += bins[i].sum[c];
+            }
+            for (int c = 0; c < 3; ++c)
+            {
+                palette.rgb[palette.size][c] = static_cast<std::uint8_t>((sum[c] + box.count / 2) / box.count);
+            }
+            ++palette.size;
+        }
+        return palette;
+    }
+
+    // ===== поиск ближайшего цвета =====
+
+    using NearestFn = std::uint8_t (*)(const PaletteSoA &, int, int, int);
+
+    std::uint8_t nearest_scalar(const PaletteSoA &p, int r, int g, int b)
+    {
+        std::int32_t best = INT32_MAX;
+        int best_i = 0;
+        for (int i = 0; i < p.padded; ++i)
+        {
+            const std::int32_t dr = p.r[i] - r, dg = p.g[i] - g, db = p.b[i] - b;
+            const std::int32_t d = dr * dr + dg * dg + db * db;
+            if (d < best)
+            {
+                best = d;
+                best_i = i;
+            }
+        }
+        return static_cast<std::uint8_t>(best_i);
+    }
+
+#ifdef TG_GIFTS_GIF_X86
+    __attribute__((target("sse4.1"))) std::uint8_t nearest_sse41(const PaletteSoA &p, int r, int g, int b)
+    {
+        const __m128i vr = _mm_set1_epi32(r), vg = _mm_set1_epi32(g), vb = _mm_set1_epi32(b);
+        const __m128i step = _mm_set1_epi32(4);
+        __m128i best = _mm_set1_epi32(INT32_MAX);
+        __m128i best_i = _mm_setzero_si128();
+        __m128i idx = _mm_setr_epi32(0, 1, 2, 3);
+        for (int i = 0; i < p.padded; i += 4)
+        {
+            const __m128i dr = _mm_sub_epi32(_mm_load_si128(reinterpret_cast<const __m128i *>(p.r + i)), vr);
+            const __m128i dg = _mm_sub_epi32(_mm_load_si128(reinterpret_cast<const __m128i *>(p.g + i)), vg);
+            const __m128i db = _mm_sub_epi32(_mm_load_si128(reinterpret_cast<const __m128i *>(p.b + i)), vb);
+            const __m128i d = _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(dr, dr), _mm_mullo_epi32(dg, dg)), _mm_mullo_epi32(db, db));
+            const __m128i closer = _mm_cmplt_epi32(d, best);
+            best = _mm_min_epi32(best, d);
+            best_i = _mm_blendv_epi8(best_i, idx, closer);
+            idx = _mm_add_epi32(idx, step);
+        }
+        alignas(16) std::int32_t dist[4], index[4];
+        _mm_store_si128(reinterpret_cast<__m128i *>(dist), best);
+        _mm_store_si128(reinterpret_cast<__m128i *>(index), best_i);
+        int k = 0;
+        for (int j = 1; j < 4; ++j)
+        {
+            if (dist[j] < dist[k] || (dist[j] == dist[k] && index[j] < index[k])) k = j;
+        }
+        return static_cast<std::uint8_t>(index[k]);
+    }
+
+    __attribute__((target("avx2"))) std::uint8_t nearest_avx2(const PaletteSoA &p, int r, int g, int b)
+    {
+        const __m256i vr = _mm256_set1_epi32(r), vg = _mm256_set1_epi32(g), vb = _mm256_set1_epi32(b);
+        const __m256i step = _mm256_set1_epi32(8);
+        __m256i best = _mm256_set1_epi32(INT32_MAX);
+        __m256i best_i = _mm256_setzero_si256();
+        __m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        for (int i = 0; i < p.padded; i += 8)
+        {
+            const __m256i dr = _mm256_sub_epi32(_mm256_load_si256(reinterpret_cast<const __m256i *>(p.r + i)), vr);
+            const __m256i dg = _mm256_sub_epi32(_mm256_load_si256(reinterpret_cast<const __m256i *>(p.g + i)), vg);
+            const __m256i db = _mm256_sub_epi32(_mm256_load_si256(reinterpret_cast<const __m256i *>(p.b + i)), vb);
+            const __m256i d = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(dr, dr), _mm256_mullo_epi32(dg, dg)),
+                                               _mm256_mullo_epi32(db, db));
+            const __m256i closer = _mm256_cmpgt_epi32(best, d);
+            best = _mm256_min_epi32(best, d);
+            best_i = _mm256_blendv_epi8(best_i, idx, closer);
+            idx = _mm256_add_epi32(idx, step);
+        }
+        alignas(32) std::int32_t dist[8], index[8];
+        _mm256_store_si256(reinterpret_cast<__m256i *>(dist), best);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(index), best_i);
+        int k = 0;
+        for (int j = 1; j < 8; ++j)
+        {
+            if (dist[j] < dist[k] || (dist[j] == dist[k] && index[j] < index[k])) k = j;
+        }
+        return static_cast<std::uint8_t>(index[k]);
+    }
+#endif
+
+    struct NearestImpl
+    {
+        NearestFn fn = nearest_scalar;
+        const char *name = "scalar";
+
+        NearestImpl()
+        {
+#ifdef TG_GIFTS_GIF_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+            {
+                fn = nearest_avx2;
+                name = "avx2";
+            }
+            else if (__builtin_cpu_supports("sse4.1"))
+            {
+                fn = nearest_sse41;
+                name = "sse4.1";
+            }
+#endif
+        }
+    };
+
+    const NearestImpl &nearest_impl()
+    {
+        static const NearestImpl impl;
+        return impl;
+    }
+
+    // Ближайший цвет считается один раз на ячейку rgb666 (ошибка сверху не больше 2 на канал)
+    // и кэшируется в общей для всех кадров таблице; 0xFFFF — ещё не посчитано.
+    class NearestTable
+    {
+    public:
+        explicit NearestTable(const PaletteSoA &palette)
+            : palette_(palette), nearest_(nearest_impl().fn), cells_(1u << 18)
+        {
+            for (auto &c : cells_) c.store(kUnknown, std::memory_order_relaxed);
+        }
+
+        std::uint8_t lookup(std::uint8_t r, std::uint8_t g, std::uint8_t b)
+        {
+            const std::uint32_t cell = (std::uint32_t{r} >> 2) << 12 | (std::uint32_t{g} >> 2) << 6 | (b >> 2);
+            std::uint16_t v = cells_[cell].load(std::memory_order_relaxed);
+            if (v == kUnknown)
+            {
+                v = nearest_(palette_, (r & 0xFC) | 2, (g & 0xFC) | 2, (b & 0xFC) | 2);
+                cells_[cell].store(v, std::memory_order_relaxed);
+            }
+            return static_cast<std::uint8_t>(v);
+        }
+
+    private:
+        static constexpr std::uint16_t kUnknown = 0xFFFF;
+        const PaletteSoA &palette_;
+        NearestFn nearest_;
+        std::vector<std::atomic<std::uint16_t>> cells_;
+    };
+
+    void quantize(const std::vector<std::uint8_t> &rgba, NearestTable &table, bool empty_palette, std::vector<std::uint8_t> &out)
+    {
+        const std::size_t pixels = rgba.size() / 4;
+        out.resize(pixels);
+        for (std::size_t p = 0; p < pixels; ++p)
+        {
+            const std::uint8_t *px = rgba.data() + p * 4;
+            out[p] = (px[3] < 128 || empty_palette) ? kTransparent : table.lookup(px[0], px[1], px[2]);
+        }
+    }
+
+    // ===== LZW =====
+
+    struct GifBitWriter
+    {
+        std::string &out;
+        std::string block;
+        std::uint32_t acc = 0;
+        int bits = 0;
+
+        void put(std::uint32_t code, int width)
+        {
+            acc |= code << bits;
+            bits += width;
+            while (bits >= 8)
+            {
+                byte(static_cast<std::uint8_t>(acc & 0xFF));
+                acc >>= 8;
+                bits -= 8;
+            }
+        }
+        void byte(std::uint8_t b)
+        {
+            block.push_back(static_cast<char>(b));
+            if (block.size() == 255)
+            {
+                flush();
+            }
+        }
+        void flush()
+        {
+            if (block.empty()) return;
+            out.push_back(static_cast<char>(block.size()));
+            out += block;
+            block.clear();
+        }
+        void finish()
+        {
+            if (bits > 0)
+            {
+                byte(static_cast<std::uint8_t>(acc & 0xFF));
+            }
+            acc = 0;
+            bits = 0;
+            flush();
+            out.push_back(0);
+        }
+    };
+
+    void lzw_encode(const std::vector<std::uint8_t> &indices, int min_code_size, std::string &out)
+    {
+        out.push_back(static_cast<char>(min_code_size));
+        GifBitWriter w{out, {}};
+
+        const std::uint32_t clear = 1u << min_code_size;
+        const std::uint32_t eoi = clear + 1;
+        std::uint32_t next = eoi + 1;
+        int width = min_code_size + 1;
+
+        // (prefix << 8 | byte) -> code, открытая адресация
+        constexpr std::size_t kHashSize = 8192;
+        std::vector<std::int32_t> keys(kHashSize, -1);
+        std::vector<std::uint16_t> codes(kHashSize);
+
+        w.put(clear, width);
+        if (indices.empty())
+        {
+            w.put(eoi, width);
+            w.finish();
+            return;
+        }
+
+        std::uint32_t prefix = indices[0];
+        for (std::size_t i = 1; i < indices.size(); ++i)
+        {
+            const std::uint8_t c = indices[i];
+            const std::int32_t key = static_cast<std::int32_t>((prefix << 8) | c);
+            std::size_t h = (static_cast<std::uint32_t>(key) * 2654435761u) & (kHashSize - 1);
+            while (keys[h] != -1 && keys[h] != key)
+            {
+                h = (h + 1) & (kHashSize - 1);
+            }
+            if (keys[h] == key)
+            {
+                prefix = codes[h];
+                continue;
+            }
+
+            w.put(prefix, width);
+            if (next < 4096)
+            {
+                keys[h] = key;
+                codes[h] = static_cast<std::uint16_t>(next++);
+                if (next > (1u << width) && width < 12)
+                {
+                    ++width;
+                }
+            }
+            else
+            {
+                w.put(clear, width);
+                std::fill(keys.begin(), keys.end(), -1);
+                next = eoi + 1;
+                width = min_code_size + 1;
+            }
+            prefix = c;
+        }
+        w.put(prefix, width);
+        // декодер добавит запись после последнего кода и может расширить ширину до EOI
+        if (next == (1u << width) && width < 12)
+        {
+            ++width;
+        }
+        w.put(eoi, width);
+        w.finish();
+    }
+
+    // ===== кадры =====
+
+    struct OutFrame
+    {
+        int x = 0, y = 0, w = 1, h = 1;
+        int dispose = 1; // 1 — оставить, 2 — очистить до фона
+        std::uint32_t delay_cs = 0;
+        std::vector<std::uint8_t> delta; // весь холст, неизменённое = kTransparent
+        std::string data;
+    };
+
+    bool uncovers(const std::vector<std::uint8_t> &canvas, const std::vector<std::uint8_t> &cur)
+    {
+        for (std::size_t p = 0; p < cur.size(); ++p)
+        {
+            if (cur[p] == kTransparent && canvas[p] != kTransparent) return true;
+        }
+        return false;
+    }
+
+    template <class F>
+    void parallel_for(ThreadPool *pool, std::size_t n, F &&fn)
+    {
+        if (!pool || n < 2)
+        {
+            for (std::size_t i = 0; i < n; ++i) fn(i);
+            return;
+        }
+        std::vector<std::future<void>> parts;
+        parts.reserve(n);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            parts.push_back(pool->submit([&fn, i]
+                                         { fn(i); }));
+        }
+        for (auto &p : parts) p.get();
+    }
+} // namespace
+
+GifEncoder::GifEncoder(ThreadPool *pool)
+    : pool_(pool)
+{
+}
+
+const char *GifEncoder::simd_level()
+{
+    return nearest_impl().name;
+}
+
+bool GifEncoder::encode(const RenderedAnimation &anim, std::string &out)
+{
+    const std::size_t pixels = static_cast<std::size_t>(anim.width) * anim.height;
+    if (anim.width <= 0 || anim.height <= 0 || anim.width > 0xFFFF || anim.height > 0xFFFF || anim.frames.empty())
+    {
+        return false;
+    }
+    for (const auto &f : anim.frames)
+    {
+        if (f.size() != pixels * 4) return false;
+    }
+
+    const Palette palette = build_palette(anim);
+    const PaletteSoA soa(palette);
+
+    NearestTable table(soa);
+
+    std::vector<std::vector<std::uint8_t>> indexed(anim.frames.size());
+    parallel_for(pool_, anim.frames.size(), [&](std::size_t i)
+                 { quantize(anim.frames[i], table, palette.size == 0, indexed[i]); });
+
+    // Прямоугольники изменений. Если пиксель становится прозрачным, "не менять" не подходит:
+    // предыдущий кадр растягиваем на весь холст с dispose=2, а этот пишем целиком.
+    const double fps = std::max(1.0, anim.fps);
+    auto timestamp_cs = [fps](std::size_t i)
+    { return static_cast<std::uint32_t>(std::lround(i * 100.0 / fps)); };
+    auto make_full = [&](OutFrame &f)
+    {
+        f.x = f.y = 0;
+        f.w = anim.width;
+        f.h = anim.height;
+    };
+
+    std::vector<OutFrame> frames;
+    std::vector<std::uint8_t> canvas(pixels, kTransparent);
+    for (std::size_t i = 0; i < indexed.size(); ++i)
+    {
+        const auto &cur = indexed[i];
+        const std::uint32_t delay = std::max<std::uint32_t>(2, timestamp_cs(i + 1) - timestamp_cs(i));
+
+        const bool clear = !frames.empty() && uncovers(canvas, cur);
+        if (clear)
+        {
+            frames.back().dispose = 2;
+            make_full(frames.back());
+            std::fill(canvas.begin(), canvas.end(), kTransparent);
+        }
+
+        OutFrame f;
+        f.delay_cs = delay;
+        f.delta.resize(pixels);
+        int x0 = anim.width, y0 = anim.height, x1 = -1, y1 = -1;
+        for (int y = 0; y < anim.height; ++y)
+        {
+            const std::size_t row = static_cast<std::size_t>(y) * anim.width;
+            for (int x = 0; x < anim.width; ++x)
+            {
+                const std::uint8_t c = cur[row + x];
+                const bool changed = c != canvas[row + x];
+                f.delta[row + x] = changed ? c : kTransparent;
+                if (changed)
+                {
+                    x0 = std::min(x0, x);
+                    x1 = std::max(x1, x);
+                    y0 = std::min(y0, y);
+                    y1 = std::max(y1, y);
+                }
+            }
+        }
+
+        if (x1 < 0)
+        {
+            // кадр не изменился — просто дольше показываем предыдущий
+            if (!frames.empty() && !clear)
+            {
+                frames.back().delay_cs += delay;
+                continue;
+            }
+        }
+        else
+        {
+            f.x = x0;
+            f.y = y0;
+            f.w = x1 - x0 + 1;
+            f.h = y1 - y0 + 1;
+        }
+        canvas = cur;
+        frames.push_back(std::move(f));
+    }
+    // на повторе первый кадр ложится поверх последнего
+    if (frames.size() > 1 && uncovers(canvas, indexed.front()))
+    {
+        frames.back().dispose = 2;
+        make_full(frames.back());
+    }
+
+    parallel_for(pool_, frames.size(), [&](std::size_t i)
+                 {
+        OutFrame &f = frames[i];
+        std::vector<std::uint8_t> rect;
+        rect.reserve(static_cast<std::size_t>(f.w) * f.h);
+        for (int y = f.y; y < f.y + f.h; ++y) {
+            const auto row = f.delta.begin() + static_cast<std::ptrdiff_t>(y) * anim.width;
+            rect.insert(rect.end(), row + f.x, row + f.x + f.w);
+        }
+        lzw_encode(rect, 8, f.data);
+        std::vector<std::uint8_t>().swap(f.delta); });
+
+    out.clear();
+    out += "GIF89a";
+    put_u16le(out, static_cast<std::uint32_t>(anim.width));
+    put_u16le(out, static_cast<std::uint32_t>(anim.height));
+    out.push_back(static_cast<char>(0xF7)); // GCT, 256 цветов
+    out.push_back(static_cast<char>(kTransparent));
+    out.push_back(0);
+    for (int i = 0; i < 256; ++i)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            out.push_back(static_cast<char>(i < palette.size ? palette.rgb[i][c] : 0));
+        }
+    }
+    // NETSCAPE2.0: бесконечный повтор
+    out += "\x21\xFF\x0BNETSCAPE2.0\x03\x01";
+    put_u16le(out, 0);
+    out.push_back(0);
+
+    for (const auto &f : frames)
+    {
+        out += "\x21\xF9\x04";
+        out.push_back(static_cast<char>((f.dispose << 2) | 1));
+        put_u16le(out, std::min<std::uint32_t>(f.delay_cs, 0xFFFF));
+        out.push_back(static_cast<char>(kTransparent));
+        out.push_back(0);
+
+        out.push_back(0x2C);
+        put_u16le(out, static_cast<std::uint32_t>(f.x));
+        put_u16le(out, static_cast<std::uint32_t>(f.y));
+        put_u16le(out, static_cast<std::uint32_t>(f.w));
+        put_u16le(out, static_cast<std::uint32_t>(f.h));
+        out.push_back(0);
+        out += f.data;
+    }
+    out.push_back(0x3B);
+    return true;
+}
@@ -0,0 +1,149 @@
+#include "gift_crawler.hpp"
+#include "td_interface.hpp"
+
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+struct GiftCrawler::State
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::pair<td_api::int64, std::string>> pending;
+    std::size_t in_flight = 0;
+    std::size_t active_owners = 0;
+    CrawlStats stats;
+    PageHandler on_page;
+    DoneHandler on_done;
+    std::promise<CrawlStats> done;
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+};
+
+GiftCrawler::GiftCrawler(TdInterface &td, std::size_t max_in_flight)
+    : td_(td), max_in_flight_(max_in_flight == 0 ? 1 : max_in_flight)
+{
+}
+
+std::shared_future<CrawlStats> GiftCrawler::crawl(std::vector<td_api::int64> owners, PageHandler on_page,
+                                                  DoneHandler on_done)
+{
+    std::sort(owners.begin(), owners.end());
+    owners.erase(std::unique(owners.begin(), owners.end()), owners.end());
+
+    auto st = std::make_shared<State>();
+    st->on_page = std::move(on_page);
+    st->on_done = std::move(on_done);
+    st->stats.owners = owners.size();
+    st->active_owners = owners.size();
+    for (auto owner : owners)
+    {
+        st->pending.emplace_back(owner, std::string{});
+    }
+    std::shared_future<CrawlStats> result = st->done.get_future().share();
+
+    std::thread([this, st]() mutable
+                { run(std::move(st)); })
+        .detach();
+    return result;
+}
+
+void GiftCrawler::run(std::shared_ptr<State> st)
+{
+    std::unique_lock lk(st->mutex);
+    while (true)
+    {
+        st->cv.wait(lk, [&]
+                    { return st->active_owners == 0 ||
+                             (!st->pending.empty() && st->in_flight < max_in_flight()); });
+        if (st->active_owners == 0)
+        {
+            break;
+        }
+        auto [owner, offset] = std::move(st->pending.front());
+        st->pending.pop_front();
+        ++st->in_flight;
+        lk.unlock();
+
+        td_.rate_governor().acquire();
+        fetch_page(st, owner, std::move(offset));
+
+        lk.lock();
+    }
+
+    st->stats.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - st->started);
+    CrawlStats stats = st->stats;
+    lk.unlock();
+
+    spdlog::get("output")->info("[crawler] owners={} pages={} gifts={} errors={} in {} ms ({:.1f} pages/s)",
+                                stats.owners, stats.pages, stats.gifts, stats.errors,
+                                stats.elapsed.count(), stats.pages_per_sec());
+    if (st->on_done)
+    {
+        st->on_done(stats);
+    }
+    st->done.set_value(stats);
+}
+
+void GiftCrawler::fetch_page(const std::shared_ptr<State> &st, td_api::int64 owner, std::string offset)
+{
+    auto req = td_api::make_object<td_api::getReceivedGifts>(
+        std::string{},
+        td_.make_sender(owner),
+        /*collection_id*/0,
+        /*exclude_unsaved*/false,
+        /*exclude_saved*/false,
+        /*exclude_unlimited*/false,
+        /*exclude_upgradable*/false,
+        /*exclude_non_upgradable*/false,
+        /*exclude_upgraded*/false,
+        /*sort_by_price*/false,
+        false,
+        false,
+        std::move(offset),
+        /*limit*/100
+    );
+
+    td_.send_query(std::move(req), [st, owner](TdInterface::Object obj)
+                   {
+        bool ok = false;
+        std::size_t count = 0;
+        std::string next_offset;
+
+        if (obj->get_id() == td_api::error::ID) {
+            auto e = td::move_tl_object_as<td_api::error>(obj);
+            spdlog::get("logger")->error("[crawler] owner={} getReceivedGifts: {}", owner, to_string(e));
+        } else if (obj->get_id() != td_api::receivedGifts::ID) {
+            spdlog::get("logger")->error("[crawler] owner={} unexpected object {}", owner, obj->get_id());
+        } else {
+            auto page = td::move_tl_object_as<td_api::receivedGifts>(obj);
+            ok = true;
+            count = page->gifts_.size();
+            bool more = st->on_page ? st->on_page(owner, *page) : true;
+            if (more) {
+                next_offset = std::move(page->next_offset_);
+            }
+        }
+
+        {
+            std::lock_guard lk(st->mutex);
+            --st->in_flight;
+            if (ok) {
+                ++st->stats.pages;
+                st->stats.gifts += count;
+            } else {
+                ++st->stats.errors;
+            }
+            if (!next_offset.empty()) {
+                st->pending.emplace_back(owner, std::move(next_offset));
+            } else {
+                --st->active_owners;
+            }
+        }
+        st->cv.notify_one(); },
+                   HandlerClass::Bulk);
+}
@@ -0,0 +1,378 @@
+#include "gift_inventory.hpp"
+
+#include <spdlog/spdlog.h>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    constexpr char kMagic[8] = {'G', 'I', 'N', 'V', 'E', 'N', 'T', '1'};
+    constexpr std::uint32_t kVersion = 1;
+
+    constexpr std::uint32_t kCanBeUpgraded = 1u << 0;
+    constexpr std::uint32_t kUpgraded = 1u << 1;
+
+    struct FileHeader
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t count;
+        std::uint64_t strings_size;
+    };
+
+    struct StrRef
+    {
+        std::uint32_t offset;
+        std::uint32_t length;
+    };
+
+    // received_gift_id, model, backdrop, symbol
+    struct Record
+    {
+        std::int64_t owner;
+        std::int64_t gift_id;
+        std::int64_t upgrade_price;
+        std::uint32_t flags;
+        std::uint32_t reserved;
+        StrRef strings[4];
+    };
+    static_assert(sizeof(FileHeader) == 24, "inventory header layout");
+    static_assert(sizeof(Record) == 64, "inventory record layout");
+
+    StrRef append_string(std::string &blob, const std::string &s)
+    {
+        StrRef ref{static_cast<std::uint32_t>(blob.size()), static_cast<std::uint32_t>(s.size())};
+        blob += s;
+        return ref;
+    }
+
+    bool write_all(int fd, const void *data, std::size_t size)
+    {
+        const auto *p = static_cast<const char *>(data);
+        while (size > 0)
+        {
+            ssize_t n = ::write(fd, p, size);
+            if (n < 0)
+            {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            p += n;
+            size -= static_cast<std::size_t>(n);
+        }
+        return true;
+    }
+
+    // tmp пишется и fsync'ается целиком до rename: иначе после сбоя питания на месте
+    // старого кэша может оказаться файл нужной длины с нулями
+    bool write_synced(const std::string &tmp, const FileHeader &h, const std::vector<Record> &records,
+                      const std::string &strings)
+    {
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            return false;
+        }
+        const bool ok = write_all(fd, &h, sizeof(h)) &&
+                        write_all(fd, records.data(), records.size() * sizeof(Record)) &&
+                        write_all(fd, strings.data(), strings.size()) && ::fsync(fd) == 0;
+        return ::close(fd) == 0 && ok;
+    }
+} // namespace
+
+bool InventoryEntry::operator==(const InventoryEntry &o) const
+{
+    return received_gift_id == o.received_gift_id && owner == o.owner && gift_id == o.gift_id &&
+           upgrade_price == o.upgrade_price && can_be_upgraded == o.can_be_upgraded &&
+           upgraded == o.upgraded && model == o.model && backdrop == o.backdrop && symbol == o.symbol;
+}
+
+InventoryEntry make_inventory_entry(td_api::int64 owner, const td_api::receivedGift &rg)
+{
+    InventoryEntry e;
+    e.received_gift_id = rg.received_gift_id_;
+    e.owner = owner;
+    e.can_be_upgraded = rg.can_be_upgraded_;
+    if (!rg.gift_)
+    {
+        return e;
+    }
+    switch (rg.gift_->get_id())
+    {
+    case td_api::sentGiftRegular::ID:
+    {
+        const auto &reg = static_cast<const td_api::sentGiftRegular &>(*rg.gift_);
+        if (reg.gift_)
+        {
+            e.gift_id = reg.gift_->id_;
+            e.upgrade_price = reg.gift_->upgrade_star_count_;
+        }
+        break;
+    }
+    case td_api::sentGiftUpgraded::ID:
+    {
+        const auto &up = static_cast<const td_api::sentGiftUpgraded &>(*rg.gift_);
+        e.upgraded = true;
+        if (up.gift_)
+        {
+            const auto &g = up.gift_;
+            e.gift_id = g->id_;
+            if (g->model_) e.model = g->model_->name_;
+            if (g->backdrop_) e.backdrop = g->backdrop_->name_;
+            if (g->symbol_) e.symbol = g->symbol_->name_;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    return e;
+}
+
+bool GiftInventory::load(const std::string &path)
+{
+    auto started = std::chrono::steady_clock::now();
+    {
+        std::lock_guard lk(mutex_);
+        path_ = path;
+    }
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        spdlog::get("logger")->info("[inventory] no cache at {}, starting empty", path);
+        return false;
+    }
+    struct stat sb{};
+    if (::fstat(fd, &sb) != 0 || static_cast<std::size_t>(sb.st_size) < sizeof(FileHeader))
+    {
+        ::close(fd);
+        spdlog::get("logger")->warn("[inventory] {} is truncated, ignoring", path);
+        return false;
+    }
+    const std::size_t size = static_cast<std::size_t>(sb.st_size);
+    void *map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        spdlog::get("logger")->warn("[inventory] mmap {} failed", path);
+        return false;
+    }
+
+    const auto *base = static_cast<const char *>(map);
+    FileHeader h;
+    std::memcpy(&h, base, sizeof(h));
+    // размеры из файла не складываем (strings_size — 64 бита, сумма переполнится), а вычитаем
+    const std::size_t payload = size - sizeof(FileHeader);
+    const std::size_t records_size = static_cast<std::size_t>(h.count) * sizeof(Record);
+    if (std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0 || h.version != kVersion ||
+        h.count > payload / sizeof(Record) || h.strings_size != payload - records_size)
+    {
+        ::munmap(map, size);
+        spdlog::get("logger")->warn("[inventory] {} has unknown format, ignoring", path);
+        return false;
+    }
+
+    const auto *records = reinterpret_cast<const Record *>(base + sizeof(FileHeader));
+    const char *strings = base + sizeof(FileHeader) + records_size;
+    // по реально размапленным байтам, а не по заголовку
+    const std::size_t strings_avail = size - sizeof(FileHeader) - records_size;
+    auto str = [&](const StrRef &r) -> std::string
+    {
+        if (r.offset > strings_avail || r.length > strings_avail - r.offset)
+        {
+            return {};
+        }
+        return std::string(strings + r.offset, r.length);
+    };
+
+    std::lock_guard lk(mutex_);
+    entries_.clear();
+    per_owner_.clear();
+    entries_.reserve(h.count);
+    for (std::uint32_t i = 0; i < h.count; ++i)
+    {
+        const Record &r = records[i];
+        InventoryEntry e;
+        e.received_gift_id = str(r.strings[0]);
+        e.owner = r.owner;
+        e.gift_id = r.gift_id;
+        e.upgrade_price = r.upgrade_price;
+        e.can_be_upgraded = (r.flags & kCanBeUpgraded) != 0;
+        e.upgraded = (r.flags & kUpgraded) != 0;
+        e.model = str(r.strings[1]);
+        e.backdrop = str(r.strings[2]);
+        e.symbol = str(r.strings[3]);
+        ++per_owner_[e.owner];
+        entries_.emplace(e.received_gift_id, std::move(e));
+    }
+    ::munmap(map, size);
+    dirty_ = false;
+
+    auto took = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+    spdlog::get("logger")->info("[inventory] loaded {} gifts of {} owners from {} in {} us",
+                                entries_.size(), per_owner_.size(), path, took.count());
+    return true;
+}
+
+bool GiftInventory::save()
+{
+    std::string path;
+    std::vector<Record> records;
+    std::string strings;
+    {
+        std::lock_guard lk(mutex_);
+        if (!dirty_ || path_.empty())
+        {
+            return true;
+        }
+        path = path_;
+        records.reserve(entries_.size());
+        for (const auto &[id, e] : entries_)
+        {
+            Record r{};
+            r.owner = e.owner;
+            r.gift_id = e.gift_id;
+            r.upgrade_price = e.upgrade_price;
+            r.flags = (e.can_be_upgraded ? kCanBeUpgraded : 0u) | (e.upgraded ? kUpgraded : 0u);
+            r.strings[0] = append_string(strings, e.received_gift_id);
+            r.strings[1] = append_string(strings, e.model);
+            r.strings[2] = append_string(strings, e.backdrop);
+            r.strings[3] = append_string(strings, e.symbol);
+            records.push_back(r);
+        }
+        dirty_ = false;
+    }
+
+    FileHeader h{};
+    std::memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = kVersion;
+    h.count = static_cast<std::uint32_t>(records.size());
+    h.strings_size = strings.size();
+
+    const std::string tmp = path + ".tmp";
+    if (!write_synced(tmp, h, records, strings))
+    {
+        spdlog::get("logger")->error("[inventory] failed to write {}: {}", tmp, std::strerror(errno));
+        std::lock_guard lk(mutex_);
+        dirty_ = true;
+        return false;
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        spdlog::get("logger")->error("[inventory] failed to replace {}", path);
+        std::lock_guard lk(mutex_);
+        dirty_ = true;
+        return false;
+    }
+    spdlog::get("logger")->info("[inventory] saved {} gifts to {}", records.size(), path);
+    return true;
+}
+
+bool GiftInventory::upsert(InventoryEntry e)
+{
+    std::lock_guard lk(mutex_);
+    auto it = entries_.find(e.received_gift_id);
+    if (it == entries_.end())
+    {
+        ++per_owner_[e.owner];
+        entries_.emplace(e.received_gift_id, std::move(e));
+        dirty_ = true;
+        return true;
+    }
+    if (it->second == e)
+    {
+        return false;
+    }
+    if (it->second.owner != e.owner)
+    {
+        if (--per_owner_[it->second.owner] == 0)
+        {
+            per_owner_.erase(it->second.owner);
+        }
+        ++per_owner_[e.owner];
+    }
+    it->second = std::move(e);
+    dirty_ = true;
+    return true;
+}
+
+std::vector<std::string> GiftInventory::evict_missing(td_api::int64 owner, const std::unordered_set<std::string> &seen)
+{
+    std::vector<std::string> evicted;
+    std::lock_guard lk(mutex_);
+    for (auto it = entries_.begin(); it != entries_.end();)
+    {
+        if (it->second.owner == owner && !seen.count(it->first))
+        {
+            evicted.push_back(it->first);
+            it = entries_.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    if (!evicted.empty())
+    {
+        auto n = per_owner_.find(owner);
+        if (n != per_owner_.end() && (n->second -= std::min(n->second, evicted.size())) == 0)
+        {
+            per_owner_.erase(n);
+        }
+        dirty_ = true;
+    }
+    return evicted;
+}
+
+std::optional<InventoryEntry> GiftInventory::find(const std::string &received_gift_id) const
+{
+    std::lock_guard lk(mutex_);
+    auto it = entries_.find(received_gift_id);
+    if (it == entries_.end())
+    {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+std::vector<InventoryEntry> GiftInventory::owned_by(td_api::int64 owner) const
+{
+    std::vector<InventoryEntry> result;
+    std::lock_guard lk(mutex_);
+    for (const auto &[id, e] : entries_)
+    {
+        if (e.owner == owner)
+        {
+            result.push_back(e);
+        }
+    }
+    return result;
+}
+
+bool GiftInventory::has_owner(td_api::int64 owner) const
+{
+    std::lock_guard lk(mutex_);
+    return per_owner_.count(owner) > 0;
+}
+
+void GiftInventory::for_each(const std::function<void(const InventoryEntry &)> &fn) const
+{
+    std::lock_guard lk(mutex_);
+    for (const auto &[id, e] : entries_)
+    {
+        fn(e);
+    }
+}
+
+std::size_t GiftInventory::size() const
+{
+    std::lock_guard lk(mutex_);
+    return entries_.size();
+}
@@ -0,0 +1,194 @@
+#include "catalog_series.hpp"
+
+#include <spdlog/spdlog.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <algorithm>
+#include <ctime>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace
+{
+    struct DrainStats
+    {
+        std::int64_t id = 0;
+        std::int64_t price = 0;
+        std::int64_t total = 0;
+        std::int64_t first_ms = 0;
+        std::int64_t last_ms = 0;
+        std::int64_t remaining = 0;
+        std::int64_t sold = 0;          // за время наблюдения
+        double avg_per_sec = 0;
+        double peak_per_sec = 0;        // по окну window_sec
+        double recent_per_sec = 0;      // последнее окно
+        std::optional<double> to_zero_sec; // от первого снимка до remaining == 0
+    };
+
+    std::string format_time(std::int64_t ms)
+    {
+        std::time_t t = static_cast<std::time_t>(ms / 1000);
+        std::tm tm{};
+        gmtime_r(&t, &tm);
+        char buf[32];
+        std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+        return buf;
+    }
+
+    // Выборки — точки изменения, между ними значение постоянно
+    DrainStats analyze(std::int64_t id, const std::vector<CatalogSeriesReader::Sample> &s, double window_sec)
+    {
+        DrainStats d;
+        d.id = id;
+        d.price = s.back().price;
+        d.total = s.back().total;
+        d.first_ms = s.front().time_ms;
+        d.last_ms = s.back().time_ms;
+        d.remaining = s.back().remaining;
+        d.sold = s.front().remaining - s.back().remaining;
+
+        std::size_t end = s.size() - 1;
+        for (std::size_t i = 0; i < s.size(); ++i)
+        {
+            if (s[i].remaining == 0)
+            {
+                d.to_zero_sec = (s[i].time_ms - s.front().time_ms) / 1000.0;
+                end = i;
+                break;
+            }
+        }
+        const double span = (s[end].time_ms - s.front().time_ms) / 1000.0;
+        if (span > 0)
+        {
+            d.avg_per_sec = (s.front().remaining - s[end].remaining) / span;
+        }
+
+        // окно [t_i, t_j], t_j - t_i >= window: два указателя
+        const auto window_ms = static_cast<std::int64_t>(window_sec * 1000);
+        std::size_t j = 0;
+        for (std::size_t i = 0; i <= end; ++i)
+        {
+            j = std::max(j, i);
+            while (j < end && s[j].time_ms - s[i].time_ms < window_ms)
+            {
+                ++j;
+            }
+            const double dt = std::max<double>(window_sec, (s[j].time_ms - s[i].time_ms) / 1000.0);
+            const double rate = (s[i].remaining - s[j].remaining) / dt;
+            d.peak_per_sec = std::max(d.peak_per_sec, rate);
+        }
+        for (std::size_t i = end; i-- > 0;)
+        {
+            if (s[end].time_ms - s[i].time_ms >= window_ms || i == 0)
+            {
+                const double dt = std::max<double>(window_sec, (s[end].time_ms - s[i].time_ms) / 1000.0);
+                d.recent_per_sec = (s[i].remaining - s[end].remaining) / dt;
+                break;
+            }
+        }
+        return d;
+    }
+} // namespace
+
+// Аналитика по ряду каталога из buy_loop: gift_stats [файл] [--gift ID] [--window SEC] [--all]
+// По умолчанию — только лимитированные подарки, у которых наблюдались продажи.
+int main(int argc, char **argv)
+{
+    auto output = spdlog::stdout_color_mt("output");
+    output->set_pattern("%v");
+    auto logger = spdlog::stderr_color_mt("logger");
+    logger->set_level(spdlog::level::warn);
+
+    std::string path = "gifts_catalog.series";
+    std::optional<std::int64_t> only;
+    double window_sec = 10;
+    bool all = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string
+        { return i + 1 < argc ? argv[++i] : std::string{}; };
+        try
+        {
+            if (arg == "--gift")
+            {
+                only = std::stoll(value());
+            }
+            else if (arg == "--window")
+            {
+                window_sec = std::max(0.001, std::stod(value()));
+            }
+            else if (arg == "--all")
+            {
+                all = true;
+            }
+            else
+            {
+                path = arg;
+            }
+        }
+        catch (const std::exception &)
+        {
+            logger->error("bad value for {}", arg);
+            return 2;
+        }
+    }
+
+    CatalogSeriesReader reader;
+    if (!reader.load(path))
+    {
+        logger->error("can't read {}", path);
+        return 1;
+    }
+    if (reader.truncated())
+    {
+        logger->warn("{}: last frame is incomplete, ignored", path);
+    }
+
+    std::vector<DrainStats> rows;
+    for (const auto &[id, samples] : reader.series())
+    {
+        if (samples.empty() || (only && id != *only))
+        {
+            continue;
+        }
+        DrainStats d = analyze(id, samples, window_sec);
+        if (!only && !all && (d.total == 0 || d.sold == 0))
+        {
+            continue;
+        }
+        rows.push_back(d);
+        if (only)
+        {
+            for (const auto &s : samples)
+            {
+                output->info("{}  price={} total={} remaining={}", format_time(s.time_ms), s.price, s.total, s.remaining);
+            }
+        }
+    }
+    std::sort(rows.begin(), rows.end(), [](const DrainStats &a, const DrainStats &b)
+              { return a.first_ms > b.first_ms; });
+
+    output->info("{} frames, {} gifts in {}", reader.frames(), reader.series().size(), path);
+    output->info("{:>20} {:>7} {:>8} {:>8} {:>8} {:>9} {:>9} {:>10}  {}",
+                 "gift_id", "price", "total", "left", "sold", "avg/s", "peak/s", "to_zero", "first seen (UTC)");
+    for (const auto &d : rows)
+    {
+        std::string to_zero;
+        if (d.to_zero_sec)
+        {
+            to_zero = fmt::format("{:.1f}s", *d.to_zero_sec);
+        }
+        else if (d.recent_per_sec > 0)
+        {
+            to_zero = fmt::format("~{:.0f}s", d.remaining / d.recent_per_sec); // прогноз по последнему окну
+        }
+        else
+        {
+            to_zero = "-";
+        }
+        output->info("{:>20} {:>7} {:>8} {:>8} {:>8} {:>9.2f} {:>9.2f} {:>10}  {}",
+                     d.id, d.price, d.total, d.remaining, d.sold, d.avg_per_sec, d.peak_per_sec, to_zero, format_time(d.first_ms));
+    }
+    return 0;
+}
@@ -0,0 +1,232 @@
+#include "image_encoders.hpp"
+#include "gif_encoder.hpp"
+
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <cmath>
+#include <zlib.h>
+
+#ifdef TG_GIFTS_HAVE_WEBP
+#include <webp/encode.h>
+#include <webp/mux.h>
+#endif
+
+std::optional<RenderFormat> parse_render_format(const std::string &name)
+{
+    if (name == "gif") return RenderFormat::Gif;
+    if (name == "webp") return RenderFormat::Webp;
+    if (name == "apng") return RenderFormat::Apng;
+    if (name == "png") return RenderFormat::Png;
+    return std::nullopt;
+}
+
+const char *render_format_extension(RenderFormat format)
+{
+    switch (format)
+    {
+    case RenderFormat::Gif: return ".gif";
+    case RenderFormat::Webp: return ".webp";
+    case RenderFormat::Apng: return ".apng";
+    case RenderFormat::Png: return ".png";
+    }
+    return "";
+}
+
+namespace
+{
+    void put_u16be(std::string &out, std::uint32_t v)
+    {
+        out.push_back(static_cast<char>((v >> 8) & 0xFF));
+        out.push_back(static_cast<char>(v & 0xFF));
+    }
+
+    void put_u32be(std::string &out, std::uint32_t v)
+    {
+        put_u16be(out, v >> 16);
+        put_u16be(out, v & 0xFFFF);
+    }
+
+    // ===== PNG / APNG =====
+
+    void png_chunk(std::string &out, const char *type, const std::string &data)
+    {
+        put_u32be(out, static_cast<std::uint32_t>(data.size()));
+        std::size_t start = out.size();
+        out.append(type, 4);
+        out += data;
+        auto crc = crc32(0L, reinterpret_cast<const Bytef *>(out.data() + start), static_cast<uInt>(out.size() - start));
+        put_u32be(out, static_cast<std::uint32_t>(crc));
+    }
+
+    // Фильтр Sub на каждой строке + deflate
+    bool png_deflate(const std::vector<std::uint8_t> &rgba, int w, int h, std::string &out)
+    {
+        const std::size_t stride = static_cast<std::size_t>(w) * 4;
+        std::string raw(static_cast<std::size_t>(h) * (stride + 1), '\0');
+        for (int y = 0; y < h; ++y)
+        {
+            const std::uint8_t *src = rgba.data() + y * stride;
+            char *dst = raw.data() + y * (stride + 1);
+            dst[0] = 1;
+            for (std::size_t x = 0; x < stride; ++x)
+            {
+                std::uint8_t left = x >= 4 ? src[x - 4] : 0;
+                dst[x + 1] = static_cast<char>(static_cast<std::uint8_t>(src[x] - left));
+            }
+        }
+        uLongf size = compressBound(static_cast<uLong>(raw.size()));
+        out.resize(size);
+        if (compress2(reinterpret_cast<Bytef *>(out.data()), &size,
+                      reinterpret_cast<const Bytef *>(raw.data()), static_cast<uLong>(raw.size()), 6) != Z_OK)
+        {
+            return false;
+        }
+        out.resize(size);
+        return true;
+    }
+
+    void png_header(std::string &out, int w, int h)
+    {
+        out.append("\x89PNG\r\n\x1a\n", 8);
+        std::string ihdr;
+        put_u32be(ihdr, static_cast<std::uint32_t>(w));
+        put_u32be(ihdr, static_cast<std::uint32_t>(h));
+        ihdr.push_back(8); // bit depth
+        ihdr.push_back(6); // RGBA
+        ihdr.push_back(0);
+        ihdr.push_back(0);
+        ihdr.push_back(0);
+        png_chunk(out, "IHDR", ihdr);
+    }
+
+    bool valid(const RenderedAnimation &anim)
+    {
+        const std::size_t frame_size = static_cast<std::size_t>(anim.width) * anim.height * 4;
+        return anim.width > 0 && anim.height > 0 && !anim.frames.empty() &&
+               std::all_of(anim.frames.begin(), anim.frames.end(), [&](const auto &f)
+                           { return f.size() == frame_size; });
+    }
+} // namespace
+
+bool encode_png(const RenderedAnimation &anim, std::string &out)
+{
+    if (!valid(anim)) return false;
+    std::string idat;
+    if (!png_deflate(anim.frames.front(), anim.width, anim.height, idat)) return false;
+    out.clear();
+    png_header(out, anim.width, anim.height);
+    png_chunk(out, "IDAT", idat);
+    png_chunk(out, "IEND", {});
+    return true;
+}
+
+bool encode_apng(const RenderedAnimation &anim, std::string &out)
+{
+    if (!valid(anim)) return false;
+    out.clear();
+    png_header(out, anim.width, anim.height);
+
+    std::string actl;
+    put_u32be(actl, static_cast<std::uint32_t>(anim.frames.size()));
+    put_u32be(actl, 0); // бесконечно
+    png_chunk(out, "acTL", actl);
+
+    const auto delay_ms = static_cast<std::uint32_t>(std::lround(1000.0 / std::max(1.0, anim.fps)));
+    std::uint32_t seq = 0;
+    for (std::size_t i = 0; i < anim.frames.size(); ++i)
+    {
+        std::string fctl;
+        put_u32be(fctl, seq++);
+        put_u32be(fctl, static_cast<std::uint32_t>(anim.width));
+        put_u32be(fctl, static_cast<std::uint32_t>(anim.height));
+        put_u32be(fctl, 0);
+        put_u32be(fctl, 0);
+        put_u16be(fctl, delay_ms);
+        put_u16be(fctl, 1000);
+        fctl.push_back(1); // dispose: background
+        fctl.push_back(0); // blend: source
+        png_chunk(out, "fcTL", fctl);
+
+        std::string data;
+        if (!png_deflate(anim.frames[i], anim.width, anim.height, data)) return false;
+        if (i == 0)
+        {
+            png_chunk(out, "IDAT", data);
+        }
+        else
+        {
+            std::string fdat;
+            put_u32be(fdat, seq++);
+            fdat += data;
+            png_chunk(out, "fdAT", fdat);
+        }
+    }
+    png_chunk(out, "IEND", {});
+    return true;
+}
+
+bool encode_gif(const RenderedAnimation &anim, std::string &out, ThreadPool *pool)
+{
+    return GifEncoder(pool).encode(anim, out);
+}
+
+bool encode_webp(const RenderedAnimation &anim, std::string &out)
+{
+#ifdef TG_GIFTS_HAVE_WEBP
+    if (!valid(anim)) return false;
+
+    WebPAnimEncoderOptions enc_options;
+    if (!WebPAnimEncoderOptionsInit(&enc_options)) return false;
+    WebPAnimEncoder *enc = WebPAnimEncoderNew(anim.width, anim.height, &enc_options);
+    if (!enc) return false;
+
+    WebPConfig config;
+    WebPConfigInit(&config);
+    config.quality = 80;
+
+    WebPPicture pic;
+    WebPPictureInit(&pic);
+    pic.width = anim.width;
+    pic.height = anim.height;
+    pic.use_argb = 1;
+
+    bool ok = true;
+    const double frame_ms = 1000.0 / std::max(1.0, anim.fps);
+    int timestamp = 0;
+    for (std::size_t i = 0; ok && i < anim.frames.size(); ++i)
+    {
+        timestamp = static_cast<int>(std::lround(i * frame_ms));
+        ok = WebPPictureImportRGBA(&pic, anim.frames[i].data(), anim.width * 4) &&
+             WebPAnimEncoderAdd(enc, &pic, timestamp, &config);
+    }
+    timestamp = static_cast<int>(std::lround(anim.frames.size() * frame_ms));
+    WebPData data;
+    WebPDataInit(&data);
+    ok = ok && WebPAnimEncoderAdd(enc, nullptr, timestamp, nullptr) && WebPAnimEncoderAssemble(enc, &data);
+    if (ok)
+    {
+        out.assign(reinterpret_cast<const char *>(data.bytes), data.size);
+    }
+    WebPDataClear(&data);
+    WebPPictureFree(&pic);
+    WebPAnimEncoderDelete(enc);
+    return ok;
+#else
+    (void)anim;
+    (void)out;
+    spdlog::get("logger")->error("[render] built without libwebp, webp output is unavailable");
+    return false;
+#endif
+}
+
+bool encode_animation(const RenderedAnimation &anim, RenderFormat format, std::string &out, ThreadPool *pool)
+{
+    switch (format)
+    {
+    case RenderFormat::Gif: return encode_gif(anim, out, pool);
+    case RenderFormat::Webp: return encode_webp(anim, out);
+    case RenderFormat::Apng: return encode_apng(anim, out);
+    case RenderFormat::Png: return encode_png(anim, out);
+    }
+    return false;
+}
@@ -1,13 +1,43 @@
 #include "td_interface.hpp"
-#include <fstream>
+#include "command_dispatcher.hpp"
+#include "control_server.hpp"
+#include "request_trace.hpp"
+#include <charconv>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <optional>
 #include <spdlog/spdlog.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
-#include <nlohmann/json.hpp>
 #include <thread>
-#include <unordered_set>
+#ifdef TG_GIFTS_HAVE_RENDER
+#include "asset_index.hpp"
+#include "tgs_renderer.hpp"
+#endif
+
+namespace
+{
+    // Число из переменной окружения. Мусор не роняет запуск: предупреждение и nullopt —
+    // остаётся значение по умолчанию (как с TG_PROFILE)
+    template <class T>
+    std::optional<T> env_number(const char *name)
+    {
+        const char *value = std::getenv(name);
+        if (!value)
+        {
+            return std::nullopt;
+        }
+        T out{};
+        const char *end = value + std::strlen(value);
+        auto [ptr, ec] = std::from_chars(value, end, out);
+        if (ec != std::errc() || ptr != end || ptr == value)
+        {
+            spdlog::get("logger")->warn("{}={} is not a valid number, ignored", name, value);
+            return std::nullopt;
+        }
+        return out;
+    }
+} // namespace
 
 int main()
 {
@@ -18,6 +48,13 @@ int main()
     output->set_pattern("%v");
     auto logger = spdlog::stderr_color_mt("logger");
     logger->set_level(spdlog::level::debug);
+    // строки лога видны на таймлайне трассы (при выключенной трассировке sink ничего не пишет)
+    output->sinks().push_back(make_trace_log_sink("log.output"));
+    logger->sinks().push_back(make_trace_log_sink("log.logger"));
+    if (const char *trace = std::getenv("TG_TRACE"))
+    {
+        RequestTrace::set_enabled(std::string(trace) != "0");
+    }
 
     if (!api_id_env || !api_hash_env)
     {
@@ -25,170 +62,153 @@ int main()
         return 1;
     }
 
-    int32_t api_id = std::stoi(api_id_env);
+    auto api_id = env_number<int32_t>("TG_API_ID");
+    if (!api_id)
+    {
+        logger->error("TG_API_ID must be a number");
+        return 1;
+    }
     std::string api_hash = api_hash_env;
 
 
-    TdInterface tg(api_id, api_hash);
-    tg.set_on_authorized_callback([&tg, output]()
-                                  { std::thread([&tg, output]()
-                                                {
+    TdInterface tg(*api_id, api_hash);
+    if (const char *profile_env = std::getenv("TG_PROFILE"))
+    {
+        if (auto profile = parse_session_profile(profile_env))
+        {
+            tg.set_profile(*profile);
+        }
+        else
+        {
+            logger->warn("TG_PROFILE={} is not lean/full, using lean", profile_env);
+        }
+    }
+    if (auto rss_sec = env_number<int>("TG_RSS_SAMPLE_SEC"))
+    {
+        tg.set_rss_sample_delay(std::chrono::seconds(*rss_sec));
+    }
+    const char *inventory_env = std::getenv("TG_INVENTORY");
+    tg.inventory().load(inventory_env ? inventory_env : "gifts_inventory.bin");
+    tg.inventory().for_each([&tg](const InventoryEntry &e)
+                            { tg.attributes().upsert(e); });
+    const char *catalog_env = std::getenv("TG_CATALOG_SERIES");
+    tg.catalog().open(catalog_env ? catalog_env : "gifts_catalog.series");
+    if (auto sec = env_number<int>("TG_FULL_REFRESH_SEC"))
+    {
+        tg.set_full_refresh_interval(std::chrono::seconds(*sec));
+    }
+    if (auto k = env_number<std::size_t>("TG_CRAWL_IN_FLIGHT"))
+    {
+        tg.crawler().set_max_in_flight(*k);
+    }
+    if (auto n = env_number<std::size_t>("TG_HANDLER_WORKERS"))
+    {
+        // 0 — все обработчики в loop(), как раньше
+        tg.set_handler_workers(*n);
+    }
+    if (auto n = env_number<std::size_t>("TG_STICKER_DOWNLOADS"))
+    {
+        tg.sticker_cache().set_max_downloads(*n);
+    }
+#ifdef TG_GIFTS_HAVE_RENDER
+    // Скачанные .tgs сразу конвертируются: stickers_render/<asset>.<fmt>, где asset — канонический
+    // ассет из индекса (одинаковые анимации под разными unique_id рендерятся один раз),
+    // рядом со стикером в gifts_channel/ — ссылка <received_gift_id>.<fmt>
+    const char *render_env = std::getenv("TG_RENDER_FORMAT");
+    std::string render_format = render_env ? render_env : "gif";
+    const char *assets_env = std::getenv("TG_ASSET_INDEX");
+    AssetIndex assets(assets_env ? assets_env : "assets_index.json");
+    std::unique_ptr<TgsRenderer> renderer;
+    if (auto fmt = parse_render_format(render_format))
+    {
+        assets.load();
+        renderer = std::make_unique<TgsRenderer>();
+        renderer->set_asset_index(&assets);
+        RenderOptions opts;
+        opts.format = *fmt;
+        tg.sticker_cache().set_on_ready([r = renderer.get(), opts, &assets](const std::filesystem::path &cached, const std::string &received_id)
+                                        {
+            if (cached.extension() != ".tgs") return;
+            const char *ext = render_format_extension(opts.format);
+            const std::filesystem::path link = std::filesystem::path("gifts_channel") / (received_id + ext);
+            if (auto asset = assets.asset_of(received_id))
+            {
+                const auto rendered = std::filesystem::path("stickers_render") / (*asset + ext);
+                std::error_code ec;
+                if (std::filesystem::exists(rendered, ec)) {
+                    StickerCache::link_file(rendered, link);
+                    return;
+                }
+            }
+            r->convert_async(cached, std::filesystem::path("stickers_render") / (cached.stem().string() + ext), opts,
+                             [received_id, link, &assets](const std::filesystem::path &out) {
+                StickerCache::link_file(out, link);
+                assets.bind(received_id, out.stem().string());
+            }); });
+    }
+    else if (render_format != "none")
+    {
+        logger->warn("TG_RENDER_FORMAT={} is not gif/webp/apng/png/none, rendering disabled", render_format);
+    }
+#endif
+    if (const char *standby = std::getenv("TG_STANDBY_DB"))
+    {
+        // отдельная база = отдельная сессия того же аккаунта; первый раз спросит код после основной
+        tg.enable_standby(standby);
+    }
+    if (auto rate = env_number<double>("TG_RATE_LIMIT"))
+    {
+        tg.rate_governor().set_rate(*rate, 5);
+    }
+    // Команды: stdin (текстовая форма или JSON-строка) и control-сокет (JSON/текст построчно)
+    CommandDispatcher commands(tg);
+    // trace on|off|clear|dump [файл] — таймлайн запросов для chrome://tracing / Perfetto
+    commands.add("trace", [](const nlohmann::json &c)
+                 {
+        const auto args = c.value("args", nlohmann::json::array());
+        const std::string action = c.value("action", args.empty() ? std::string("dump") : args[0].get<std::string>());
+        if (action == "on" || action == "off") {
+            RequestTrace::set_enabled(action == "on");
+            return nlohmann::json{{"ok", true}, {"tracing", RequestTrace::enabled()}};
+        }
+        if (action == "clear") {
+            RequestTrace::clear();
+            return nlohmann::json{{"ok", true}};
+        }
+        if (action == "dump") {
+            const std::string path = c.value("path", args.size() > 1 ? args[1].get<std::string>() : std::string("tg_gifts.trace.json"));
+            std::size_t events = 0;
+            if (!RequestTrace::dump(path, &events)) {
+                return nlohmann::json{{"ok", false}, {"error", "can't write " + path}};
+            }
+            return nlohmann::json{{"ok", true}, {"path", path}, {"events", events}};
+        }
+        return nlohmann::json{{"ok", false}, {"error", "usage: trace on|off|clear|dump [path]"}}; });
+    const char *control_env = std::getenv("TG_CONTROL_SOCKET");
+    std::string control_path = control_env ? control_env : "tg_gifts.sock";
+    std::unique_ptr<ControlServer> control;
+    bool input_started = false;
+    tg.set_on_authorized_callback([&commands, &control, &input_started, control_path, output]()
+                                  {
+        // сокет — только после авторизации: до неё td ещё спрашивает код/пароль со stdin
+        if (!control && control_path != "none") {
+            control = std::make_unique<ControlServer>(control_path, [&commands](const std::string &line)
+                                                      { return commands.dispatch_line(line); });
+            if (!control->start()) control.reset();
+        }
+        // после restart() колбэк зовётся снова — второй читатель stdin не нужен
+        if (input_started) return;
+        input_started = true;
+        std::thread([&commands, output]()
+                    {
+            RequestTrace::name_thread("stdin");
             output->info("enter commands: ");
             std::string command;
             while (std::getline(std::cin, command)) {
-                if (command == "on") {
-                    output->info("[State] Set to ACTIVE");
-                }
-                else if (command == "test")
-                {
-                    std::string owner_str;
-                    std::cout << "owner_id (user_id или -100... для канала, пусто = по умолчанию): ";
-                    std::getline(std::cin, owner_str);
-
-                    if (owner_str.empty()) {
-                        tg.test(); // старое поведение
-                    } else {
-                        try {
-                            long long owner = std::stoll(owner_str); // поддерживает -100...
-                            tg.test(static_cast<td_api::int64>(owner));
-                        } catch (const std::exception& e) {
-                            output->info("[test] Некорректный owner_id: {}", owner_str);
-                        }
-                    }
-                }
-                else if (command == "upgrade")
-                { 
-                    std::string identifier;
-                    int price;
-                    std::cout << "ID: ";
-                    std::cin >> identifier;
-                    std::cout << "price: ";
-                    std::cin >> price;
-                    tg.send_query_upgrade(identifier, price);
-                }
-                else if (command == "buy")
-                {
-                    if (tg.buying.load(std::memory_order_relaxed)) {
-                        output->info("[State] Already buying");
-                        continue;
-                    }
-
-                    // Спросим владельца (user_id для пользователя или -100... для канала)
-                    std::string owner_str;
-                    std::cout << "owner_id (user_id или -100... для канала): ";
-                    std::getline(std::cin, owner_str);
-
-                    long long owner_ll = 0;
-                    try {
-                        owner_ll = std::stoll(owner_str);
-                    } catch (...) {
-                        output->info("[buy] Некорректный owner_id: {}", owner_str);
-                        continue;
-                    }
-
-                    int millis = 1000;
-                    std::cout << "poll interval ms (default 1000): ";
-                    std::string ms_str;
-                    std::getline(std::cin, ms_str);
-                    if (!ms_str.empty()) {
-                        try { millis = std::stoi(ms_str); } catch (...) {}
-                    }
-
-                    tg.buying.store(true, std::memory_order_release);
-                    std::thread([&tg, millis, owner_ll]() {
-                        tg.buy_loop(millis, static_cast<td_api::int64>(owner_ll));
-                    }).detach();
-                }
-                else if (command == "upg")
-                {
-                    if (tg.checking.load(std::memory_order_relaxed))
-                    {
-                        output->info("[State] Already checking for upgrades");
-                        continue;
-                    }
-
-                    int millis = 25;
-                    std::cout << "time: ";
-                    std::cin >> millis;
-                    // очистим \n после >>, чтобы не ломать следующий getline
-                    std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-                    std::string gifts_file;
-                    std::cout << "gifts file (default: gifts.json): ";
-                    std::getline(std::cin, gifts_file);
-                    if (gifts_file.empty()) gifts_file = "gifts.json";
-                    // === 1) Читаем gifts.json ===
-                    std::vector<std::pair<std::string, std::int64_t>> gifts;
-                    try {
-                        std::ifstream in(gifts_file);
-                        if (!in.is_open()) {
-                            throw std::runtime_error(std::string("can't open ") + gifts_file);
-                        }
-                        nlohmann::json j;
-                        in >> j;
-                        for (const auto& e : j) {
-                            gifts.emplace_back(
-                                e.at("id").get<std::string>(),
-                                e.at("price").get<std::int64_t>()
-                            );
-                        }
-                    } catch (const std::exception& e) {
-                        spdlog::get("logger")->error("[upg] failed to read {}: {}", gifts_file, e.what());
-                        continue;
-                    }
-
-                    // === 2) Находим канальные received_gift_id и вызываем test(<chat_id>) ===
-                    auto parse_chat_id = [](const std::string& s) -> std::optional<long long> {
-                        // ожидаем вид "-100XXXXXXXXX_YYYY..."
-                        if (s.rfind("-100", 0) == 0) {
-                            auto pos = s.find('_');
-                            if (pos != std::string::npos) {
-                                try {
-                                    long long chat_id = std::stoll(s.substr(0, pos));
-                                    return chat_id;
-                                } catch (...) {}
-                            }
-                        }
-                        return std::nullopt;
-                    };
-
-                    std::unordered_set<long long> channels;
-                    for (const auto& [id, price] : gifts) {
-                        if (auto cid = parse_chat_id(id)) {
-                            channels.insert(*cid);
-                        }
-                    }
-                    for (auto cid : channels) {
-						spdlog::get("logger")->info("[channels] getting channel {}", cid);
-                        tg.test(static_cast<td_api::int64>(cid));
-                    }
-
-                    // === 3) Стартуем апгрейд-цикл с этим набором ===
-                    tg.checking.store(true, std::memory_order_release);
-                    std::thread([&tg, millis, gifts = std::move(gifts)]() mutable {
-                        tg.upgrade_loop(millis, gifts);
-                    }).detach();
-                }
-                else if (command == "stop")
-                {
-                    output->info("");
-                    tg.checking.store(false, std::memory_order_relaxed);
-                    tg.buying.store(false, std::memory_order_relaxed); 
-                }
-                else if (command == "stop_buy")
-                {
-                    output->info("");
-                    tg.buying.store(false, std::memory_order_relaxed); 
-                }
-                else if (command == "stop_upg")
-                {
-                    output->info("");
-                    tg.checking.store(false, std::memory_order_relaxed);
-                }
-                else {
-                    output->info("[Unknown Command] Use 'on' or 'off'");
-                }
+                if (command.empty()) continue;
+                output->info("{}", commands.dispatch_line(command));
             } })
-                                        .detach(); });
+            .detach(); });
     output->info("Starting loop...");
     tg.loop();
 
@@ -0,0 +1,265 @@
+#include "request_trace.hpp"
+
+#include <fmt/format.h>
+#include <spdlog/sinks/base_sink.h>
+#include <spdlog/details/null_mutex.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+
+namespace
+{
+    constexpr std::size_t kCapacity = 1 << 15;
+
+    struct Event
+    {
+        std::int64_t ts_ns;
+        const char *name;
+        std::uint64_t id;
+        std::int64_t arg;
+        char phase;
+    };
+
+    // Пишет только поток-владелец; dump читает, отбрасывая то, что могло перезаписаться во время копирования
+    struct ThreadBuffer
+    {
+        std::uint32_t tid = 0;
+        std::atomic<const char *> thread_name{nullptr};
+        std::atomic<std::uint64_t> head{0};
+        std::atomic<bool> alive{true};
+        std::unique_ptr<Event[]> events{new Event[kCapacity]};
+    };
+
+    std::mutex g_buffers_mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> g_buffers;
+
+    // Буфер завершившегося потока достаётся следующему новому — дорожка в трассе = слот, а не ОС-поток
+    struct LocalBuffer
+    {
+        ThreadBuffer *buffer = nullptr;
+        ~LocalBuffer()
+        {
+            if (buffer)
+            {
+                buffer->alive.store(false, std::memory_order_release);
+            }
+        }
+    };
+    thread_local LocalBuffer t_local;
+
+    ThreadBuffer &local_buffer()
+    {
+        if (t_local.buffer)
+        {
+            return *t_local.buffer;
+        }
+        std::lock_guard lk(g_buffers_mutex);
+        for (auto &b : g_buffers)
+        {
+            bool dead = false;
+            if (b->alive.compare_exchange_strong(dead, true))
+            {
+                b->thread_name.store(nullptr, std::memory_order_relaxed);
+                t_local.buffer = b.get();
+                return *b;
+            }
+        }
+        g_buffers.push_back(std::make_unique<ThreadBuffer>());
+        g_buffers.back()->tid = static_cast<std::uint32_t>(g_buffers.size());
+        t_local.buffer = g_buffers.back().get();
+        return *t_local.buffer;
+    }
+
+    std::int64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    class TraceLogSink final : public spdlog::sinks::base_sink<spdlog::details::null_mutex>
+    {
+    public:
+        explicit TraceLogSink(const char *name) : name_(name) {}
+
+    protected:
+        void sink_it_(const spdlog::details::log_msg &msg) override
+        {
+            RequestTrace::instant(name_, static_cast<std::int64_t>(msg.level));
+        }
+        void flush_() override {}
+
+    private:
+        const char *name_;
+    };
+} // namespace
+
+void RequestTrace::set_enabled(bool on)
+{
+    enabled_.store(on, std::memory_order_relaxed);
+}
+
+void RequestTrace::record(char phase, const char *name, std::uint64_t id, std::int64_t arg)
+{
+    ThreadBuffer &b = local_buffer();
+    const auto h = b.head.load(std::memory_order_relaxed);
+    b.events[h & (kCapacity - 1)] = Event{now_ns(), name, id, arg, phase};
+    b.head.store(h + 1, std::memory_order_release);
+}
+
+void RequestTrace::begin(const char *name, std::int64_t arg)
+{
+    if (enabled()) record('B', name, 0, arg);
+}
+
+void RequestTrace::end(const char *name)
+{
+    record('E', name, 0, 0);
+}
+
+void RequestTrace::instant(const char *name, std::int64_t arg)
+{
+    if (enabled()) record('i', name, 0, arg);
+}
+
+void RequestTrace::async_begin(const char *name, std::uint64_t id, std::uint64_t query_id)
+{
+    if (enabled()) record('b', name, id, static_cast<std::int64_t>(query_id));
+}
+
+void RequestTrace::async_step(const char *name, std::uint64_t id)
+{
+    if (enabled()) record('n', name, id, 0);
+}
+
+void RequestTrace::async_end(const char *name, std::uint64_t id)
+{
+    if (enabled()) record('e', name, id, 0);
+}
+
+void RequestTrace::name_thread(const char *name)
+{
+    local_buffer().thread_name.store(name, std::memory_order_relaxed);
+}
+
+void RequestTrace::clear()
+{
+    // буферы чужих потоков не трогаем: dump просто пропускает всё, что старше отметки
+    clear_before_ns_.store(now_ns(), std::memory_order_relaxed);
+}
+
+bool RequestTrace::dump(const std::string &path, std::size_t *events)
+{
+    struct Tagged
+    {
+        Event e;
+        std::uint32_t tid;
+    };
+    std::vector<Tagged> all;
+    std::vector<std::pair<std::uint32_t, const char *>> names;
+    const auto since = clear_before_ns_.load(std::memory_order_relaxed);
+    {
+        std::lock_guard lk(g_buffers_mutex);
+        std::vector<Event> copy(kCapacity);
+        for (auto &b : g_buffers)
+        {
+            const auto h1 = b->head.load(std::memory_order_acquire);
+            const auto from = h1 > kCapacity ? h1 - kCapacity : 0;
+            for (auto i = from; i < h1; ++i)
+            {
+                copy[i - from] = b->events[i & (kCapacity - 1)];
+            }
+            // пока копировали, владелец мог уйти на круг вперёд — такие слоты не берём
+            const auto h2 = b->head.load(std::memory_order_acquire);
+            const auto valid_from = std::max(from, h2 > kCapacity ? h2 - kCapacity : 0);
+            for (auto i = valid_from; i < h1; ++i)
+            {
+                const Event &e = copy[i - from];
+                if (e.ts_ns >= since)
+                {
+                    all.push_back(Tagged{e, b->tid});
+                }
+            }
+            if (auto name = b->thread_name.load(std::memory_order_relaxed))
+            {
+                names.emplace_back(b->tid, name);
+            }
+        }
+    }
+    std::stable_sort(all.begin(), all.end(), [](const Tagged &a, const Tagged &b)
+                     { return a.e.ts_ns < b.e.ts_ns; });
+
+    std::FILE *f = std::fopen(path.c_str(), "w");
+    if (!f)
+    {
+        return false;
+    }
+    const int pid = static_cast<int>(::getpid());
+    const std::int64_t origin = all.empty() ? 0 : all.front().e.ts_ns;
+    fmt::memory_buffer out;
+    fmt::format_to(std::back_inserter(out), "{{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    auto sep = [&]
+    {
+        if (!first) fmt::format_to(std::back_inserter(out), ",\n");
+        first = false;
+    };
+    for (const auto &[tid, name] : names)
+    {
+        sep();
+        fmt::format_to(std::back_inserter(out), R"({{"name":"thread_name","ph":"M","pid":{},"tid":{},"args":{{"name":"{}"}}}})", pid, tid, name);
+    }
+    for (const auto &t : all)
+    {
+        const Event &e = t.e;
+        const double ts = static_cast<double>(e.ts_ns - origin) / 1000.0;
+        sep();
+        switch (e.phase)
+        {
+        case 'b':
+            if (e.arg != 0)
+            {
+                fmt::format_to(std::back_inserter(out), R"({{"name":"{}","cat":"query","ph":"b","ts":{:.3f},"pid":{},"tid":{},"id":"0x{:x}","args":{{"query_id":{}}}}})",
+                               e.name, ts, pid, t.tid, e.id, e.arg);
+                break;
+            }
+            [[fallthrough]];
+        case 'n':
+        case 'e':
+            fmt::format_to(std::back_inserter(out), R"({{"name":"{}","cat":"query","ph":"{}","ts":{:.3f},"pid":{},"tid":{},"id":"0x{:x}"}})",
+                           e.name, e.phase, ts, pid, t.tid, e.id);
+            break;
+        case 'i':
+            fmt::format_to(std::back_inserter(out), R"({{"name":"{}","ph":"i","s":"t","ts":{:.3f},"pid":{},"tid":{},"args":{{"arg":{}}}}})",
+                           e.name, ts, pid, t.tid, e.arg);
+            break;
+        case 'B':
+            fmt::format_to(std::back_inserter(out), R"({{"name":"{}","ph":"B","ts":{:.3f},"pid":{},"tid":{},"args":{{"arg":{}}}}})",
+                           e.name, ts, pid, t.tid, e.arg);
+            break;
+        default:
+            fmt::format_to(std::back_inserter(out), R"({{"name":"{}","ph":"E","ts":{:.3f},"pid":{},"tid":{}}})", e.name, ts, pid, t.tid);
+            break;
+        }
+        if (out.size() > (1 << 20))
+        {
+            std::fwrite(out.data(), 1, out.size(), f);
+            out.clear();
+        }
+    }
+    fmt::format_to(std::back_inserter(out), "\n]}}\n");
+    std::fwrite(out.data(), 1, out.size(), f);
+    const bool ok = std::fclose(f) == 0;
+    if (events)
+    {
+        *events = all.size();
+    }
+    return ok;
+}
+
+std::shared_ptr<spdlog::sinks::sink> make_trace_log_sink(const char *name)
+{
+    return std::make_shared<TraceLogSink>(name);
+}
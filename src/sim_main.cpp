@@ -0,0 +1,247 @@
+#include "request_trace.hpp"
+#include "sim_transport.hpp"
+#include "td_coro.hpp"
+#include "td_interface.hpp"
+
+#include <spdlog/sinks/null_sink.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Прогон снайпинга без аккаунта: TdInterface поверх SimTransport.
+// Фазы: краул инвентаря, последовательные запросы (round trip), пачка send_upgrade,
+// затем upgrade_loop (или замкнутый upgrade_pipeline_loop при --depth) + buy_loop параллельно. Этим тренируется PGO (scripts/pgo_build.sh),
+// а итоговые перцентили сравниваются между сборками.
+//   tg_gifts_sim [--seconds N] [--latency-us N] [--requests N] [--workers N] [--depth N]
+//                [--updates N] [--no-filter] [--trace FILE] [--verbose]
+namespace
+{
+    struct Percentiles
+    {
+        double p50, p90, p99, max;
+    };
+
+    Percentiles percentiles(std::vector<double> v)
+    {
+        if (v.empty())
+        {
+            return {0, 0, 0, 0};
+        }
+        std::sort(v.begin(), v.end());
+        auto at = [&v](double q)
+        { return v[std::min(v.size() - 1, static_cast<std::size_t>(q * static_cast<double>(v.size())))]; };
+        return {at(0.50), at(0.90), at(0.99), v.back()};
+    }
+
+    void report(const char *name, const char *unit, const std::vector<double> &samples)
+    {
+        auto p = percentiles(samples);
+        std::printf("%-14s n=%-8zu p50=%.2f p90=%.2f p99=%.2f max=%.2f %s\n", name, samples.size(), p.p50, p.p90, p.p99, p.max, unit);
+    }
+
+    // n последовательных getReceivedGift: запрос -> ответ -> обработчик -> следующий
+    td_coro::Task<void> roundtrips(TdInterface &td, std::size_t n, std::vector<double> &out)
+    {
+        out.reserve(n);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            const auto started = std::chrono::steady_clock::now();
+            auto obj = co_await td.query(td_api::make_object<td_api::getReceivedGift>("689019"));
+            out.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - started).count());
+        }
+    }
+
+    td_coro::Task<void> signal(td_coro::Task<void> task, std::promise<void> &done)
+    {
+        co_await std::move(task);
+        done.set_value();
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    int seconds = 5;
+    std::size_t requests = 20000;
+    bool verbose = false;
+    std::string trace_path;
+    long workers = -1;
+    int depth = 0;
+    bool filter = true;
+    SimConfig config;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--seconds" && i + 1 < argc)
+        {
+            seconds = std::stoi(argv[++i]);
+        }
+        else if (arg == "--latency-us" && i + 1 < argc)
+        {
+            config.latency = std::chrono::microseconds(std::stol(argv[++i]));
+            config.jitter = config.latency / 3;
+        }
+        else if (arg == "--requests" && i + 1 < argc)
+        {
+            requests = std::stoul(argv[++i]);
+        }
+        else if (arg == "--workers" && i + 1 < argc)
+        {
+            workers = std::stol(argv[++i]);
+        }
+        else if (arg == "--depth" && i + 1 < argc)
+        {
+            depth = std::stoi(argv[++i]);
+        }
+        else if (arg == "--updates" && i + 1 < argc)
+        {
+            config.updates_per_request = std::stoi(argv[++i]);
+        }
+        else if (arg == "--no-filter")
+        {
+            filter = false;
+        }
+        else if (arg == "--trace" && i + 1 < argc)
+        {
+            trace_path = argv[++i];
+        }
+        else if (arg == "--verbose")
+        {
+            verbose = true;
+        }
+        else
+        {
+            std::fprintf(stderr, "usage: %s [--seconds N] [--latency-us N] [--requests N] [--workers N] [--depth N] [--updates N] [--no-filter] [--trace FILE] [--verbose]\n", argv[0]);
+            return 2;
+        }
+    }
+    config.unlock_after = requests * 4; // окно «ещё нельзя» на весь прогон
+
+    // логи форматируются как в бою, но по умолчанию уходят в никуда
+    if (verbose)
+    {
+        spdlog::stdout_color_mt("output")->set_pattern("%v");
+        spdlog::stderr_color_mt("logger")->set_level(spdlog::level::debug);
+    }
+    else
+    {
+        spdlog::create<spdlog::sinks::null_sink_mt>("output");
+        spdlog::create<spdlog::sinks::null_sink_mt>("logger")->set_level(spdlog::level::debug);
+    }
+    if (!trace_path.empty())
+    {
+        spdlog::get("output")->sinks().push_back(make_trace_log_sink("log.output"));
+        spdlog::get("logger")->sinks().push_back(make_trace_log_sink("log.logger"));
+        RequestTrace::set_enabled(true);
+    }
+
+    auto transport = std::make_unique<SimTransport>(config);
+    auto *sim = transport.get();
+    TdInterface td(0, "sim", std::move(transport));
+    if (workers >= 0)
+    {
+        td.set_handler_workers(static_cast<std::size_t>(workers));
+    }
+    if (!filter)
+    {
+        // всё до process_update, как без фильтра
+        td.update_filter().set_default_rule(UpdateRule::Pass);
+        td.update_filter().set_rule(td_api::updateNewMessage::ID, UpdateRule::Pass);
+    }
+    std::promise<void> authorized;
+    td.set_on_authorized_callback([&authorized]
+                                  { authorized.set_value(); });
+    std::thread loop([&td]
+                     { td.loop(); });
+    authorized.get_future().wait();
+
+    const auto started = std::chrono::steady_clock::now();
+    const auto crawl = td.crawl_gifts({1000001}).get();
+    std::printf("crawl          %zu pages, %zu gifts\n", crawl.pages, crawl.gifts);
+
+    std::vector<double> rtt;
+    std::promise<void> rtt_done;
+    td_coro::spawn(signal(roundtrips(td, requests, rtt), rtt_done));
+    rtt_done.get_future().wait();
+    report("roundtrip", "us", rtt);
+
+    // горячий путь отправки: только вызов send_upgrade, ответы разбирает loop()
+    const TdInterface::UpgradeTargets targets = {
+        {"700279", 25000}, {"727170", 25000}, {"689019", 25000}, {"691933", 25000}, {"700281", 25000}, {"716987", 25000}};
+    std::vector<UpgradeTemplate> templates;
+    for (const auto &[id, price] : targets)
+    {
+        templates.push_back(UpgradeTemplate::make(id, price));
+    }
+    std::vector<double> send;
+    send.reserve(requests);
+    for (std::size_t i = 0; i < requests; ++i)
+    {
+        const auto t0 = std::chrono::steady_clock::now();
+        td.send_upgrade(templates[i % templates.size()]);
+        send.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count());
+    }
+    report("send_upgrade", "ns", send);
+
+    td.checking = true;
+    td.buying = true;
+    // лимит пайплайна = темп таймерного цикла (1 мс), чтобы сравнивать при равной нагрузке
+    std::thread upgrades([&td, &targets, depth]
+                         {
+        if (depth > 0) td.upgrade_pipeline_loop(depth, 1000, targets);
+        else td.upgrade_loop(1, targets); });
+    std::thread buys([&td]
+                     { td.buy_loop(5, 1000001); });
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    td.checking = false;
+    td.buying = false;
+    upgrades.join();
+    buys.join();
+
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    std::printf("total          %llu requests in %.1f s, %d/%d upgrade sent/received\n",
+                static_cast<unsigned long long>(sim->requests()), elapsed, td.sent_.load(), td.received_.load());
+    const auto loop_stats = td.loop_stats();
+    std::printf("loop           %llu responses, busy %.1f ms, max stall %.3f ms, >1ms %llu, >10ms %llu\n",
+                static_cast<unsigned long long>(loop_stats.responses), loop_stats.busy_ms, loop_stats.max_stall_ms,
+                static_cast<unsigned long long>(loop_stats.stalls_over_1ms), static_cast<unsigned long long>(loop_stats.stalls_over_10ms));
+    if (config.updates_per_request > 0)
+    {
+        std::uint64_t seen = 0, dropped = 0;
+        std::string top;
+        for (const auto &t : td.update_filter().stats())
+        {
+            seen += t.seen;
+            dropped += t.dropped;
+            top += " " + t.name + "=" + std::to_string(t.seen) + "/" + std::to_string(t.dropped);
+        }
+        std::printf("updates        %llu seen, %llu dropped:%s\n", static_cast<unsigned long long>(seen),
+                    static_cast<unsigned long long>(dropped), top.c_str());
+    }
+    if (depth > 0)
+    {
+        const auto p = td.upgrade_pipeline().stats();
+        std::printf("pipeline       %zu lanes x depth %d: sent %llu, responses %llu, deferred %llu, expired %llu\n", p.lanes, depth,
+                    static_cast<unsigned long long>(p.sent), static_cast<unsigned long long>(p.responses),
+                    static_cast<unsigned long long>(p.deferred), static_cast<unsigned long long>(p.expired));
+    }
+
+    td.stop();
+    loop.join();
+    if (!trace_path.empty())
+    {
+        std::size_t events = 0;
+        if (!RequestTrace::dump(trace_path, &events))
+        {
+            std::fprintf(stderr, "can't write %s\n", trace_path.c_str());
+            return 1;
+        }
+        std::printf("trace          %zu events -> %s\n", events, trace_path.c_str());
+    }
+    return 0;
+}
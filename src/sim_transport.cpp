@@ -0,0 +1,248 @@
+#include "sim_transport.hpp"
+
+#include <algorithm>
+
+namespace td_api = td::td_api;
+
+SimTransport::SimTransport(SimConfig config)
+    : config_(config), rng_(config.seed)
+{
+    remaining_.resize(static_cast<std::size_t>(std::max(config_.catalog_size, 0)));
+    for (std::size_t i = 0; i < remaining_.size(); ++i)
+    {
+        remaining_[i] = i % 3 == 0 ? 0 : static_cast<int>(1000 + 250 * i); // треть — не лимитированные
+    }
+}
+
+std::int32_t SimTransport::create_client_id()
+{
+    std::lock_guard lk(mutex_);
+    return ++next_client_id_;
+}
+
+std::uint64_t SimTransport::requests() const
+{
+    std::lock_guard lk(mutex_);
+    return requests_;
+}
+
+void SimTransport::send(std::int32_t client_id, std::uint64_t request_id, td_api::object_ptr<td_api::Function> request)
+{
+    {
+        std::lock_guard lk(mutex_);
+        ++requests_;
+        // как TDLib: первый запрос запускает клиента, он сообщает состояние авторизации
+        if (started_.insert(client_id).second)
+        {
+            push_authorization(client_id, td_api::make_object<td_api::authorizationStateWaitTdlibParameters>());
+        }
+        auto response = respond(client_id, *request);
+        push_noise(client_id);
+        if (request_id != 0 && response)
+        {
+            push(due(), client_id, request_id, std::move(response));
+        }
+    }
+    cv_.notify_one();
+}
+
+TdTransport::Response SimTransport::receive(double timeout)
+{
+    std::unique_lock lk(mutex_);
+    const auto deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(timeout));
+    while (true)
+    {
+        const auto now = Clock::now();
+        if (!queue_.empty() && queue_.top().due <= now)
+        {
+            const Pending &top = queue_.top();
+            Response r{top.client_id, top.request_id, std::move(top.object)};
+            queue_.pop();
+            return r;
+        }
+        if (now >= deadline)
+        {
+            return Response{0, 0, nullptr};
+        }
+        const auto wake = queue_.empty() ? deadline : std::min(deadline, queue_.top().due);
+        cv_.wait_until(lk, wake);
+    }
+}
+
+SimTransport::Clock::time_point SimTransport::due()
+{
+    auto jitter = config_.jitter.count();
+    std::uniform_int_distribution<std::int64_t> d(-jitter, jitter);
+    return Clock::now() + std::max(std::chrono::microseconds(0), config_.latency + std::chrono::microseconds(jitter ? d(rng_) : 0));
+}
+
+void SimTransport::push(Clock::time_point at, std::int32_t client_id, std::uint64_t request_id, Object object)
+{
+    queue_.push(Pending{at, order_++, client_id, request_id, std::move(object)});
+}
+
+void SimTransport::push_authorization(std::int32_t client_id, Object state)
+{
+    push(Clock::now(), client_id, 0,
+         td_api::make_object<td_api::updateAuthorizationState>(td::move_tl_object_as<td_api::AuthorizationState>(state)));
+}
+
+void SimTransport::push_noise(std::int32_t client_id)
+{
+    for (int i = 0; i < config_.updates_per_request; ++i)
+    {
+        const auto n = noise_++;
+        const td_api::int53 chat_id = -1001000000000 - static_cast<td_api::int53>(n % 16);
+        Object update;
+        switch (n % 4)
+        {
+        case 0:
+        case 1:
+        {
+            auto m = td_api::make_object<td_api::message>();
+            m->chat_id_ = chat_id;
+            m->sender_id_ = td_api::make_object<td_api::messageSenderChat>(chat_id);
+            m->content_ = td_api::make_object<td_api::messageText>(
+                td_api::make_object<td_api::formattedText>("post " + std::to_string(n), std::vector<td_api::object_ptr<td_api::textEntity>>{}));
+            update = td_api::make_object<td_api::updateNewMessage>(std::move(m));
+            break;
+        }
+        case 2:
+            update = td_api::make_object<td_api::updateChatReadInbox>(chat_id);
+            break;
+        default:
+            update = td_api::make_object<td_api::updateUserStatus>(static_cast<td_api::int53>(n % 1000));
+            break;
+        }
+        push(due(), client_id, 0, std::move(update));
+    }
+}
+
+SimTransport::Object SimTransport::respond(std::int32_t client_id, td_api::Function &request)
+{
+    switch (request.get_id())
+    {
+    case td_api::setTdlibParameters::ID:
+        push_authorization(client_id, td_api::make_object<td_api::authorizationStateReady>());
+        return td_api::make_object<td_api::ok>();
+    case td_api::close::ID:
+        push_authorization(client_id, td_api::make_object<td_api::authorizationStateClosing>());
+        push_authorization(client_id, td_api::make_object<td_api::authorizationStateClosed>());
+        return td_api::make_object<td_api::ok>();
+    case td_api::setOption::ID:
+        return td_api::make_object<td_api::ok>();
+    case td_api::getOption::ID:
+        return td_api::make_object<td_api::optionValueString>("sim");
+    case td_api::getMe::ID:
+    {
+        auto me = td_api::make_object<td_api::user>();
+        me->id_ = 1000001;
+        return me;
+    }
+    case td_api::getAvailableGifts::ID:
+        return make_catalog();
+    case td_api::getReceivedGift::ID:
+    {
+        auto &q = static_cast<td_api::getReceivedGift &>(request);
+        return make_received_gift(q.received_gift_id_, ++upgrade_attempts_ >= config_.unlock_after);
+    }
+    case td_api::getReceivedGifts::ID:
+    {
+        auto &q = static_cast<td_api::getReceivedGifts &>(request);
+        return make_received_gifts(q.offset_, q.limit_);
+    }
+    case td_api::upgradeGift::ID:
+    {
+        auto &q = static_cast<td_api::upgradeGift &>(request);
+        if (++upgrade_attempts_ < config_.unlock_after)
+        {
+            return td_api::make_object<td_api::error>(400, "STARGIFT_UPGRADE_UNAVAILABLE");
+        }
+        if (!upgraded_.insert(q.received_gift_id_).second)
+        {
+            return td_api::make_object<td_api::error>(400, "STARGIFT_ALREADY_UPGRADED");
+        }
+        auto result = td_api::make_object<td_api::upgradeGiftResult>();
+        result->gift_ = td_api::make_object<td_api::upgradedGift>();
+        result->received_gift_id_ = q.received_gift_id_;
+        return result;
+    }
+    case td_api::sendGift::ID:
+        return td_api::make_object<td_api::ok>();
+    default:
+        return td_api::make_object<td_api::error>(400, "SIM_UNSUPPORTED");
+    }
+}
+
+SimTransport::Object SimTransport::make_catalog()
+{
+    auto list = td_api::make_object<td_api::availableGifts>();
+    for (std::size_t i = 0; i < remaining_.size(); ++i)
+    {
+        auto g = td_api::make_object<td_api::gift>();
+        g->id_ = 5170000000000000000LL + static_cast<std::int64_t>(i);
+        g->star_count_ = 15 + 10 * static_cast<std::int64_t>(i);
+        g->upgrade_star_count_ = 25000;
+        g->overall_limits_ = td_api::make_object<td_api::giftPurchaseLimits>();
+        if (i % 3 != 0)
+        {
+            // распродаются с разной скоростью
+            remaining_[i] = std::max(0, remaining_[i] - static_cast<int>(i % 5));
+            g->overall_limits_->total_count_ = static_cast<std::int32_t>(1000 + 250 * i);
+            g->overall_limits_->remaining_count_ = remaining_[i];
+        }
+        auto ag = td_api::make_object<td_api::availableGift>();
+        ag->gift_ = std::move(g);
+        list->gifts_.push_back(std::move(ag));
+    }
+    return list;
+}
+
+SimTransport::Object SimTransport::make_received_gift(const std::string &received_gift_id, bool can_be_upgraded)
+{
+    auto g = td_api::make_object<td_api::gift>();
+    g->id_ = 5170000000000000001LL;
+    g->star_count_ = 25;
+    g->upgrade_star_count_ = 25000;
+    g->overall_limits_ = td_api::make_object<td_api::giftPurchaseLimits>();
+    g->overall_limits_->total_count_ = 50000;
+    auto rg = td_api::make_object<td_api::receivedGift>();
+    rg->received_gift_id_ = received_gift_id;
+    rg->can_be_upgraded_ = can_be_upgraded;
+    rg->gift_ = td_api::make_object<td_api::sentGiftRegular>(std::move(g));
+    return rg;
+}
+
+SimTransport::Object SimTransport::make_received_gifts(const std::string &offset, int limit)
+{
+    const int start = offset.empty() ? 0 : std::stoi(offset);
+    const int end = std::min(config_.received_gifts, start + std::max(1, std::min(limit, 50)));
+    auto page = td_api::make_object<td_api::receivedGifts>();
+    page->total_count_ = config_.received_gifts;
+    for (int i = start; i < end; ++i)
+    {
+        auto rg = td_api::make_object<td_api::receivedGift>();
+        rg->received_gift_id_ = std::to_string(700000 + i);
+        if (i % 4 == 0)
+        {
+            auto u = td_api::make_object<td_api::upgradedGift>();
+            u->model_ = td_api::make_object<td_api::upgradedGiftModel>();
+            u->model_->name_ = "Model " + std::to_string(i % 17);
+            u->backdrop_ = td_api::make_object<td_api::upgradedGiftBackdrop>();
+            u->backdrop_->name_ = "Backdrop " + std::to_string(i % 11);
+            u->symbol_ = td_api::make_object<td_api::upgradedGiftSymbol>();
+            u->symbol_->name_ = "Symbol " + std::to_string(i % 7);
+            rg->gift_ = td_api::make_object<td_api::sentGiftUpgraded>(std::move(u));
+        }
+        else
+        {
+            auto g = td_api::make_object<td_api::gift>();
+            g->id_ = 5170000000000000000LL + i % 24;
+            g->upgrade_star_count_ = 25000;
+            rg->gift_ = td_api::make_object<td_api::sentGiftRegular>(std::move(g));
+        }
+        page->gifts_.push_back(std::move(rg));
+    }
+    page->next_offset_ = end < config_.received_gifts ? std::to_string(end) : std::string{};
+    return page;
+}
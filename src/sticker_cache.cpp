@@ -0,0 +1,251 @@
+#include "sticker_cache.hpp"
+#include "td_interface.hpp"
+
+#include <spdlog/spdlog.h>
+#include <chrono>
+#include <string_view>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    // Стикер без remote unique_id кэшируется под именем file_<сессия>_<file_id>: file_id живёт
+    // только в этой сессии TDLib, поэтому такие файлы не поднимаются при следующем запуске
+    constexpr std::string_view kSessionPrefix = "file_";
+} // namespace
+
+StickerCache::StickerCache(TdInterface &td, fs::path cache_dir, fs::path links_dir, std::size_t max_downloads)
+    : td_(td), cache_dir_(std::move(cache_dir)), links_dir_(std::move(links_dir)),
+      session_(std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                  std::chrono::system_clock::now().time_since_epoch())
+                                  .count())),
+      max_downloads_(max_downloads == 0 ? 1 : max_downloads)
+{
+}
+
+void StickerCache::set_max_downloads(std::size_t n)
+{
+    {
+        std::lock_guard lk(mutex_);
+        max_downloads_ = n == 0 ? 1 : n;
+    }
+    pump();
+}
+
+void StickerCache::set_on_ready(ReadyHandler handler)
+{
+    std::lock_guard lk(mutex_);
+    on_ready_ = std::move(handler);
+}
+
+StickerCache::Stats StickerCache::stats() const
+{
+    std::lock_guard lk(mutex_);
+    return stats_;
+}
+
+// Поднимаем то, что уже скачано в прошлые запуски (имя файла = unique_id);
+// файлы по file_id прошлых сессий удаляем — их ключ больше ничего не значит
+void StickerCache::scan_locked()
+{
+    if (scanned_)
+    {
+        return;
+    }
+    scanned_ = true;
+    std::error_code ec;
+    fs::create_directories(cache_dir_, ec);
+    fs::create_directories(links_dir_, ec);
+    std::size_t stale = 0;
+    for (const auto &entry : fs::directory_iterator(cache_dir_, ec))
+    {
+        if (!entry.is_regular_file(ec))
+        {
+            continue;
+        }
+        std::string stem = entry.path().stem().string();
+        if (stem.compare(0, kSessionPrefix.size(), kSessionPrefix) == 0)
+        {
+            fs::remove(entry.path(), ec);
+            ++stale;
+            continue;
+        }
+        cached_.emplace(std::move(stem), entry.path());
+    }
+    spdlog::get("logger")->info("[StickerCache] {} stickers on disk in {}, {} stale session files removed",
+                                cached_.size(), cache_dir_.string(), stale);
+}
+
+void StickerCache::request(const td_api::sticker &st, const std::string &received_gift_id)
+{
+    if (!st.sticker_)
+    {
+        return;
+    }
+    const auto &file = st.sticker_;
+    // unique_id стабилен между сессиями; file_id — нет, поэтому ключ по нему помечен сессией
+    std::string unique_id = (file->remote_ && !file->remote_->unique_id_.empty())
+                                ? file->remote_->unique_id_
+                                : std::string(kSessionPrefix) + session_ + "_" + std::to_string(file->id_);
+
+    fs::path cached;
+    {
+        std::lock_guard lk(mutex_);
+        scan_locked();
+        auto hit = cached_.find(unique_id);
+        if (hit != cached_.end())
+        {
+            cached = hit->second;
+            ++stats_.hits;
+        }
+        else
+        {
+            auto [it, inserted] = pending_.try_emplace(unique_id);
+            it->second.file_id = file->id_;
+            it->second.received_ids.push_back(received_gift_id);
+            if (inserted)
+            {
+                queue_.push_back(unique_id);
+            }
+        }
+    }
+
+    if (!cached.empty())
+    {
+        link(cached, received_gift_id);
+        return;
+    }
+    pump();
+}
+
+void StickerCache::pump()
+{
+    std::vector<std::pair<std::string, td_api::int32>> to_send;
+    {
+        std::lock_guard lk(mutex_);
+        while (in_flight_ < max_downloads_ && !queue_.empty())
+        {
+            auto unique_id = std::move(queue_.front());
+            queue_.pop_front();
+            auto it = pending_.find(unique_id);
+            if (it == pending_.end())
+            {
+                continue;
+            }
+            ++in_flight_;
+            to_send.emplace_back(std::move(unique_id), it->second.file_id);
+        }
+    }
+
+    for (auto &[unique_id, file_id] : to_send)
+    {
+        td_.send_query(td_api::make_object<td_api::downloadFile>(file_id, /*priority*/1, /*offset*/0, /*limit*/0, /*synchronous*/true),
+                       [this, unique_id = std::move(unique_id)](TdInterface::Object obj)
+                       { on_downloaded(unique_id, std::move(obj)); },
+                       HandlerClass::Bulk);
+    }
+}
+
+void StickerCache::on_downloaded(const std::string &unique_id, td_api::object_ptr<td_api::Object> obj)
+{
+    fs::path cached;
+    if (obj->get_id() != td_api::file::ID)
+    {
+        spdlog::get("logger")->warn("[StickerCache] not a File (unique_id={}): {}", unique_id, to_string(obj));
+    }
+    else
+    {
+        auto file = td::move_tl_object_as<td_api::file>(obj);
+        if (!file->local_ || file->local_->path_.empty())
+        {
+            spdlog::get("logger")->warn("[StickerCache] no local path (unique_id={})", unique_id);
+        }
+        else
+        {
+            // TDLib может почистить свой кэш, поэтому копируем к себе один раз
+            fs::path src(file->local_->path_);
+            fs::path dst = cache_dir_ / (unique_id + src.extension().string());
+            std::error_code ec;
+            if (fs::exists(dst, ec) || fs::copy_file(src, dst, fs::copy_options::skip_existing, ec))
+            {
+                cached = dst;
+            }
+            else
+            {
+                spdlog::get("logger")->warn("[StickerCache] copy {} -> {} failed: {}", src.string(), dst.string(), ec.message());
+            }
+        }
+    }
+
+    Pending done;
+    {
+        std::lock_guard lk(mutex_);
+        --in_flight_;
+        auto it = pending_.find(unique_id);
+        if (it != pending_.end())
+        {
+            done = std::move(it->second);
+            pending_.erase(it);
+        }
+        if (cached.empty())
+        {
+            ++stats_.failures;
+        }
+        else
+        {
+            ++stats_.downloads;
+            cached_[unique_id] = cached;
+        }
+    }
+
+    if (!cached.empty())
+    {
+        for (const auto &received_id : done.received_ids)
+        {
+            link(cached, received_id);
+        }
+    }
+    pump();
+}
+
+bool StickerCache::link_file(const fs::path &src, const fs::path &dst)
+{
+    std::error_code ec;
+    if (fs::exists(dst, ec))
+    {
+        return true;
+    }
+    fs::create_hard_link(src, dst, ec);
+    if (ec)
+    {
+        // другой раздел / ФС без hard link'ов
+        ec.clear();
+        fs::copy_file(src, dst, fs::copy_options::skip_existing, ec);
+    }
+    if (ec)
+    {
+        spdlog::get("logger")->warn("[StickerCache] link {} failed: {}", dst.string(), ec.message());
+        return false;
+    }
+    return true;
+}
+
+bool StickerCache::link(const fs::path &cached, const std::string &received_gift_id)
+{
+    if (!link_file(cached, links_dir_ / (received_gift_id + cached.extension().string())))
+    {
+        return false;
+    }
+    ReadyHandler on_ready;
+    {
+        std::lock_guard lk(mutex_);
+        ++stats_.links;
+        on_ready = on_ready_;
+    }
+    if (on_ready)
+    {
+        on_ready(cached, received_gift_id);
+    }
+    return true;
+}
@@ -1,4 +1,6 @@
 #include "td_interface.hpp"
+#include "td_coro.hpp"
+#include "request_trace.hpp"
 
 #include <fmt/format.h>
 #include <sstream>
@@ -13,7 +15,10 @@
 #include <locale>
 #include <filesystem>
 #include <chrono>
+#include <fstream>
 #include <unordered_set>
+#include <algorithm>
+#include <unistd.h>
 
 
 std::u16string utf8_to_utf16(const std::string &utf8)
@@ -70,20 +75,22 @@ namespace td_api = td::td_api;
 using td_api::make_object;
 using td_api::object_ptr;
 
-TdInterface::TdInterface(int32_t api_id, const std::string &api_hash)
+TdInterface::TdInterface(int32_t api_id, const std::string &api_hash, std::unique_ptr<TdTransport> transport)
     : api_id_(api_id), api_hash_(api_hash)
 {
     td::ClientManager::execute(td_api::make_object<td_api::setLogVerbosityLevel>(1));
-    client_manager_ = std::make_unique<td::ClientManager>();
-    client_id_ = client_manager_->create_client_id();
-    send_query(td_api::make_object<td_api::getOption>("version"), {});
+    transport_ = transport ? std::move(transport) : std::make_unique<ClientManagerTransport>();
+    auto &primary = create_session(restart_directory_);
+    client_id_.store(primary.client_id, std::memory_order_release);
+    send_to(primary, td_api::make_object<td_api::getOption>("version"), {});
     spdlog::get("output")->info("TdInterface initialized");
 }
 
 void TdInterface::loop()
 {
     spdlog::get("logger")->debug("Starting TdInterface loop...");
-    while (true)
+    RequestTrace::name_thread("td_loop");
+    while (!stopping_.load(std::memory_order_acquire))
     {
         if (need_restart_)
         {
@@ -92,20 +99,121 @@ void TdInterface::loop()
         }
         else
         {
-            auto response = client_manager_->receive(10);
-            process_response(std::move(response));
+            if (has_standby_input_.load(std::memory_order_acquire))
+            {
+                apply_standby_input();
+            }
+            auto response = transport_->receive(10);
+            if (!response.object)
+            {
+                continue;
+            }
+            const auto request_id = response.request_id;
+            std::uint64_t trace_id = request_id;
+            if (request_id != 0 && shared_query_id(request_id))
+            {
+                trace_id = end_shared_trace(request_id);
+            }
+            if (trace_id != 0)
+            {
+                RequestTrace::async_step("response", trace_id);
+            }
+            const auto started = std::chrono::steady_clock::now();
+            {
+                TraceSpan span("process_response", static_cast<std::int64_t>(request_id));
+                process_response(std::move(response));
+            }
+            record_loop_busy(std::chrono::steady_clock::now() - started);
+            if (trace_id != 0)
+            {
+                RequestTrace::async_end("query", trace_id);
+            }
         }
     }
 }
 
-void TdInterface::send_query(object_ptr<td_api::Function> f, std::function<void(Object)> handler)
+void TdInterface::stop()
+{
+    stopping_.store(true, std::memory_order_release);
+    send_query(td_api::make_object<td_api::getOption>("version"));
+}
+
+void TdInterface::send_query(object_ptr<td_api::Function> f, std::function<void(Object)> handler, HandlerClass handler_class)
+{
+    send_query_with_id(next_query_id(), std::move(f), std::move(handler), handler_class);
+}
+
+void TdInterface::send_query_with_id(std::uint64_t query_id, object_ptr<td_api::Function> f, std::function<void(Object)> handler,
+                                     HandlerClass handler_class)
+{
+    RequestTrace::async_begin("query", query_id);
+    const auto client_id = client_id_.load(std::memory_order_acquire);
+    if (handler)
+    {
+        std::lock_guard lk(handlers_mutex_);
+        handlers_[query_id] = PendingQuery{client_id, std::move(handler), handler_class};
+    }
+    send_raw(client_id, query_id, std::move(f));
+}
+
+td_coro::QueryAwaiter TdInterface::query(object_ptr<td_api::Function> f)
+{
+    return td_coro::QueryAwaiter(*this, std::move(f));
+}
+
+td_coro::QueryAwaiter TdInterface::query(object_ptr<td_api::Function> f, td_coro::CancellationToken token)
+{
+    return td_coro::QueryAwaiter(*this, std::move(f), std::move(token));
+}
+
+bool TdInterface::cancel_query(std::uint64_t query_id, const std::string &reason)
+{
+    std::function<void(Object)> handler;
+    {
+        std::lock_guard lk(handlers_mutex_);
+        auto it = handlers_.find(query_id);
+        if (it == handlers_.end())
+        {
+            return false;
+        }
+        handler = std::move(it->second.handler);
+        handlers_.erase(it);
+    }
+    // поздний ответ TDLib на этот query_id обработчика уже не найдёт
+    handler(td_api::make_object<td_api::error>(499, reason));
+    return true;
+}
+
+void TdInterface::send_to(Session &session, object_ptr<td_api::Function> f, std::function<void(Object)> handler)
 {
     auto query_id = next_query_id();
+    RequestTrace::async_begin("query", query_id);
     if (handler)
     {
-        handlers_[query_id] = std::move(handler);
+        std::lock_guard lk(handlers_mutex_);
+        handlers_[query_id] = PendingQuery{session.client_id, std::move(handler)};
     }
-    client_manager_->send(client_id_, query_id, std::move(f));
+    transport_->send(session.client_id, query_id, std::move(f));
+}
+
+void TdInterface::send_raw(std::int32_t client_id, std::uint64_t query_id, object_ptr<td_api::Function> f, std::uint64_t trace_id)
+{
+    // первый запрос после отказа — то, ради чего нужен резерв
+    if (failed_at_ns_.load(std::memory_order_relaxed) != 0)
+    {
+        if (auto failed = failed_at_ns_.exchange(0))
+        {
+            auto now = std::chrono::steady_clock::now().time_since_epoch();
+            spdlog::get("logger")->warn("[failover] first request {} us after failure",
+                                        (std::chrono::duration_cast<std::chrono::nanoseconds>(now).count() - failed) / 1000);
+        }
+    }
+    if (RequestTrace::enabled())
+    {
+        RequestTrace::async_step("send", trace_id != 0 ? trace_id : query_id);
+    }
+    TraceSpan span("transport.send", static_cast<std::int64_t>(query_id));
+    transport_->send(client_id, query_id, std::move(f));
 }
 
 void TdInterface::send_query_check()
@@ -113,72 +221,94 @@ void TdInterface::send_query_check()
 
     auto get_gift = td_api::make_object<td_api::getReceivedGift>(id);
     auto query_id = 123456789;
-    client_manager_->send(client_id_, query_id, std::move(get_gift));
-    {
-        std::lock_guard lk(times_mutex_);
-        times[sent_] = std::chrono::steady_clock::now();
-    }
-    sent_.fetch_add(1, std::memory_order_relaxed);
+    const auto trace_id = begin_shared_trace(query_id);
+    send_raw(client_id_.load(std::memory_order_acquire), query_id, std::move(get_gift), trace_id);
+    mark_sent();
 }
 
 void TdInterface::send_query_upgrade(const std::string& received_gift_id, int price = 25000)
 {
-    auto upgrade_gift = td_api::make_object<td_api::upgradeGift>(bb, received_gift_id, false, price);
-    
-    constexpr std::int64_t BASE = 900000000;
-    std::int64_t query_id = BASE;
-
-    bool full_parse_ok = false;
-    try {
-        std::size_t idx = 0;
-        long long v = std::stoll(received_gift_id, &idx, 10);
-        if (idx == received_gift_id.size() && v >= 0) {
-            query_id = BASE + static_cast<std::int64_t>(v);
-            full_parse_ok = true;
-        }
-    } catch (...) {
+    send_upgrade(UpgradeTemplate::make(received_gift_id, price));
+}
+
+void TdInterface::send_upgrade(const UpgradeTemplate &t)
+{
+    send_upgrade(t, t.query_id);
+}
+
+void TdInterface::send_upgrade(const UpgradeTemplate &t, std::uint64_t request_id)
+{
+    // у пайплайна request_id и так уникален
+    std::uint64_t trace_id = 0;
+    if (shared_query_id(request_id))
+    {
+        trace_id = begin_shared_trace(request_id);
+    }
+    else
+    {
+        RequestTrace::async_begin("query", request_id, t.query_id);
     }
+    send_raw(client_id_.load(std::memory_order_acquire), request_id, t.build(bb), trace_id);
+    mark_sent();
+}
 
-    if (!full_parse_ok) {
-        const std::string& s = received_gift_id;
+void TdInterface::mark_sent()
+{
+    send_times_.record(static_cast<std::uint64_t>(sent_.fetch_add(1, std::memory_order_relaxed)), std::chrono::steady_clock::now());
+}
 
-        std::size_t j = s.size();
-        while (j > 0 && std::isdigit(static_cast<unsigned char>(s[j - 1]))) {
-            --j;
-        }
-        const std::size_t digits_len = s.size() - j;
+bool TdInterface::shared_query_id(std::uint64_t query_id)
+{
+    return query_id == 123456789 || query_id == 987654321 ||
+           (query_id > 900000000 && query_id < UpgradePipeline::kRequestBase);
+}
 
-        if (digits_len > 0) {
-            std::string tail = s.substr(j, digits_len);
-            if (tail.size() > 6) {
-                tail = tail.substr(tail.size() - 6);
-            }
-            try {
-                std::int64_t suffix = std::stoll(tail);
-                query_id = BASE + suffix;
-            } catch (...) {
-            }
-        }
+std::uint64_t TdInterface::begin_shared_trace(std::uint64_t query_id)
+{
+    if (!RequestTrace::enabled())
+    {
+        return 0;
     }
+    const std::uint64_t trace_id = kSharedTraceBase + shared_trace_seq_.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard lk(shared_traces_mutex_);
+        shared_traces_[query_id].push_back(trace_id);
+    }
+    shared_traces_open_.fetch_add(1, std::memory_order_relaxed);
+    RequestTrace::async_begin("query", trace_id, query_id);
+    return trace_id;
+}
 
-    client_manager_->send(client_id_, query_id, std::move(upgrade_gift));
+std::uint64_t TdInterface::end_shared_trace(std::uint64_t query_id)
+{
+    // без трассировки очередь пуста — ответ не платит за мьютекс
+    if (shared_traces_open_.load(std::memory_order_relaxed) == 0)
+    {
+        return 0;
+    }
+    std::lock_guard lk(shared_traces_mutex_);
+    auto it = shared_traces_.find(query_id);
+    if (it == shared_traces_.end())
     {
-        std::lock_guard lk(times_mutex_);
-        times[sent_] = std::chrono::steady_clock::now();
+        return 0;
     }
-    sent_.fetch_add(1, std::memory_order_relaxed);
+    const std::uint64_t trace_id = it->second.front();
+    it->second.pop_front();
+    if (it->second.empty())
+    {
+        shared_traces_.erase(it);
+    }
+    shared_traces_open_.fetch_sub(1, std::memory_order_relaxed);
+    return trace_id;
 }
 
 void TdInterface::send_query_upgrade()
 {
     auto upgrade_gift = td_api::make_object<td_api::upgradeGift>(bb, id, false, 25000);
     auto query_id = 987654321;
-    client_manager_->send(client_id_, query_id, std::move(upgrade_gift));
-    {
-        std::lock_guard lk(times_mutex_);
-        times[sent_] = std::chrono::steady_clock::now();
-    }
-    sent_.fetch_add(1, std::memory_order_relaxed);
+    const auto trace_id = begin_shared_trace(query_id);
+    send_raw(client_id_.load(std::memory_order_acquire), query_id, std::move(upgrade_gift), trace_id);
+    mark_sent();
 }
 
 td_api::object_ptr<td_api::MessageSender> TdInterface::make_sender(td_api::int64 id) {
@@ -194,13 +324,16 @@ void TdInterface::buy_loop(int millis, td_api::int64 owner_id)
 {
     auto seen = std::make_shared<std::unordered_set<td_api::int64>>();
     spdlog::get("output")->info("[buy_loop] Starting to {} (delay={})", owner_id, millis);
+    RequestTrace::name_thread("buy_loop");
 
 
     while (buying.load()) {
+        RequestTrace::instant("buy_loop.poll");
         send_query(
             td_api::make_object<td_api::getAvailableGifts>(),
             [this, owner_id, seen](Object obj)
             {
+                TraceSpan span("buy_loop.catalog");
                 if (obj->get_id() == td_api::error::ID) {
                     auto e = td::move_tl_object_as<td_api::error>(obj);
                     spdlog::get("logger")->warn("[buy_loop] getAvailableGifts error: {}", to_string(e));
@@ -214,6 +347,19 @@ void TdInterface::buy_loop(int millis, td_api::int64 owner_id)
                 auto list = td::move_tl_object_as<td_api::availableGifts>(obj);
                 std::vector<td_api::int64> to_buy;
 
+                // снимок каталога — в ряд для аналитики (кодирует и пишет отдельный поток)
+                CatalogSnapshot snap;
+                snap.time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                   std::chrono::system_clock::now().time_since_epoch()).count();
+                snap.gifts.reserve(list->gifts_.size());
+                for (const auto &ag : list->gifts_) {
+                    if (!ag || !ag->gift_) continue;
+                    const auto &g = ag->gift_;
+                    const auto &lim = g->overall_limits_;
+                    snap.gifts.push_back(CatalogPoint{g->id_, g->star_count_, lim ? lim->total_count_ : 0, lim ? lim->remaining_count_ : 0});
+                }
+                catalog_.push(std::move(snap));
+
                 for (auto &ag : list->gifts_) {
                     if (!ag || !ag->gift_) continue;
                     const auto &g = ag->gift_;
@@ -234,29 +380,7 @@ void TdInterface::buy_loop(int millis, td_api::int64 owner_id)
                     spdlog::get("output")->info("[buy_loop] No availible gifts");
                 }
                 return;
-                for (const auto &gift_id : to_buy) {
-                    auto req = td_api::make_object<td_api::sendGift>(
-                        gift_id,
-                        make_sender(owner_id),   
-                        td_api::make_object<td_api::formattedText>(
-                            std::string{}, std::vector<td_api::object_ptr<td_api::textEntity>>{}
-                        ), 
-                        true,
-                        false
-                    );
-
-                    send_query(std::move(req),
-                        [gift_id](Object res)
-                        {
-                            if (res->get_id() == td_api::error::ID) {
-                                auto e = td::move_tl_object_as<td_api::error>(res);
-                                spdlog::get("logger")->warn("[buy_loop] sendGift id={} -> error: {}", gift_id, to_string(e));
-                            } else {
-                                spdlog::get("output")->info("[buy_loop] sendGift id={} -> OK ({}", gift_id, res->get_id());
-                            }
-                        }
-                    );
-                }
+                td_coro::spawn(buy_gifts(std::move(to_buy), owner_id));
             }
         );
 
@@ -281,34 +405,87 @@ void TdInterface::upgrade_loop(int millis)
         {"691894", 25000}, // socks-
         {"698277", 25000} // klever
     };
+    std::vector<UpgradeTemplate> templates;
+    for (const auto& [id, price] : gifts) {
+        templates.push_back(UpgradeTemplate::make(id, price));
+    }
+    RequestTrace::name_thread("upgrade_loop");
     std::size_t i = 0;
     while (checking.load()) {
-        const auto& [id, price] = gifts[i++ % gifts.size()];
-        send_query_upgrade(id, price);
+        {
+            TraceSpan span("upgrade_loop.send");
+            send_upgrade(templates[i++ % templates.size()]);
+        }
         std::this_thread::sleep_for(std::chrono::milliseconds(millis));
     }
 }
 
-void TdInterface::upgrade_loop(int millis, const std::vector<std::pair<std::string, std::int64_t>>& gifts)
+void TdInterface::upgrade_loop(int millis, const UpgradeTargets &gifts)
 {
-    if (gifts.empty()) {
-        spdlog::get("logger")->warn("[upgrade_loop] gifts list is empty");
-        return;
-    }
+    set_upgrade_targets(gifts);
+    RequestTrace::name_thread("upgrade_loop");
     std::size_t i = 0;
     while (checking.load(std::memory_order_acquire)) {
-        const auto& [id, price] = gifts[i++ % gifts.size()];
-        send_query_upgrade(id, static_cast<int>(price));
+        std::shared_ptr<const std::vector<UpgradeTemplate>> templates;
+        {
+            std::lock_guard lk(targets_mutex_);
+            templates = upgrade_templates_;
+        }
+        if (templates->empty()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(millis));
+            continue;
+        }
+        {
+            TraceSpan span("upgrade_loop.send", static_cast<std::int64_t>(i % templates->size()));
+            send_upgrade((*templates)[i++ % templates->size()]);
+        }
         std::this_thread::sleep_for(std::chrono::milliseconds(millis));
     }
 }
 
+void TdInterface::upgrade_pipeline_loop(int depth, double rate, const UpgradeTargets &gifts)
+{
+    set_upgrade_targets(gifts);
+    RequestTrace::name_thread("upgrade_pacer");
+    std::shared_ptr<const std::vector<UpgradeTemplate>> templates;
+    {
+        std::lock_guard lk(targets_mutex_);
+        templates = upgrade_templates_;
+    }
+    upgrade_pipeline_.run(std::move(templates), depth, rate, checking);
+}
+
+void TdInterface::set_upgrade_targets(UpgradeTargets targets)
+{
+    if (targets.empty()) {
+        spdlog::get("logger")->warn("[upgrade_loop] gifts list is empty");
+    }
+    auto templates = std::make_shared<std::vector<UpgradeTemplate>>();
+    templates->reserve(targets.size());
+    for (const auto &[id, price] : targets) {
+        templates->push_back(UpgradeTemplate::make(id, price));
+    }
+    auto next = std::make_shared<const UpgradeTargets>(std::move(targets));
+    {
+        std::lock_guard lk(targets_mutex_);
+        upgrade_targets_ = std::move(next);
+        upgrade_templates_ = templates;
+    }
+    upgrade_pipeline_.retarget(std::move(templates));
+}
+
+std::shared_ptr<const TdInterface::UpgradeTargets> TdInterface::upgrade_targets() const
+{
+    std::lock_guard lk(targets_mutex_);
+    return upgrade_targets_;
+}
+
 std::uint64_t TdInterface::next_query_id()
 {
     return ++current_query_id_;
 }
 
-void TdInterface::process_response(td::ClientManager::Response response)
+void TdInterface::process_response(TdTransport::Response response)
 {
     if (!response.object)
     {
@@ -316,134 +493,158 @@ void TdInterface::process_response(td::ClientManager::Response response)
     }
     if (response.request_id == 0)
     {
+        auto session = sessions_.find(response.client_id);
+        if (session == sessions_.end())
+        {
+            return; // хвост уже закрытого клиента
+        }
+        if (response.object->get_id() == td_api::updateAuthorizationState::ID)
+        {
+            auto update = td::move_tl_object_as<td_api::updateAuthorizationState>(response.object);
+            const auto client_id = response.client_id;
+            session->second->authorization_state = std::move(update->authorization_state_);
+            on_authorization_state_update(*session->second);
+            if (session->second->authorization_state->get_id() == td_api::authorizationStateClosed::ID)
+            {
+                on_closed(client_id);
+            }
+            return;
+        }
+        if (response.client_id != client_id_.load(std::memory_order_acquire))
+        {
+            return; // резерв: кроме авторизации ничего не обрабатываем
+        }
+        if (!update_filter_.pass(*response.object))
+        {
+            return;
+        }
         process_update(std::move(response.object));
         return;
     }
     if (response.request_id == 123456789)
     {
-        {
-            std::lock_guard lk(times_mutex_);
-
-            auto it = times.find(received_);
-            if (it != times.end())
-            {
-                {
-                    auto now = std::chrono::steady_clock::now();
-                    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - it->second);
-                    spdlog::get("logger")->info("[Check] Time taken: {} ms | sent/recieved: {}/{}", duration.count(), sent_.load(), received_.load());
-                    times.erase(it);
-                }
-            }
-        }
-
-        received_.fetch_add(1, std::memory_order_relaxed);
+        // в loop() — только счётчики и решение об улучшении; форматирование и лог — в пуле
+        std::optional<std::chrono::steady_clock::duration> taken =
+            send_times_.take(static_cast<std::uint64_t>(received_.load()), std::chrono::steady_clock::now());
+        const auto received = received_.fetch_add(1, std::memory_order_relaxed);
+        const auto sent = sent_.load(std::memory_order_relaxed);
         auto obj = std::move(response.object);
         // Special case for check query
-        if (obj->get_id() == td_api::error::ID)
+        if (obj->get_id() == td_api::receivedGift::ID &&
+            static_cast<const td_api::receivedGift &>(*obj).can_be_upgraded_)
         {
-            auto error = td::move_tl_object_as<td_api::error>(obj);
-            spdlog::get("logger")->error("[Error] {}", to_string(error));
-            return;
+            checking.store(false, std::memory_order_relaxed);
+            td_coro::spawn(upgrade_gift(id, 25000, {}));
         }
-        else if (obj->get_id() == td_api::receivedGift::ID)
-        {
-            auto gift = td::move_tl_object_as<td_api::receivedGift>(obj);
-            if (gift->can_be_upgraded_)
+        offload([obj = std::move(obj), taken, sent, received]() mutable
+                {
+            TraceSpan span("check.log");
+            if (taken)
             {
-
-                checking.store(false, std::memory_order_relaxed);
-                auto upgrade_gift = td_api::make_object<td_api::upgradeGift>(bb, id, false, 25000);
-                send_query(std::move(upgrade_gift), [this](Object obj)
-                            {
-                                            if (obj->get_id() == td_api::error::ID)
-                                            {
-                                                auto error = td::move_tl_object_as<td_api::error>(obj);
-                                                spdlog::get("logger")->error("[Error] {}", to_string(error));
-                                                return;
-                                            }
-                                            else if (obj->get_id() == td_api::upgradeGiftResult::ID)
-                                            {
-                                                auto upgrade_result = td::move_tl_object_as<td_api::upgradeGiftResult>(obj);
-                                                spdlog::get("logger")->info("[Upgrade Result] {}", to_string(upgrade_result));
-                                            } });
+                auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(*taken);
+                spdlog::get("logger")->info("[Check] Time taken: {} ms | sent/recieved: {}/{}", duration.count(), sent, received);
             }
-            spdlog::get("logger")->info("[Gift] ID: {}, Upgradeble: {}, type_id: {}",
-                                        gift->received_gift_id_, gift->can_be_upgraded_, gift->gift_->get_id());
+            if (obj->get_id() == td_api::error::ID)
+            {
+                auto error = td::move_tl_object_as<td_api::error>(obj);
+                spdlog::get("logger")->error("[Error] {}", to_string(error));
+            }
+            else if (obj->get_id() == td_api::receivedGift::ID)
+            {
+                auto gift = td::move_tl_object_as<td_api::receivedGift>(obj);
+                spdlog::get("logger")->info("[Gift] ID: {}, Upgradeble: {}, type_id: {}",
+                                            gift->received_gift_id_, gift->can_be_upgraded_, gift->gift_->get_id());
 
-            auto sentgift = td::move_tl_object_as<td_api::sentGiftRegular>(gift->gift_);
+                auto sentgift = td::move_tl_object_as<td_api::sentGiftRegular>(gift->gift_);
 
-            spdlog::get("logger")->info("[Gift] ID: {}, starCount: {}, total: {}, usc: {}",
-                                        sentgift->gift_->id_, sentgift->gift_->star_count_, sentgift->gift_->overall_limits_->total_count_, sentgift->gift_->upgrade_star_count_);
-        }
-        else
-        {
-            spdlog::get("logger")->error("[Error] ID = {}", obj->get_id());
-        }
+                spdlog::get("logger")->info("[Gift] ID: {}, starCount: {}, total: {}, usc: {}",
+                                            sentgift->gift_->id_, sentgift->gift_->star_count_, sentgift->gift_->overall_limits_->total_count_, sentgift->gift_->upgrade_star_count_);
+            }
+            else
+            {
+                spdlog::get("logger")->error("[Error] ID = {}", obj->get_id());
+            } });
         return;
     }
 
     if (response.request_id > 900000000) {
-        std::string to_log;
-        {
-            std::lock_guard lk(times_mutex_);
-
-            auto it = times.find(received_);
-            if (it != times.end())
+        // следующий запрос цели уходит раньше, чем мы разберём этот ответ
+        const auto query_id = upgrade_pipeline_.on_response(response.request_id);
+        std::optional<std::chrono::steady_clock::duration> taken =
+            send_times_.take(static_cast<std::uint64_t>(received_.load()), std::chrono::steady_clock::now());
+        const auto sent = sent_.load(std::memory_order_relaxed);
+        const auto received = received_.load(std::memory_order_relaxed);
+        received_.fetch_add(1, std::memory_order_relaxed);
+        offload([obj = std::move(response.object), taken, sent, received, query_id]() mutable
+                {
+            TraceSpan span("upgrade.log", static_cast<std::int64_t>(query_id));
+            std::string to_log;
+            if (taken)
+            {
+                auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(*taken);
+                std::ostringstream oss;
+                oss << "Time taken("
+                    << query_id - 900000000
+                    << "): "
+                    << std::setw(3) << std::right << duration.count() // по умолчанию заполняется пробелами
+                    << " ms | sent/received: "
+                    << sent
+                    << "/"
+                    << received << " ";
+                to_log += oss.str();
+            }
+            if (obj->get_id() == td_api::error::ID)
             {
+                auto error = td::move_tl_object_as<td_api::error>(obj);
+                if (error->code_ == 400 && error->message_ == "STARGIFT_UPGRADE_UNAVAILABLE") {
+                    to_log += "E(400): Unavailable";
+                }
+                else if (error->code_ == 400 && error->message_ == "Have not enough Telegram Stars")
                 {
-                    auto now = std::chrono::steady_clock::now();
-                    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - it->second);
-                    std::ostringstream oss;
-                    oss << "Time taken("
-                        << response.request_id - 900000000
-                        << "): "
-                        << std::setw(3) << std::right << duration.count() // по умолчанию заполняется пробелами
-                        << " ms | sent/received: "
-                        << sent_
-                        << "/"
-                        << received_ << " ";
-                    to_log += oss.str();
-                    times.erase(it);
+                    to_log += "E(400):" + fmt::format(fg(fmt::color::red)," Not enough");
+                }
+                else {
+                    to_log += "E(" + std::to_string(error->code_) + "): " + error->message_;
                 }
             }
-        }
-        received_.fetch_add(1, std::memory_order_relaxed);
-        auto obj = std::move(response.object);
-        if (obj->get_id() == td_api::error::ID)
-        {
-            auto error = td::move_tl_object_as<td_api::error>(obj);
-            if (error->code_ == 400 && error->message_ == "STARGIFT_UPGRADE_UNAVAILABLE") {
-                to_log += "E(400): Unavailable";
-            }
-            else if (error->code_ == 400 && error->message_ == "Have not enough Telegram Stars")
+            else if (obj->get_id() == td_api::upgradeGiftResult::ID)
             {
-                to_log += "E(400):" + fmt::format(fg(fmt::color::red)," Not enough");
+                auto upgrade_result = td::move_tl_object_as<td_api::upgradeGiftResult>(obj);
+                to_log += "Success: " + to_string(upgrade_result);
+                // checking.store(false, std::memory_order_relaxed);
             }
             else {
-                to_log += "E(" + std::to_string(error->code_) + "): " + error->message_;
+                to_log += "Recieved: " + std::to_string(obj->get_id());
             }
-        }
-        else if (obj->get_id() == td_api::upgradeGiftResult::ID)
-        {
-            auto upgrade_result = td::move_tl_object_as<td_api::upgradeGiftResult>(obj);
-            to_log += "Success: " + to_string(upgrade_result);
-            // checking.store(false, std::memory_order_relaxed);
-        }
-        else {
-            to_log += "Recieved: " + std::to_string(obj->get_id());
-        }
 
-        spdlog::get("logger")->info("[Response] {}", to_log);
+            spdlog::get("logger")->info("[Response] {}", to_log); });
         return;
     }
     else
     {
-
-        auto it = handlers_.find(response.request_id);
-        if (it != handlers_.end())
+        std::function<void(Object)> handler;
+        auto handler_class = HandlerClass::Critical;
+        {
+            std::lock_guard lk(handlers_mutex_);
+            auto it = handlers_.find(response.request_id);
+            if (it != handlers_.end())
+            {
+                handler = std::move(it->second.handler);
+                handler_class = it->second.handler_class;
+                handlers_.erase(it);
+            }
+        }
+        if (handler && handler_class == HandlerClass::Bulk && bulk_pool_)
+        {
+            bulk_pool_->submit([handler = std::move(handler), obj = std::move(response.object), id = response.request_id]() mutable
+                               {
+                TraceSpan span("handler.bulk", static_cast<std::int64_t>(id));
+                handler(std::move(obj)); });
+        }
+        else if (handler)
         {
-            it->second(std::move(response.object));
-            handlers_.erase(it);
+            TraceSpan span("handler", static_cast<std::int64_t>(response.request_id));
+            handler(std::move(response.object));
         }
         return;
     }
@@ -452,11 +653,6 @@ void TdInterface::process_response(td::ClientManager::Response response)
 void TdInterface::process_update(object_ptr<td_api::Object> update)
 {
     td_api::downcast_call(*update, overloaded(
-                                       [this](td_api::updateAuthorizationState &auth_state)
-                                       {
-                                           authorization_state_ = std::move(auth_state.authorization_state_);
-                                           on_authorization_state_update();
-                                       },
                                        [this](td_api::updateNewMessage &update_new_message)
                                        {
                                            auto &msg = update_new_message.message_;
@@ -486,13 +682,13 @@ void TdInterface::process_update(object_ptr<td_api::Object> update)
                                                 
                                                 else if (msg->chat_id_ == 879292729 && text_msg->text_->text_ == "upg") {
                                                     
-                                                    if (checking.load(std::memory_order_relaxed))
+                                                    bool idle = false;
+                                                    if (!checking.compare_exchange_strong(idle, true, std::memory_order_acq_rel))
                                                     {
                                                         spdlog::get("output")->info("[State] Already checking for upgrades");
                                                     }
                                                     else {
                                                         int millis = 50;
-                                                        checking.store(true, std::memory_order_relaxed);
                                                         std::thread([this, millis]()
                                                                     { upgrade_loop(millis); })
                                                             .detach();
@@ -509,155 +705,202 @@ using td_api::int64;
 
 void TdInterface::test()
 {
-    // Получаем текущего пользователя
-    send_query(td_api::make_object<td_api::getMe>(),
-               [this](Object obj)
-               {
-                   if (obj->get_id() == td_api::error::ID)
-                   {
-                       auto e = td::move_tl_object_as<td_api::error>(obj);
-                       spdlog::get("logger")->error("[test] getMe error: {}", to_string(e));
-                       return;
-                   }
-                   if (obj->get_id() != td_api::user::ID)
-                   {
-                       spdlog::get("logger")->error("[test] getMe unexpected object id={}", obj->get_id());
-                       return;
-                   }
-
-                   auto me = td::move_tl_object_as<td_api::user>(obj);
-                   td_api::int64 my_id = me->id_;
-                   spdlog::get("logger")->info("[test] using my user_id={}", my_id);
-
-                   // Дальше используем уже существующую перегрузку
-                   this->test(my_id);
-               });
+    td_coro::spawn(test_flow());
 }
 
-void TdInterface::test(td_api::int64 owner_user_id) {
-    namespace fs = std::filesystem;
-
-    const fs::path out_dir = "gifts_channel";
-    std::error_code ec;
-    fs::create_directories(out_dir, ec); // ок, если уже существует
-
-    // Сохраняем стикер под ИМЕНЕМ ПОЛУЧЕННОГО ПОДАРКА (received_gift_id_, это string)
-    auto save_sticker = [this, out_dir](const td_api::object_ptr<td_api::sticker>& st,
-                                        const std::string& received_gift_id) {
-        if (!st || !st->sticker_) return;
-
-        int32 file_id = st->sticker_->id_; // TDLib file_id
-        send_query(td_api::make_object<td_api::downloadFile>(file_id, /*priority*/32, /*offset*/0, /*limit*/0, /*synchronous*/true),
-                   [this, out_dir, received_gift_id](Object obj) {
-            if (obj->get_id() != td_api::file::ID) {
-                spdlog::get("logger")->warn("[StickerSave] not a File (gift_id={})", received_gift_id);
-                return;
-            }
-            auto file = td::move_tl_object_as<td_api::file>(obj);
-            if (!file->local_ || file->local_->path_.empty()) {
-                spdlog::get("logger")->warn("[StickerSave] no local path (gift_id={})", received_gift_id);
-                return;
-            }
-            try {
-                fs::path src_path(file->local_->path_);
-                fs::path dst = out_dir / (received_gift_id + src_path.extension().string());
-                if (!fs::exists(dst)) {
-                    fs::copy_file(src_path, dst, fs::copy_options::none);
-                }
-            } catch (const std::exception& e) {
-                spdlog::get("logger")->warn("[StickerSave] exception: {} (gift_id={})", e.what(), received_gift_id);
-            }
-        });
-    };
+td_coro::Task<void> TdInterface::test_flow()
+{
+    // Получаем текущего пользователя
+    td_api::object_ptr<td_api::error> e;
+    auto me = td_coro::expect<td_api::user>(co_await query(td_api::make_object<td_api::getMe>()), &e);
+    if (!me)
+    {
+        spdlog::get("logger")->error("[test] getMe error: {}", to_string(e));
+        co_return;
+    }
+    spdlog::get("logger")->info("[test] using my user_id={}", me->id_);
 
-    const std::string bb;                  // business_connection_id пустой
+    // Дальше используем уже существующую перегрузку
+    test(me->id_);
+}
 
-    auto fetch_page = std::make_shared<std::function<void(std::string)>>();
+td_coro::Task<bool> TdInterface::check_then_upgrade(std::string received_gift_id, std::int64_t price, td_coro::CancellationToken token)
+{
+    td_api::object_ptr<td_api::error> e;
+    auto gift = td_coro::expect<td_api::receivedGift>(
+        co_await query(td_api::make_object<td_api::getReceivedGift>(received_gift_id), token), &e);
+    if (!gift)
+    {
+        spdlog::get("logger")->error("[check] {}: {}", received_gift_id, to_string(e));
+        co_return false;
+    }
+    if (!gift->can_be_upgraded_)
+    {
+        spdlog::get("logger")->info("[check] {} can't be upgraded yet", received_gift_id);
+        co_return false;
+    }
+    co_return co_await upgrade_gift(std::move(received_gift_id), price, std::move(token));
+}
 
-    *fetch_page = [this, fetch_page, owner_user_id, bb, save_sticker](std::string offset) {
-        td_api::object_ptr<td_api::MessageSender> sender;
-        if (owner_user_id < 0) {
-            sender = td_api::make_object<td_api::messageSenderChat>(owner_user_id);
-        } else {
-            sender = td_api::make_object<td_api::messageSenderUser>(owner_user_id);
-        }
-        auto req = td_api::make_object<td_api::getReceivedGifts>(
-            bb,
-            std::move(sender),
-			/*collection_id*/0,	
-            /*exclude_unsaved*/false,
-            /*exclude_saved*/false,
-            /*exclude_unlimited*/false,
-            /*exclude_upgradable*/false,
-            /*exclude_non_upgradable*/false,
-            /*exclude_upgraded*/false,
-            /*sort_by_price*/false,
-			false,
-			false,
-            offset,
-            /*limit*/100
-        );
+td_coro::Task<bool> TdInterface::upgrade_gift(std::string received_gift_id, std::int64_t price, td_coro::CancellationToken token)
+{
+    td_api::object_ptr<td_api::error> e;
+    auto result = td_coro::expect<td_api::upgradeGiftResult>(
+        co_await query(td_api::make_object<td_api::upgradeGift>(bb, received_gift_id, false, price), token), &e);
+    if (!result)
+    {
+        spdlog::get("logger")->error("[Error] {}", to_string(e));
+        co_return false;
+    }
+    spdlog::get("logger")->info("[Upgrade Result] {}", to_string(result));
+    co_return true;
+}
 
-        send_query(std::move(req), [this, fetch_page, save_sticker](Object obj) {
-            if (obj->get_id() == td_api::error::ID) {
-                auto e = td::move_tl_object_as<td_api::error>(obj);
-                spdlog::get("logger")->error("[getReceivedGifts] {}", to_string(e));
-                return;
-            }
-            if (obj->get_id() != td_api::receivedGifts::ID) {
-                spdlog::get("logger")->error("[getReceivedGifts] unexpected object {}", obj->get_id());
-                return;
-            }
+td_coro::Task<void> TdInterface::buy_gifts(std::vector<td_api::int64> gift_ids, td_api::int64 owner_id)
+{
+    // не больше 4 sendGift в полёте: остальные ждут в семафоре, а не в очереди TDLib
+    td_coro::AsyncSemaphore limit(4);
+    std::vector<td_coro::Task<bool>> buys;
+    buys.reserve(gift_ids.size());
+    for (auto gift_id : gift_ids) {
+        buys.push_back(buy_gift(gift_id, owner_id, limit));
+    }
+    auto results = co_await td_coro::when_all(std::move(buys));
+    spdlog::get("output")->info("[buy_loop] bought {}/{}", std::count(results.begin(), results.end(), true), results.size());
+}
 
-            auto gifts = td::move_tl_object_as<td_api::receivedGifts>(obj);
+td_coro::Task<bool> TdInterface::buy_gift(td_api::int64 gift_id, td_api::int64 owner_id, td_coro::AsyncSemaphore &limit)
+{
+    co_await limit.acquire();
+    auto req = td_api::make_object<td_api::sendGift>(
+        gift_id,
+        make_sender(owner_id),
+        td_api::make_object<td_api::formattedText>(
+            std::string{}, std::vector<td_api::object_ptr<td_api::textEntity>>{}
+        ),
+        true,
+        false
+    );
+    auto res = co_await query(std::move(req));
+    limit.release();
+    if (res->get_id() == td_api::error::ID) {
+        auto e = td::move_tl_object_as<td_api::error>(res);
+        spdlog::get("logger")->warn("[buy_loop] sendGift id={} -> error: {}", gift_id, to_string(e));
+        co_return false;
+    }
+    spdlog::get("output")->info("[buy_loop] sendGift id={} -> OK ({})", gift_id, res->get_id());
+    co_return true;
+}
 
-            for (auto &rg : gifts->gifts_) {
-                if (!rg || !rg->gift_) continue;
+void TdInterface::test(td_api::int64 owner_user_id) {
+    crawl_gifts({owner_user_id});
+}
 
-                const std::string received_id = rg->received_gift_id_; // <-- ВАЖНО: это string
+std::shared_future<CrawlStats> TdInterface::crawl_gifts(std::vector<td_api::int64> owners, bool incremental)
+{
+    // кого обходим целиком: всех при !incremental, иначе тех, кого давно (или ни разу) не обходили
+    auto full = std::make_shared<std::unordered_set<td_api::int64>>();
+    {
+        std::lock_guard lk(full_crawl_mutex_);
+        const auto now = std::chrono::steady_clock::now();
+        for (auto owner : owners) {
+            auto it = last_full_crawl_.find(owner);
+            if (!incremental || it == last_full_crawl_.end() || now - it->second >= full_refresh_interval_) {
+                full->insert(owner);
+            }
+        }
+    }
+    // id, встреченные при полном обходе; страницы одного владельца идут по очереди
+    struct Seen
+    {
+        std::mutex mutex;
+        std::unordered_map<td_api::int64, std::unordered_set<std::string>> ids;
+    };
+    auto seen = std::make_shared<Seen>();
+    return crawler_.crawl(
+        std::move(owners),
+        [this, full, seen](td_api::int64 owner, td_api::receivedGifts &page)
+        {
+            TraceSpan span("crawl.page", owner);
+            const bool is_full = full->count(owner) > 0;
+            std::unordered_set<std::string> *ids = nullptr;
+            if (is_full) {
+                std::lock_guard lk(seen->mutex);
+                ids = &seen->ids[owner]; // узлы unordered_map не переезжают
+            }
+            bool changed = false;
+            for (auto &rg : page.gifts_) {
+                if (!rg) continue;
+                if (ids) ids->insert(rg->received_gift_id_);
+                if (!rg->gift_) continue;
+                auto entry = make_inventory_entry(owner, *rg);
+                attributes_.upsert(entry);
+                changed |= inventory_.upsert(std::move(entry));
+                on_received_gift(owner, *rg);
+            }
+            if (is_full && page.next_offset_.empty()) {
+                // последняя страница полного обхода: чего не встретили — у владельца больше нет
+                std::unordered_set<std::string> all;
+                {
+                    std::lock_guard lk(seen->mutex);
+                    all = std::move(seen->ids[owner]);
+                    seen->ids.erase(owner);
+                }
+                const auto evicted = inventory_.evict_missing(owner, all);
+                for (const auto &id : evicted) {
+                    attributes_.remove(id);
+                }
+                if (!evicted.empty()) {
+                    spdlog::get("logger")->info("[crawler] owner={} evicted {} gifts no longer owned", owner, evicted.size());
+                }
+                std::lock_guard lk(full_crawl_mutex_);
+                last_full_crawl_[owner] = std::chrono::steady_clock::now();
+            }
+            // подарки идут от новых к старым: страница без изменений — дальше всё уже в кэше
+            return is_full || changed;
+        },
+        [this](const CrawlStats &)
+        { inventory_.save(); });
+}
 
-                switch (rg->gift_->get_id()) {
-                    case td_api::sentGiftRegular::ID: {
-                        auto reg = td::move_tl_object_as<td_api::sentGiftRegular>(rg->gift_);
-                        if (!reg || !reg->gift_) break;
+void TdInterface::on_received_gift(td_api::int64 /*owner*/, td_api::receivedGift &rg)
+{
+    const std::string received_id = rg.received_gift_id_; // <-- ВАЖНО: это string
 
-                        // ЛОГ: только id полученного подарка
-                        spdlog::get("output")->info("gift_id={} upg_price={}", received_id, reg->gift_->upgrade_star_count_);
+    switch (rg.gift_->get_id()) {
+        case td_api::sentGiftRegular::ID: {
+            auto reg = td::move_tl_object_as<td_api::sentGiftRegular>(rg.gift_);
+            if (!reg || !reg->gift_) break;
 
-                        // Сохранить соответствующий стикер под именем id подарка
-                        save_sticker(reg->gift_->sticker_, received_id);
-                        break;
-                    }
-                    case td_api::sentGiftUpgraded::ID: {
-                        auto up = td::move_tl_object_as<td_api::sentGiftUpgraded>(rg->gift_);
-                        if (!up || !up->gift_) break;
-                        const auto &g = up->gift_;
-
-                        const char* model    = (g->model_    && !g->model_->name_.empty())    ? g->model_->name_.c_str()    : "-";
-                        const char* backdrop = (g->backdrop_ && !g->backdrop_->name_.empty()) ? g->backdrop_->name_.c_str() : "-";
-                        const char* symbol   = (g->symbol_   && !g->symbol_->name_.empty())   ? g->symbol_->name_.c_str()   : "-";
-
-                        // ЛОГ: id полученного подарка + важные поля уникального
-                        spdlog::get("output")->info("gift_id={} model={} backdrop={} symbol={}",
-                                                    received_id, model, backdrop, symbol);
-                        break;
-                    }
-                    default:
-                        spdlog::get("output")->info("gift_id={} type={}", received_id, rg->gift_->get_id());
-                        break;
-                }
-            }
+            // ЛОГ: только id полученного подарка
+            spdlog::get("output")->info("gift_id={} upg_price={}", received_id, reg->gift_->upgrade_star_count_);
 
-            if (!gifts->next_offset_.empty()) {
-                (*fetch_page)(gifts->next_offset_);
+            // Сохранить соответствующий стикер под именем id подарка
+            if (reg->gift_->sticker_) {
+                sticker_cache_.request(*reg->gift_->sticker_, received_id);
             }
-        });
-    };
-
-    (*fetch_page)("");
+            break;
+        }
+        case td_api::sentGiftUpgraded::ID: {
+            auto up = td::move_tl_object_as<td_api::sentGiftUpgraded>(rg.gift_);
+            if (!up || !up->gift_) break;
+            const auto &g = up->gift_;
+
+            const char* model    = (g->model_    && !g->model_->name_.empty())    ? g->model_->name_.c_str()    : "-";
+            const char* backdrop = (g->backdrop_ && !g->backdrop_->name_.empty()) ? g->backdrop_->name_.c_str() : "-";
+            const char* symbol   = (g->symbol_   && !g->symbol_->name_.empty())   ? g->symbol_->name_.c_str()   : "-";
+
+            // ЛОГ: id полученного подарка + важные поля уникального
+            spdlog::get("output")->info("gift_id={} model={} backdrop={} symbol={}",
+                                        received_id, model, backdrop, symbol);
+            break;
+        }
+        default:
+            spdlog::get("output")->info("gift_id={} type={}", received_id, rg.gift_->get_id());
+            break;
+    }
 }
 
-
 void TdInterface::check_for_upgrade()
 {
     while (true) {
@@ -672,135 +915,517 @@ void TdInterface::check_for_upgrade()
 }
 
 
-void TdInterface::on_authorization_state_update()
+void TdInterface::on_authorization_state_update(Session &session)
 {
-    spdlog::get("logger")->info("Authorization state update");
-    authentication_query_id_++;
-    td_api::downcast_call(*authorization_state_, overloaded(
-                                                     [this](td_api::authorizationStateReady &)
+    const bool active = session.client_id == client_id_.load(std::memory_order_acquire);
+    spdlog::get("logger")->info("Authorization state update (client {}{})", session.client_id, active ? "" : ", standby");
+    session.authentication_query_id++;
+    td_api::downcast_call(*session.authorization_state, overloaded(
+                                                     [this, &session, active](td_api::authorizationStateReady &)
                                                      {
-                                                         are_authorized_ = true;
+                                                         session.are_authorized = true;
+                                                         session.closing = false;
+                                                         if (!active)
+                                                         {
+                                                             standby_waiting_.store(0, std::memory_order_relaxed);
+                                                             standby_ready_.store(true, std::memory_order_relaxed);
+                                                             spdlog::get("output")->info("[standby] client {} ready", session.client_id);
+                                                             if (authorized_once_) return;
+                                                         }
+                                                         else
+                                                         {
+                                                             mark_recovered();
+                                                             report_startup();
+                                                             // резерв авторизуется до старта команд: иначе его запросы кода делили бы stdin с ними
+                                                             if (!standby_directory_.empty() && standby_id_ == 0)
+                                                             {
+                                                                 create_standby();
+                                                                 if (!authorized_once_) return;
+                                                             }
+                                                         }
+                                                         authorized_once_ = true;
                                                          on_authorized();
                                                      },
-                                                     [this](td_api::authorizationStateLoggingOut &)
+                                                     [this, &session, active](td_api::authorizationStateLoggingOut &)
                                                      {
-                                                         are_authorized_ = false;
+                                                         session.are_authorized = false;
                                                          spdlog::get("output")->info("Logging out");
+                                                         if (active) failover(session);
+                                                         else standby_ready_.store(false, std::memory_order_relaxed);
                                                      },
-                                                     [this](td_api::authorizationStateClosing &)
+                                                     [this, &session, active](td_api::authorizationStateClosing &)
                                                      {
                                                          spdlog::get("output")->info("Closing");
+                                                         if (active) failover(session);
+                                                         else standby_ready_.store(false, std::memory_order_relaxed);
                                                      },
-                                                     [this](td_api::authorizationStateClosed &)
+                                                     [this, &session](td_api::authorizationStateClosed &)
                                                      {
-                                                         are_authorized_ = false;
-                                                         need_restart_ = true;
+                                                         session.are_authorized = false;
                                                          spdlog::get("output")->info("Terminated");
                                                      },
-                                                     [this](td_api::authorizationStateWaitPhoneNumber &)
+                                                     [this, &session, active](td_api::authorizationStateWaitPhoneNumber &)
                                                      {
+                                                         if (defer_standby_login(session, active)) return;
                                                          spdlog::get("output")->info("Enter phone number: ");
                                                          std::string phone_number;
                                                          std::cin >> phone_number;
-                                                         send_query(
+                                                         send_to(session,
                                                              td_api::make_object<td_api::setAuthenticationPhoneNumber>(phone_number, nullptr),
-                                                             create_authentication_query_handler());
+                                                             create_authentication_query_handler(session));
                                                      },
-                                                     [this](td_api::authorizationStateWaitEmailAddress &)
+                                                     [this, &session, active](td_api::authorizationStateWaitEmailAddress &)
                                                      {
+                                                         if (defer_standby_login(session, active)) return;
                                                          spdlog::get("output")->info("Enter email address: ");
                                                          std::string email_address;
                                                          std::cin >> email_address;
-                                                         send_query(td_api::make_object<td_api::setAuthenticationEmailAddress>(email_address),
-                                                                    create_authentication_query_handler());
+                                                         send_to(session, td_api::make_object<td_api::setAuthenticationEmailAddress>(email_address),
+                                                                    create_authentication_query_handler(session));
                                                      },
-                                                     [this](td_api::authorizationStateWaitEmailCode &)
+                                                     [this, &session, active](td_api::authorizationStateWaitEmailCode &)
                                                      {
+                                                         if (defer_standby_login(session, active)) return;
                                                          spdlog::get("output")->info("Enter email authentication code: ");
                                                          std::string code;
                                                          std::cin >> code;
-                                                         send_query(td_api::make_object<td_api::checkAuthenticationEmailCode>(
+                                                         send_to(session, td_api::make_object<td_api::checkAuthenticationEmailCode>(
                                                                         td_api::make_object<td_api::emailAddressAuthenticationCode>(code)),
-                                                                    create_authentication_query_handler());
+                                                                    create_authentication_query_handler(session));
                                                      },
-                                                     [this](td_api::authorizationStateWaitCode &)
+                                                     [this, &session, active](td_api::authorizationStateWaitCode &)
                                                      {
+                                                         if (defer_standby_login(session, active)) return;
                                                          spdlog::get("output")->info("Enter authentication code: ");
                                                          std::string code;
                                                          std::cin >> code;
-                                                         send_query(td_api::make_object<td_api::checkAuthenticationCode>(code),
-                                                                    create_authentication_query_handler());
+                                                         send_to(session, td_api::make_object<td_api::checkAuthenticationCode>(code),
+                                                                    create_authentication_query_handler(session));
                                                      },
-                                                     [this](td_api::authorizationStateWaitRegistration &)
+                                                     [this, &session, active](td_api::authorizationStateWaitRegistration &)
                                                      {
+                                                         if (defer_standby_login(session, active)) return;
                                                          std::string first_name;
                                                          std::string last_name;
                                                          spdlog::get("output")->info("Enter your first name: ");
                                                          std::cin >> first_name;
                                                          spdlog::get("output")->info("Enter your last name: ");
                                                          std::cin >> last_name;
-                                                         send_query(td_api::make_object<td_api::registerUser>(first_name, last_name, false),
-                                                                    create_authentication_query_handler());
+                                                         send_to(session, td_api::make_object<td_api::registerUser>(first_name, last_name, false),
+                                                                    create_authentication_query_handler(session));
                                                      },
-                                                     [this](td_api::authorizationStateWaitPassword &)
+                                                     [this, &session, active](td_api::authorizationStateWaitPassword &)
                                                      {
+                                                         if (defer_standby_login(session, active)) return;
                                                          spdlog::get("output")->info("Enter authentication password: ");
                                                          std::string password;
                                                          std::getline(std::cin, password);
-                                                         send_query(td_api::make_object<td_api::checkAuthenticationPassword>(password),
-                                                                    create_authentication_query_handler());
+                                                         send_to(session, td_api::make_object<td_api::checkAuthenticationPassword>(password),
+                                                                    create_authentication_query_handler(session));
                                                      },
-                                                     [this](td_api::authorizationStateWaitOtherDeviceConfirmation &state)
+                                                     [](td_api::authorizationStateWaitOtherDeviceConfirmation &state)
                                                      {
                                                          spdlog::get("output")->info("Confirm this login link on another device: {}", state.link_);
                                                      },
-                                                     [this](td_api::authorizationStateWaitTdlibParameters &)
+                                                     [this, &session](td_api::authorizationStateWaitTdlibParameters &)
                                                      {
+                                                         const bool full = profile_ == SessionProfile::Full;
+                                                         if (!full)
+                                                         {
+                                                             // опции до setTdlibParameters: часть из них читается только при старте
+                                                             for (const char *option : {"ignore_background_updates", "disable_top_chats",
+                                                                                        "disable_persistent_network_statistics",
+                                                                                        "use_storage_optimizer", "ignore_file_names"})
+                                                             {
+                                                                 send_to(session, td_api::make_object<td_api::setOption>(
+                                                                                      option, td_api::make_object<td_api::optionValueBoolean>(true)),
+                                                                         {});
+                                                             }
+                                                         }
                                                          auto request = td_api::make_object<td_api::setTdlibParameters>();
-                                                         request->database_directory_ = "ai_agent_td";
-                                                         request->use_message_database_ = true;
-                                                         request->use_secret_chats_ = true;
+                                                         request->database_directory_ = session.database_directory;
+                                                         // chat info оставляем и в lean: заголовки чатов/имена без запросов после рестарта
+                                                         request->use_chat_info_database_ = true;
+                                                         // стикеры мы храним сами (StickerCache), file id между сессиями не нужны
+                                                         request->use_file_database_ = full;
+                                                         request->use_message_database_ = full;
+                                                         request->use_secret_chats_ = full;
                                                          request->api_id_ = api_id_;
                                                          request->api_hash_ = api_hash_;
                                                          request->system_language_code_ = "en";
                                                          request->device_model_ = "Desktop";
                                                          request->application_version_ = "1.0";
-                                                         send_query(std::move(request), create_authentication_query_handler());
+                                                         send_to(session, std::move(request), create_authentication_query_handler(session));
                                                      },
                                                      [](auto &){}
                                                      ));
 }
 
-void TdInterface::check_authentication_error(Object object)
+void TdInterface::check_authentication_error(std::int32_t client_id, Object object)
 {
     if (object->get_id() == td_api::error::ID)
     {
         auto error = td::move_tl_object_as<td_api::error>(object);
         spdlog::get("logger")->error("Auth error: {}", to_string(error));
-        on_authorization_state_update();
+        auto session = sessions_.find(client_id);
+        if (session != sessions_.end())
+        {
+            on_authorization_state_update(*session->second);
+        }
     }
 }
 
-std::function<void(TdInterface::Object)> TdInterface::create_authentication_query_handler()
+std::function<void(TdInterface::Object)> TdInterface::create_authentication_query_handler(Session &session)
 {
-    return [this, id = authentication_query_id_](Object object)
+    return [this, client_id = session.client_id, id = session.authentication_query_id](Object object)
     {
-        if (id == authentication_query_id_)
+        auto session = sessions_.find(client_id);
+        if (session != sessions_.end() && id == session->second->authentication_query_id)
         {
-            check_authentication_error(std::move(object));
+            check_authentication_error(client_id, std::move(object));
         }
     };
 }
 
+std::optional<SessionProfile> parse_session_profile(const std::string &name)
+{
+    if (name == "lean") return SessionProfile::Lean;
+    if (name == "full") return SessionProfile::Full;
+    return std::nullopt;
+}
+
+const char *session_profile_name(SessionProfile profile)
+{
+    return profile == SessionProfile::Full ? "full" : "lean";
+}
+
+void TdInterface::set_handler_workers(std::size_t workers)
+{
+    bulk_pool_ = workers ? std::make_unique<WorkPool>(workers) : nullptr;
+}
+
+void TdInterface::offload(WorkJob job)
+{
+    if (bulk_pool_)
+    {
+        bulk_pool_->submit(std::move(job));
+    }
+    else
+    {
+        job();
+    }
+}
+
+WorkPool::Stats TdInterface::bulk_stats() const
+{
+    return bulk_pool_ ? bulk_pool_->stats() : WorkPool::Stats{};
+}
+
+void TdInterface::record_loop_busy(std::chrono::steady_clock::duration busy)
+{
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(busy).count();
+    loop_responses_.fetch_add(1, std::memory_order_relaxed);
+    loop_busy_ns_.fetch_add(ns, std::memory_order_relaxed);
+    // пишет только loop(), так что max без CAS
+    if (ns > loop_max_ns_.load(std::memory_order_relaxed))
+    {
+        loop_max_ns_.store(ns, std::memory_order_relaxed);
+    }
+    if (ns > 1000000)
+    {
+        loop_stalls_1ms_.fetch_add(1, std::memory_order_relaxed);
+        if (ns > 10000000)
+        {
+            loop_stalls_10ms_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+TdInterface::LoopStats TdInterface::loop_stats() const
+{
+    LoopStats s;
+    s.responses = loop_responses_.load(std::memory_order_relaxed);
+    s.busy_ms = static_cast<double>(loop_busy_ns_.load(std::memory_order_relaxed)) / 1e6;
+    s.max_stall_ms = static_cast<double>(loop_max_ns_.load(std::memory_order_relaxed)) / 1e6;
+    s.stalls_over_1ms = loop_stalls_1ms_.load(std::memory_order_relaxed);
+    s.stalls_over_10ms = loop_stalls_10ms_.load(std::memory_order_relaxed);
+    return s;
+}
+
+std::size_t TdInterface::rss_bytes()
+{
+    // statm: size resident shared ... (в страницах)
+    std::ifstream statm("/proc/self/statm");
+    std::size_t size = 0, resident = 0;
+    if (!(statm >> size >> resident))
+    {
+        return 0;
+    }
+    return resident * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+}
+
+void TdInterface::report_startup()
+{
+    if (startup_reported_)
+    {
+        return;
+    }
+    startup_reported_ = true;
+    const auto took = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started_at_);
+    const char *name = session_profile_name(profile_);
+    spdlog::get("logger")->info("[profile] {}: authorized in {} ms, RSS {:.1f} MB", name, took.count(), rss_bytes() / 1048576.0);
+    std::thread([name, delay = rss_sample_delay_]()
+                {
+        std::this_thread::sleep_for(delay);
+        spdlog::get("logger")->info("[profile] {}: RSS {:.1f} MB after {} s", name, rss_bytes() / 1048576.0, delay.count()); })
+        .detach();
+}
+
 void TdInterface::restart()
 {
-    spdlog::get("logger")->warn("Restarting...");
-    client_manager_.reset();
+    // транспорт (ClientManager) не пересоздаём: в нём может жить резервный клиент
+    need_restart_ = false;
+    auto &session = create_session(restart_directory_);
+    spdlog::get("logger")->warn("Restarting: new client {} on {}", session.client_id, session.database_directory);
+    client_id_.store(session.client_id, std::memory_order_release);
+    send_to(session, td_api::make_object<td_api::getOption>("version"), {});
+}
 
-    td::ClientManager::execute(td_api::make_object<td_api::setLogVerbosityLevel>(1));
-    client_manager_ = std::make_unique<td::ClientManager>();
-    client_id_ = client_manager_->create_client_id();
-    send_query(td_api::make_object<td_api::getOption>("version"), {});
+TdInterface::Session &TdInterface::create_session(std::string database_directory)
+{
+    auto session = std::make_unique<Session>();
+    session->client_id = transport_->create_client_id();
+    session->database_directory = std::move(database_directory);
+    auto &ref = *session;
+    sessions_[ref.client_id] = std::move(session);
+    return ref;
+}
+
+void TdInterface::enable_standby(std::string database_directory)
+{
+    standby_directory_ = std::move(database_directory);
+}
+
+void TdInterface::create_standby()
+{
+    auto &session = create_session(standby_directory_);
+    standby_id_ = session.client_id;
+    standby_ready_.store(false, std::memory_order_relaxed);
+    spdlog::get("logger")->info("[standby] starting client {} on {}", session.client_id, session.database_directory);
+    // любой запрос запускает клиента; дальше он сам пройдёт авторизацию из своей базы
+    send_to(session, td_api::make_object<td_api::getOption>("version"), {});
+}
+
+namespace
+{
+    const char *login_input_name(std::int32_t state_id)
+    {
+        switch (state_id)
+        {
+        case td_api::authorizationStateWaitPhoneNumber::ID:
+            return "phone";
+        case td_api::authorizationStateWaitEmailAddress::ID:
+            return "email";
+        case td_api::authorizationStateWaitEmailCode::ID:
+            return "email_code";
+        case td_api::authorizationStateWaitCode::ID:
+            return "code";
+        case td_api::authorizationStateWaitRegistration::ID:
+            return "registration";
+        case td_api::authorizationStateWaitPassword::ID:
+            return "password";
+        default:
+            return "";
+        }
+    }
+} // namespace
+
+bool TdInterface::defer_standby_login(Session &session, bool active)
+{
+    // первая авторизация идёт до старта команд — там stdin свободен
+    if (active || !authorized_once_)
+    {
+        return false;
+    }
+    const std::int32_t state_id = session.authorization_state->get_id();
+    standby_waiting_.store(state_id, std::memory_order_relaxed);
+    standby_ready_.store(false, std::memory_order_relaxed);
+    spdlog::get("logger")->warn("[standby] client {} needs {} to log in, left unready (answer with: standby <{}>)",
+                                session.client_id, login_input_name(state_id), login_input_name(state_id));
+    return true;
+}
+
+std::string TdInterface::standby_waiting_for() const
+{
+    return login_input_name(standby_waiting_.load(std::memory_order_relaxed));
+}
+
+bool TdInterface::standby_login(std::string input)
+{
+    if (standby_waiting_.load(std::memory_order_relaxed) == 0)
+    {
+        return false;
+    }
+    {
+        std::lock_guard lk(standby_input_mutex_);
+        standby_input_ = std::move(input);
+    }
+    has_standby_input_.store(true, std::memory_order_release);
+    return true;
+}
+
+void TdInterface::apply_standby_input()
+{
+    std::string input;
+    {
+        std::lock_guard lk(standby_input_mutex_);
+        has_standby_input_.store(false, std::memory_order_relaxed);
+        if (!standby_input_)
+        {
+            return;
+        }
+        input = std::move(*standby_input_);
+        standby_input_.reset();
+    }
+    auto it = sessions_.find(standby_id_);
+    const std::int32_t waiting = standby_waiting_.exchange(0, std::memory_order_relaxed);
+    if (it == sessions_.end() || !it->second->authorization_state || it->second->authorization_state->get_id() != waiting)
+    {
+        spdlog::get("logger")->warn("[standby] login input dropped: standby is no longer waiting for it");
+        return;
+    }
+    Session &session = *it->second;
+    object_ptr<td_api::Function> f;
+    switch (waiting)
+    {
+    case td_api::authorizationStateWaitPhoneNumber::ID:
+        f = td_api::make_object<td_api::setAuthenticationPhoneNumber>(input, nullptr);
+        break;
+    case td_api::authorizationStateWaitEmailAddress::ID:
+        f = td_api::make_object<td_api::setAuthenticationEmailAddress>(input);
+        break;
+    case td_api::authorizationStateWaitEmailCode::ID:
+        f = td_api::make_object<td_api::checkAuthenticationEmailCode>(
+            td_api::make_object<td_api::emailAddressAuthenticationCode>(input));
+        break;
+    case td_api::authorizationStateWaitCode::ID:
+        f = td_api::make_object<td_api::checkAuthenticationCode>(input);
+        break;
+    case td_api::authorizationStateWaitRegistration::ID:
+    {
+        const auto space = input.find(' ');
+        f = td_api::make_object<td_api::registerUser>(input.substr(0, space),
+                                                      space == std::string::npos ? std::string() : input.substr(space + 1), false);
+        break;
+    }
+    case td_api::authorizationStateWaitPassword::ID:
+        f = td_api::make_object<td_api::checkAuthenticationPassword>(input);
+        break;
+    default:
+        return;
+    }
+    spdlog::get("logger")->info("[standby] sending {} for client {}", login_input_name(waiting), session.client_id);
+    send_to(session, std::move(f), create_authentication_query_handler(session));
+}
+
+void TdInterface::fail_pending(std::int32_t client_id, const std::string &reason)
+{
+    // ответов от закрытого клиента уже не будет: обработчики получают ошибку сейчас, а не висят вечно
+    std::vector<std::function<void(Object)>> failed;
+    {
+        std::lock_guard lk(handlers_mutex_);
+        for (auto it = handlers_.begin(); it != handlers_.end();)
+        {
+            if (it->second.client_id == client_id)
+            {
+                failed.push_back(std::move(it->second.handler));
+                it = handlers_.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+    if (!failed.empty())
+    {
+        spdlog::get("logger")->warn("[failover] failing {} in-flight queries of client {}", failed.size(), client_id);
+    }
+    for (auto &handler : failed)
+    {
+        handler(td_api::make_object<td_api::error>(500, reason));
+    }
+}
+
+void TdInterface::failover(Session &failed)
+{
+    if (failed.closing)
+    {
+        return; // Closing и Closed приходят оба, переключаемся на первом
+    }
+    failed.closing = true;
+    failure_started_ns_ = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              std::chrono::steady_clock::now().time_since_epoch())
+                              .count();
+
+    auto standby = sessions_.find(standby_id_);
+    if (standby != sessions_.end() && standby->second->are_authorized)
+    {
+        // циклы (upgrade/buy/crawler) читают client_id_ на каждой отправке — продолжают уже в резерв
+        client_id_.store(standby->second->client_id, std::memory_order_release);
+        standby_id_ = failed.client_id; // после Closed пересоздадим на его базе
+        standby_ready_.store(false, std::memory_order_relaxed);
+        failovers_.fetch_add(1, std::memory_order_relaxed);
+        spdlog::get("logger")->warn("[failover] client {} -> standby {}", failed.client_id, standby->second->client_id);
+        mark_recovered();
+    }
+    else
+    {
+        spdlog::get("logger")->warn("[failover] client {} is closing, no ready standby — will restart", failed.client_id);
+    }
+    fail_pending(failed.client_id, "Client closed");
+    // запросы пайплайна идут мимо handlers_: их слоты освобождаем отдельно
+    upgrade_pipeline_.reset_in_flight();
+}
+
+void TdInterface::on_closed(std::int32_t client_id)
+{
+    auto it = sessions_.find(client_id);
+    if (it == sessions_.end())
+    {
+        return;
+    }
+    std::string directory = it->second->database_directory;
+    sessions_.erase(it);
+    fail_pending(client_id, "Client closed");
+
+    if (client_id == client_id_.load(std::memory_order_acquire))
+    {
+        upgrade_pipeline_.reset_in_flight();
+        // резерва не было — старое поведение, новый клиент на той же базе
+        restart_directory_ = std::move(directory);
+        need_restart_ = true;
+    }
+    else if (client_id == standby_id_)
+    {
+        standby_id_ = 0;
+        standby_directory_ = std::move(directory);
+        create_standby();
+    }
+}
+
+void TdInterface::mark_recovered()
+{
+    if (failure_started_ns_ == 0)
+    {
+        return;
+    }
+    const auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now().time_since_epoch())
+                         .count();
+    spdlog::get("logger")->warn("[failover] active client usable {} us after failure", (now - failure_started_ns_) / 1000);
+    failed_at_ns_.store(failure_started_ns_, std::memory_order_relaxed);
+    failure_started_ns_ = 0;
 }
 
 void TdInterface::on_authorized()
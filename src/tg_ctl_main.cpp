@@ -0,0 +1,110 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Клиент control-сокета tg_gifts:
+//   tg_ctl [-s PATH] '{"cmd":"upg","interval_ms":25,"gifts_file":"gifts.json"}'
+//   tg_ctl [-s PATH] upg 25 gifts.json
+//   tg_ctl [-s PATH]            — команды построчно со stdin
+// PATH по умолчанию — $TG_CONTROL_SOCKET или tg_gifts.sock. Код возврата 1, если хоть один ответ с "ok":false.
+namespace
+{
+    bool roundtrip(int fd, const std::string &line, std::string &pending, std::string &reply)
+    {
+        const std::string out = line + "\n";
+        for (std::size_t sent = 0; sent < out.size();)
+        {
+            ssize_t n = ::send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+            if (n < 0)
+            {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            sent += static_cast<std::size_t>(n);
+        }
+        char buf[4096];
+        std::size_t pos;
+        while ((pos = pending.find('\n')) == std::string::npos)
+        {
+            ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            pending.append(buf, static_cast<std::size_t>(n));
+        }
+        reply = pending.substr(0, pos);
+        pending.erase(0, pos + 1);
+        return true;
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const char *env = std::getenv("TG_CONTROL_SOCKET");
+    std::string path = env ? env : "tg_gifts.sock";
+    int first = 1;
+    if (argc > 2 && std::string(argv[1]) == "-s")
+    {
+        path = argv[2];
+        first = 3;
+    }
+
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        std::cerr << "socket path too long: " << path << "\n";
+        return 2;
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+    {
+        std::cerr << "can't connect to " << path << ": " << std::strerror(errno) << "\n";
+        return 2;
+    }
+
+    std::string command;
+    for (int i = first; i < argc; ++i)
+    {
+        if (!command.empty()) command += ' ';
+        command += argv[i];
+    }
+
+    int rc = 0;
+    std::string pending, reply;
+    auto run = [&](const std::string &line) -> bool
+    {
+        if (!roundtrip(fd, line, pending, reply))
+        {
+            std::cerr << "connection closed\n";
+            rc = 2;
+            return false;
+        }
+        std::cout << reply << std::endl;
+        if (reply.find("\"ok\":false") != std::string::npos)
+        {
+            rc = rc ? rc : 1;
+        }
+        return true;
+    };
+
+    if (!command.empty())
+    {
+        run(command);
+    }
+    else
+    {
+        for (std::string line; std::getline(std::cin, line);)
+        {
+            if (line.empty()) continue;
+            if (!run(line)) break;
+        }
+    }
+    ::close(fd);
+    return rc;
+}
@@ -0,0 +1,109 @@
+#include "tgs_renderer.hpp"
+
+#include <spdlog/spdlog.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Замена python/convert_tgs.py: tgs_render <.tgs файлы или папки> [--to gif|webp|apng|png] [--outdir DIR]
+//                                         [--threads N] [--size PX] [--fps N]
+int main(int argc, char **argv)
+{
+    auto output = spdlog::stdout_color_mt("output");
+    output->set_pattern("%v");
+    auto logger = spdlog::stderr_color_mt("logger");
+    logger->set_level(spdlog::level::warn);
+
+    RenderOptions opts;
+    fs::path outdir = "converted";
+    std::size_t threads = std::thread::hardware_concurrency();
+    std::vector<fs::path> inputs;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string
+        { return i + 1 < argc ? argv[++i] : std::string{}; };
+        if (arg == "--to")
+        {
+            auto fmt = parse_render_format(value());
+            if (!fmt)
+            {
+                logger->error("--to: gif, webp, apng или png");
+                return 2;
+            }
+            opts.format = *fmt;
+        }
+        else if (arg == "--outdir")
+        {
+            outdir = value();
+        }
+        else if (arg == "--threads")
+        {
+            threads = std::stoul(value());
+        }
+        else if (arg == "--size")
+        {
+            opts.width = opts.height = std::stoi(value());
+        }
+        else if (arg == "--fps")
+        {
+            opts.fps = std::stoi(value());
+        }
+        else
+        {
+            inputs.emplace_back(arg);
+        }
+    }
+
+    std::vector<fs::path> files;
+    for (const auto &p : inputs)
+    {
+        std::error_code ec;
+        if (fs::is_directory(p, ec))
+        {
+            for (const auto &e : fs::directory_iterator(p, ec))
+            {
+                if (e.path().extension() == ".tgs")
+                {
+                    files.push_back(e.path());
+                }
+            }
+        }
+        else if (p.extension() == ".tgs")
+        {
+            files.push_back(p);
+        }
+    }
+    std::sort(files.begin(), files.end());
+    if (files.empty())
+    {
+        logger->error("Нет .tgs для обработки");
+        return 1;
+    }
+
+    TgsRenderer renderer(threads);
+    auto started = std::chrono::steady_clock::now();
+    std::size_t failed = 0;
+    for (const auto &f : files)
+    {
+        fs::path dst = outdir / (f.stem().string() + render_format_extension(opts.format));
+        if (renderer.convert(f, dst, opts))
+        {
+            output->info("[OK] {} -> {}", f.string(), dst.string());
+        }
+        else
+        {
+            output->info("[FAIL] {}", f.string());
+            ++failed;
+        }
+    }
+    auto took = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+    output->info("{} files, {} failed, {} ms on {} threads", files.size(), failed, took.count(), threads);
+    return failed == 0 ? 0 : 1;
+}
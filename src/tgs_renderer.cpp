@@ -0,0 +1,262 @@
+#include "tgs_renderer.hpp"
+#include "asset_index.hpp"
+
+#include <rlottie.h>
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <future>
+#include <zlib.h>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    // rlottie отдаёт premultiplied ARGB32 (0xAARRGGBB), кодерам нужен обычный RGBA
+    void unpremultiply(const std::vector<std::uint32_t> &argb, std::vector<std::uint8_t> &rgba)
+    {
+        rgba.resize(argb.size() * 4);
+        for (std::size_t i = 0; i < argb.size(); ++i)
+        {
+            const std::uint32_t p = argb[i];
+            const std::uint32_t a = p >> 24;
+            std::uint32_t r = (p >> 16) & 0xFF;
+            std::uint32_t g = (p >> 8) & 0xFF;
+            std::uint32_t b = p & 0xFF;
+            if (a != 0 && a != 255)
+            {
+                r = std::min(255u, r * 255 / a);
+                g = std::min(255u, g * 255 / a);
+                b = std::min(255u, b * 255 / a);
+            }
+            std::uint8_t *dst = rgba.data() + i * 4;
+            dst[0] = static_cast<std::uint8_t>(r);
+            dst[1] = static_cast<std::uint8_t>(g);
+            dst[2] = static_cast<std::uint8_t>(b);
+            dst[3] = static_cast<std::uint8_t>(a);
+        }
+    }
+} // namespace
+
+TgsRenderer::TgsRenderer(std::size_t threads)
+    : pool_(threads)
+{
+    dispatcher_ = std::thread([this]
+                              { dispatcher(); });
+}
+
+TgsRenderer::~TgsRenderer()
+{
+    {
+        std::lock_guard lk(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    dispatcher_.join();
+}
+
+bool TgsRenderer::gunzip(const fs::path &src, std::string &json)
+{
+    // gzread прозрачно читает и не сжатый файл, так что голый .json тоже подойдёт
+    gzFile f = gzopen(src.string().c_str(), "rb");
+    if (!f)
+    {
+        return false;
+    }
+    json.clear();
+    char buf[64 * 1024];
+    int n;
+    while ((n = gzread(f, buf, sizeof(buf))) > 0)
+    {
+        json.append(buf, static_cast<std::size_t>(n));
+    }
+    bool ok = n == 0;
+    gzclose(f);
+    return ok && !json.empty();
+}
+
+bool TgsRenderer::render_frames(const std::string &json, const RenderOptions &opts, RenderedAnimation &out)
+{
+    auto probe = rlottie::Animation::loadFromData(json, "", "", false);
+    if (!probe)
+    {
+        return false;
+    }
+    const std::size_t total = probe->totalFrame();
+    const double src_fps = probe->frameRate() > 0 ? probe->frameRate() : 60.0;
+    const std::size_t step = std::max<std::size_t>(1, static_cast<std::size_t>(std::lround(src_fps / std::max(1, opts.fps))));
+
+    std::vector<std::size_t> frame_numbers;
+    for (std::size_t f = 0; f < total; f += step)
+    {
+        frame_numbers.push_back(f);
+    }
+    if (frame_numbers.empty())
+    {
+        return false;
+    }
+
+    out.width = opts.width;
+    out.height = opts.height;
+    out.fps = src_fps / step;
+    out.frames.assign(frame_numbers.size(), {});
+
+    // рендер одного rlottie::Animation не потокобезопасен — каждому потоку свой экземпляр,
+    // кадры раздаются через один (k, k + N, ...)
+    const std::size_t workers = std::min(pool_.size(), frame_numbers.size());
+    std::vector<std::future<bool>> parts;
+    parts.reserve(workers);
+    for (std::size_t k = 0; k < workers; ++k)
+    {
+        parts.push_back(pool_.submit([&, k]() -> bool
+                                     {
+            auto anim = k == 0 ? std::move(probe) : rlottie::Animation::loadFromData(json, "", "", false);
+            if (!anim) {
+                return false;
+            }
+            std::vector<std::uint32_t> argb(static_cast<std::size_t>(opts.width) * opts.height);
+            for (std::size_t i = k; i < frame_numbers.size(); i += workers) {
+                std::fill(argb.begin(), argb.end(), 0u);
+                rlottie::Surface surface(argb.data(), opts.width, opts.height, opts.width * 4);
+                anim->renderSync(frame_numbers[i], surface);
+                unpremultiply(argb, out.frames[i]);
+            }
+            return true; }));
+    }
+    bool ok = true;
+    for (auto &p : parts)
+    {
+        ok &= p.get();
+    }
+    return ok;
+}
+
+bool TgsRenderer::convert(const fs::path &src, const fs::path &dst, const RenderOptions &opts)
+{
+    auto started = std::chrono::steady_clock::now();
+    std::string json;
+    if (!gunzip(src, json))
+    {
+        spdlog::get("logger")->warn("[render] can't read {}", src.string());
+        return false;
+    }
+    RenderedAnimation anim;
+    if (!render_frames(json, opts, anim))
+    {
+        spdlog::get("logger")->warn("[render] rlottie failed on {}", src.string());
+        return false;
+    }
+    std::string encoded;
+    if (!encode_animation(anim, opts.format, encoded, &pool_))
+    {
+        spdlog::get("logger")->warn("[render] encode failed for {}", src.string());
+        return false;
+    }
+
+    std::error_code ec;
+    fs::create_directories(dst.parent_path(), ec);
+    const fs::path tmp = dst.string() + ".tmp";
+    {
+        std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+        f.write(encoded.data(), static_cast<std::streamsize>(encoded.size()));
+        if (!f)
+        {
+            spdlog::get("logger")->warn("[render] can't write {}", tmp.string());
+            return false;
+        }
+    }
+    fs::rename(tmp, dst, ec);
+    if (ec)
+    {
+        spdlog::get("logger")->warn("[render] can't move {} -> {}: {}", tmp.string(), dst.string(), ec.message());
+        return false;
+    }
+
+    auto took = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+    spdlog::get("logger")->info("[render] {} -> {} ({} frames, {} KB, {} ms)",
+                                src.filename().string(), dst.string(), anim.frames.size(), encoded.size() / 1024, took.count());
+    return true;
+}
+
+void TgsRenderer::convert_async(fs::path src, fs::path dst, RenderOptions opts, Done done)
+{
+    std::error_code ec;
+    if (fs::exists(dst, ec))
+    {
+        if (done) done(dst);
+        return;
+    }
+    {
+        std::lock_guard lk(mutex_);
+        auto [it, inserted] = waiting_.try_emplace(dst.string());
+        if (done)
+        {
+            it->second.push_back(std::move(done));
+        }
+        if (!inserted)
+        {
+            return; // уже в очереди
+        }
+        jobs_.push_back(Job{std::move(src), std::move(dst), opts});
+    }
+    cv_.notify_one();
+}
+
+void TgsRenderer::set_asset_index(AssetIndex *index)
+{
+    std::lock_guard lk(mutex_);
+    assets_ = index;
+}
+
+void TgsRenderer::dispatcher()
+{
+    while (true)
+    {
+        Job job;
+        AssetIndex *assets;
+        {
+            std::unique_lock lk(mutex_);
+            cv_.wait(lk, [this]
+                     { return stop_ || !jobs_.empty(); });
+            if (stop_)
+            {
+                return;
+            }
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+            assets = assets_;
+        }
+
+        fs::path target = job.dst;
+        if (assets)
+        {
+            const std::string asset = assets->resolve(job.src);
+            if (!asset.empty())
+            {
+                target = job.dst.parent_path() / (asset + job.dst.extension().string());
+            }
+        }
+        std::error_code ec;
+        bool ok = fs::exists(target, ec) || convert(job.src, target, job.opts);
+
+        std::vector<Done> callbacks;
+        {
+            std::lock_guard lk(mutex_);
+            auto it = waiting_.find(job.dst.string());
+            if (it != waiting_.end())
+            {
+                callbacks = std::move(it->second);
+                waiting_.erase(it);
+            }
+        }
+        if (ok)
+        {
+            for (auto &cb : callbacks)
+            {
+                cb(target);
+            }
+        }
+    }
+}
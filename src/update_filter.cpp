@@ -0,0 +1,305 @@
+#include "update_filter.hpp"
+
+#include <td/telegram/td_api.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+namespace
+{
+    // Имена для команд до того, как тип хоть раз пришёл; остальные узнаются из to_string
+    struct KnownType
+    {
+        const char *name;
+        std::int32_t id;
+    };
+    const KnownType kKnownTypes[] = {
+        {"updateAuthorizationState", td_api::updateAuthorizationState::ID},
+        {"updateNewMessage", td_api::updateNewMessage::ID},
+        {"updateChatLastMessage", td_api::updateChatLastMessage::ID},
+        {"updateChatReadInbox", td_api::updateChatReadInbox::ID},
+        {"updateChatReadOutbox", td_api::updateChatReadOutbox::ID},
+        {"updateDeleteMessages", td_api::updateDeleteMessages::ID},
+        {"updateMessageContent", td_api::updateMessageContent::ID},
+        {"updateMessageEdited", td_api::updateMessageEdited::ID},
+        {"updateMessageInteractionInfo", td_api::updateMessageInteractionInfo::ID},
+        {"updateChatAction", td_api::updateChatAction::ID},
+        {"updateUser", td_api::updateUser::ID},
+        {"updateUserStatus", td_api::updateUserStatus::ID},
+        {"updateOption", td_api::updateOption::ID},
+        {"updateFile", td_api::updateFile::ID},
+    };
+
+    const char *known_name(std::int32_t id)
+    {
+        for (const auto &k : kKnownTypes)
+        {
+            if (k.id == id)
+            {
+                return k.name;
+            }
+        }
+        return nullptr;
+    }
+
+    template <class T>
+    std::optional<std::int64_t> chat_field(const td_api::Object &update)
+    {
+        return static_cast<const T &>(update).chat_id_;
+    }
+
+    // chat_id без обхода объекта; nullopt — у типа нет чата (или не знаем, где он)
+    std::optional<std::int64_t> chat_id_of(const td_api::Object &update)
+    {
+        switch (update.get_id())
+        {
+        case td_api::updateNewMessage::ID:
+        {
+            const auto &m = static_cast<const td_api::updateNewMessage &>(update).message_;
+            return m ? std::optional<std::int64_t>(m->chat_id_) : std::nullopt;
+        }
+        case td_api::updateChatLastMessage::ID:
+            return chat_field<td_api::updateChatLastMessage>(update);
+        case td_api::updateChatReadInbox::ID:
+            return chat_field<td_api::updateChatReadInbox>(update);
+        case td_api::updateChatReadOutbox::ID:
+            return chat_field<td_api::updateChatReadOutbox>(update);
+        case td_api::updateDeleteMessages::ID:
+            return chat_field<td_api::updateDeleteMessages>(update);
+        case td_api::updateMessageContent::ID:
+            return chat_field<td_api::updateMessageContent>(update);
+        case td_api::updateMessageEdited::ID:
+            return chat_field<td_api::updateMessageEdited>(update);
+        case td_api::updateMessageInteractionInfo::ID:
+            return chat_field<td_api::updateMessageInteractionInfo>(update);
+        case td_api::updateChatAction::ID:
+            return chat_field<td_api::updateChatAction>(update);
+        default:
+            return std::nullopt;
+        }
+    }
+
+    std::size_t hash(std::int32_t id)
+    {
+        // id конструкторов — crc32 имён, младшие биты и так разбросаны; перемешиваем на всякий случай
+        auto x = static_cast<std::uint32_t>(id);
+        x ^= x >> 16;
+        x *= 0x45d9f3bu;
+        x ^= x >> 16;
+        return x;
+    }
+} // namespace
+
+const char *update_rule_name(UpdateRule rule)
+{
+    switch (rule)
+    {
+    case UpdateRule::Drop:
+        return "drop";
+    case UpdateRule::Pass:
+        return "pass";
+    case UpdateRule::Chats:
+        return "chats";
+    }
+    return "?";
+}
+
+std::optional<UpdateRule> parse_update_rule(const std::string &s)
+{
+    if (s == "drop")
+        return UpdateRule::Drop;
+    if (s == "pass")
+        return UpdateRule::Pass;
+    if (s == "chats")
+        return UpdateRule::Chats;
+    return std::nullopt;
+}
+
+UpdateFilter::UpdateFilter()
+{
+    // авторизацию process_response разбирает раньше фильтра, правило — на случай перестановки
+    set_rule(td_api::updateAuthorizationState::ID, UpdateRule::Pass);
+    set_rule(td_api::updateNewMessage::ID, UpdateRule::Chats);
+    allow_chat(879292729);
+}
+
+bool UpdateFilter::pass(const td_api::Object &update)
+{
+    const std::int32_t id = update.get_id();
+    Slot *s = slot(id);
+    if (!s)
+    {
+        overflow_.fetch_add(1, std::memory_order_relaxed);
+        return default_rule() != UpdateRule::Drop;
+    }
+    s->seen.fetch_add(1, std::memory_order_relaxed);
+    if (s->naming.load(std::memory_order_acquire) == 0)
+    {
+        // один раз на тип: "updateFoo {\n ..." -> "updateFoo"
+        const std::string text = to_string(update);
+        set_name(*s, text.substr(0, text.find_first_of(" {\n")));
+    }
+
+    const std::uint8_t own = s->rule.load(std::memory_order_relaxed);
+    const UpdateRule rule = own ? static_cast<UpdateRule>(own - 1) : default_rule();
+    bool ok = rule == UpdateRule::Pass;
+    if (rule == UpdateRule::Chats)
+    {
+        const auto chat_id = chat_id_of(update);
+        ok = !chat_id || chat_allowed(*chat_id);
+    }
+    if (!ok)
+    {
+        s->dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    return ok;
+}
+
+void UpdateFilter::set_rule(std::int32_t type_id, UpdateRule rule)
+{
+    if (Slot *s = slot(type_id))
+    {
+        s->rule.store(static_cast<std::uint8_t>(rule) + 1, std::memory_order_relaxed);
+    }
+}
+
+void UpdateFilter::allow_chat(std::int64_t chat_id)
+{
+    std::lock_guard lk(chats_mutex_);
+    const auto current = chats_.load(std::memory_order_acquire);
+    if (std::find(current->begin(), current->end(), chat_id) != current->end())
+    {
+        return;
+    }
+    auto next = std::make_shared<std::vector<std::int64_t>>(*current);
+    next->push_back(chat_id);
+    chats_.store(std::move(next), std::memory_order_release);
+}
+
+void UpdateFilter::deny_chat(std::int64_t chat_id)
+{
+    std::lock_guard lk(chats_mutex_);
+    auto next = std::make_shared<std::vector<std::int64_t>>(*chats_.load(std::memory_order_acquire));
+    next->erase(std::remove(next->begin(), next->end(), chat_id), next->end());
+    chats_.store(std::move(next), std::memory_order_release);
+}
+
+std::vector<std::int64_t> UpdateFilter::chats() const
+{
+    return *chats_.load(std::memory_order_acquire);
+}
+
+std::optional<std::int32_t> UpdateFilter::type_id(const std::string &name) const
+{
+    if (!name.empty() && (std::isdigit(static_cast<unsigned char>(name[0])) || name[0] == '-'))
+    {
+        try
+        {
+            return static_cast<std::int32_t>(std::stol(name));
+        }
+        catch (...)
+        {
+            return std::nullopt;
+        }
+    }
+    for (const auto &k : kKnownTypes)
+    {
+        if (name == k.name)
+        {
+            return k.id;
+        }
+    }
+    for (const auto &s : slots_)
+    {
+        const auto id = s.id.load(std::memory_order_acquire);
+        if (id != 0 && s.naming.load(std::memory_order_acquire) == 2 && name == s.name)
+        {
+            return id;
+        }
+    }
+    return std::nullopt;
+}
+
+std::vector<UpdateFilter::TypeStats> UpdateFilter::stats() const
+{
+    std::vector<TypeStats> out;
+    for (const auto &s : slots_)
+    {
+        const auto id = s.id.load(std::memory_order_acquire);
+        if (id == 0)
+        {
+            continue;
+        }
+        TypeStats t;
+        t.id = id;
+        t.name = s.naming.load(std::memory_order_acquire) == 2 ? std::string(s.name) : std::to_string(id);
+        const std::uint8_t own = s.rule.load(std::memory_order_relaxed);
+        t.rule = own ? static_cast<UpdateRule>(own - 1) : default_rule();
+        t.seen = s.seen.load(std::memory_order_relaxed);
+        t.dropped = s.dropped.load(std::memory_order_relaxed);
+        out.push_back(std::move(t));
+    }
+    std::sort(out.begin(), out.end(), [](const TypeStats &a, const TypeStats &b)
+              { return a.seen > b.seen; });
+    return out;
+}
+
+void UpdateFilter::reset_counters()
+{
+    for (auto &s : slots_)
+    {
+        s.seen.store(0, std::memory_order_relaxed);
+        s.dropped.store(0, std::memory_order_relaxed);
+    }
+    overflow_.store(0, std::memory_order_relaxed);
+}
+
+UpdateFilter::Slot *UpdateFilter::slot(std::int32_t id)
+{
+    for (std::size_t i = 0, at = hash(id); i < kSlots; ++i, ++at)
+    {
+        Slot &s = slots_[at & (kSlots - 1)];
+        std::int32_t cur = s.id.load(std::memory_order_acquire);
+        if (cur == id)
+        {
+            return &s;
+        }
+        if (cur == 0)
+        {
+            // слоты только занимаются, не освобождаются — проба без удалений корректна
+            if (s.id.compare_exchange_strong(cur, id, std::memory_order_acq_rel) || cur == id)
+            {
+                if (const char *name = known_name(id))
+                {
+                    set_name(s, name);
+                }
+                return &s;
+            }
+        }
+    }
+    return nullptr;
+}
+
+void UpdateFilter::set_name(Slot &s, const std::string &name)
+{
+    std::uint8_t expected = 0;
+    if (!s.naming.compare_exchange_strong(expected, 1, std::memory_order_acquire))
+    {
+        return;
+    }
+    const std::size_t n = std::min(name.size(), kNameSize - 1);
+    std::memcpy(s.name, name.data(), n);
+    s.name[n] = '\0';
+    s.naming.store(2, std::memory_order_release);
+}
+
+bool UpdateFilter::chat_allowed(std::int64_t chat_id) const
+{
+    // id личного чата совпадает с id пользователя и положителен; группы и каналы — отрицательные
+    if (chat_id > 0 && allow_private())
+    {
+        return true;
+    }
+    const auto chats = chats_.load(std::memory_order_acquire);
+    return std::find(chats->begin(), chats->end(), chat_id) != chats->end();
+}
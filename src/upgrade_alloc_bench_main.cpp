@@ -0,0 +1,95 @@
+#include "latency_ring.hpp"
+#include "upgrade_template.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Аллокации и время на один запрос в горячем пути upgrade_loop.
+// legacy — как было: разбор id на каждую отправку + unordered_map времён под mutex;
+// template — UpgradeTemplate + LatencyRing. Объект запроса удаляется сразу, как это сделал бы TDLib.
+//   upgrade_alloc_bench [N]
+namespace
+{
+    std::atomic<std::size_t> g_allocs{0};
+}
+
+void *operator new(std::size_t n)
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(n ? n : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+namespace
+{
+    const std::vector<std::pair<std::string, std::int64_t>> kTargets = {
+        {"700279", 25000}, {"727170", 25000}, {"689019", 25000}, {"691933", 25000},
+        {"5212342398472139812", 25000}, {"gift_5212342398472139813", 25000}};
+
+    template <class F>
+    void run(const char *name, std::size_t n, F &&send)
+    {
+        const auto allocs = g_allocs.load();
+        const auto started = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            send(i);
+        }
+        const auto elapsed = std::chrono::steady_clock::now() - started;
+        std::printf("%-9s %8.2f allocs/req %8.1f ns/req\n", name,
+                    static_cast<double>(g_allocs.load() - allocs) / static_cast<double>(n),
+                    static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / static_cast<double>(n));
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const std::size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    const std::string bb;
+    std::uint64_t sink = 0;
+
+    std::unordered_map<int, std::chrono::steady_clock::time_point> times;
+    std::mutex times_mutex;
+    run("legacy", n, [&](std::size_t i)
+        {
+        const auto &[id, price] = kTargets[i % kTargets.size()];
+        auto t = UpgradeTemplate::make(id, price); // тот же разбор, что был в send_query_upgrade
+        auto req = t.build(bb);
+        sink += t.query_id;
+        {
+            std::lock_guard lk(times_mutex);
+            times[static_cast<int>(i)] = std::chrono::steady_clock::now();
+        }
+        std::lock_guard lk(times_mutex);
+        times.erase(static_cast<int>(i)); });
+
+    std::vector<UpgradeTemplate> templates;
+    for (const auto &[id, price] : kTargets)
+    {
+        templates.push_back(UpgradeTemplate::make(id, price));
+    }
+    LatencyRing ring;
+    run("template", n, [&](std::size_t i)
+        {
+        const auto &t = templates[i % templates.size()];
+        auto req = t.build(bb);
+        sink += t.query_id;
+        ring.record(i, std::chrono::steady_clock::now());
+        if (auto d = ring.take(i, std::chrono::steady_clock::now())) sink += static_cast<std::uint64_t>(d->count()); });
+
+    std::printf("(checksum %llu)\n", static_cast<unsigned long long>(sink));
+    return 0;
+}
@@ -0,0 +1,230 @@
+#include "upgrade_pipeline.hpp"
+#include "request_trace.hpp"
+
+#include <algorithm>
+#include <spdlog/spdlog.h>
+
+void UpgradePipeline::run(std::shared_ptr<const std::vector<UpgradeTemplate>> templates, int depth, double rate,
+                          const std::atomic<bool> &running)
+{
+    std::size_t lanes = 0;
+    {
+        std::lock_guard lk(mutex_);
+        running_ = &running;
+        ++generation_;
+        depth_ = std::max(1, depth);
+        lanes_.clear();
+        lane_of_.clear();
+        owed_ = 0;
+        stats_ = Stats{};
+        rebuild_locked(*templates);
+        // сразу можно выпустить по одному на полосу, дальше — в темпе rate
+        lanes = lanes_.size();
+        rate_.set_rate(rate, static_cast<double>(std::max<std::size_t>(1, lanes)));
+    }
+    active_.store(true, std::memory_order_release);
+    spdlog::get("logger")->info("[pipeline] {} lanes, depth {}, rate {}/s", lanes, depth, rate);
+
+    std::unique_lock lk(mutex_);
+    while (running.load(std::memory_order_acquire))
+    {
+        // просрочку проверяем раз в секунду: sent_ — несколько depth на полосу
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= next_expire_)
+        {
+            expire_locked(now);
+            next_expire_ = now + std::chrono::seconds(1);
+        }
+        if (owed_ == 0)
+        {
+            // running снаружи без notify — просыпаемся сами
+            cv_.wait_for(lk, std::chrono::milliseconds(50));
+            continue;
+        }
+        lk.unlock();
+        rate_.acquire();
+        lk.lock();
+        if (owed_ == 0 || !running.load(std::memory_order_acquire))
+        {
+            continue; // пока ждали токен, долг закрыл on_response или сменились цели
+        }
+        // по кругу, чтобы одна полоса с большим долгом не съела весь лимит
+        for (std::size_t n = 0; n < lanes_.size(); ++n)
+        {
+            Lane &lane = lanes_[scan_++ % lanes_.size()];
+            if (lane.owed > 0)
+            {
+                --lane.owed;
+                --owed_;
+                TraceSpan span("upgrade_pipeline.pace");
+                issue_locked(lane);
+                break;
+            }
+        }
+    }
+    active_.store(false, std::memory_order_release);
+    const auto s = stats_;
+    lk.unlock();
+    spdlog::get("logger")->info("[pipeline] stopped: sent {}, responses {}, deferred {}, expired {}", s.sent, s.responses,
+                                s.deferred, s.expired);
+}
+
+void UpgradePipeline::retarget(std::shared_ptr<const std::vector<UpgradeTemplate>> templates)
+{
+    if (!active())
+    {
+        return;
+    }
+    std::lock_guard lk(mutex_);
+    rebuild_locked(*templates);
+    cv_.notify_one();
+}
+
+std::uint64_t UpgradePipeline::on_response(std::uint64_t request_id)
+{
+    if (request_id < kRequestBase)
+    {
+        return request_id;
+    }
+    std::lock_guard lk(mutex_);
+    auto sent = sent_.find(request_id);
+    if (sent == sent_.end())
+    {
+        return request_id;
+    }
+    const Sent s = sent->second;
+    sent_.erase(sent);
+    auto it = lane_of_.find(s.query_id);
+    if (s.generation != generation_ || it == lane_of_.end())
+    {
+        return s.query_id; // прошлый запуск или цель уже убрали
+    }
+    Lane &lane = lanes_[it->second];
+    ++stats_.responses;
+    if (lane.in_flight > 0)
+    {
+        --lane.in_flight;
+    }
+    if (!active() || !running_->load(std::memory_order_acquire) || lane.in_flight + lane.owed >= lane.capacity)
+    {
+        return s.query_id; // остановлены или после retarget полоса уменьшилась
+    }
+    if (rate_.try_acquire())
+    {
+        TraceSpan span("upgrade_pipeline.refill", static_cast<std::int64_t>(s.query_id));
+        issue_locked(lane);
+        return s.query_id;
+    }
+    ++lane.owed;
+    ++owed_;
+    ++stats_.deferred;
+    cv_.notify_one();
+    return s.query_id;
+}
+
+void UpgradePipeline::reset_in_flight()
+{
+    std::size_t dropped = 0;
+    {
+        std::lock_guard lk(mutex_);
+        dropped = sent_.size();
+        sent_.clear();
+        owed_ = 0;
+        for (auto &lane : lanes_)
+        {
+            lane.in_flight = 0;
+            lane.owed = lane.capacity;
+            owed_ += lane.owed;
+        }
+        stats_.expired += dropped;
+        cv_.notify_one();
+    }
+    if (dropped > 0)
+    {
+        spdlog::get("logger")->warn("[pipeline] client closed, {} requests without response dropped", dropped);
+    }
+}
+
+void UpgradePipeline::expire_locked(std::chrono::steady_clock::time_point now)
+{
+    for (auto it = sent_.begin(); it != sent_.end();)
+    {
+        if (it->second.deadline > now)
+        {
+            ++it;
+            continue;
+        }
+        const Sent s = it->second;
+        it = sent_.erase(it);
+        ++stats_.expired;
+        auto lane_it = lane_of_.find(s.query_id);
+        if (s.generation != generation_ || lane_it == lane_of_.end())
+        {
+            continue;
+        }
+        Lane &lane = lanes_[lane_it->second];
+        if (lane.in_flight > 0)
+        {
+            --lane.in_flight;
+        }
+        if (lane.in_flight + lane.owed < lane.capacity)
+        {
+            ++lane.owed;
+            ++owed_;
+        }
+    }
+}
+
+UpgradePipeline::Stats UpgradePipeline::stats() const
+{
+    std::lock_guard lk(mutex_);
+    Stats s = stats_;
+    s.lanes = lanes_.size();
+    for (const auto &lane : lanes_)
+    {
+        s.in_flight += static_cast<std::size_t>(lane.in_flight);
+    }
+    return s;
+}
+
+void UpgradePipeline::rebuild_locked(const std::vector<UpgradeTemplate> &templates)
+{
+    std::vector<Lane> lanes;
+    std::unordered_map<std::uint64_t, std::size_t> lane_of;
+    for (const auto &t : templates)
+    {
+        auto [it, inserted] = lane_of.emplace(t.query_id, lanes.size());
+        if (inserted)
+        {
+            lanes.emplace_back();
+        }
+        Lane &lane = lanes[it->second];
+        lane.templates.push_back(t);
+        lane.capacity += depth_;
+    }
+    owed_ = 0;
+    for (auto &[query_id, index] : lane_of)
+    {
+        Lane &lane = lanes[index];
+        // запросы старой полосы ещё в полёте — их ответы по-прежнему доливают её
+        if (auto old = lane_of_.find(query_id); old != lane_of_.end())
+        {
+            lane.in_flight = lanes_[old->second].in_flight;
+        }
+        lane.owed = std::max(0, lane.capacity - lane.in_flight);
+        owed_ += lane.owed;
+    }
+    lanes_ = std::move(lanes);
+    lane_of_ = std::move(lane_of);
+    scan_ = 0;
+}
+
+void UpgradePipeline::issue_locked(Lane &lane)
+{
+    const UpgradeTemplate &t = lane.templates[lane.next++ % lane.templates.size()];
+    const std::uint64_t request_id = next_request_++;
+    sent_[request_id] = Sent{t.query_id, generation_, std::chrono::steady_clock::now() + kRequestTimeout};
+    ++lane.in_flight;
+    ++stats_.sent;
+    send_(t, request_id);
+}
@@ -0,0 +1,49 @@
+#include "upgrade_template.hpp"
+
+#include <cctype>
+
+UpgradeTemplate UpgradeTemplate::make(const std::string &received_gift_id, std::int64_t price)
+{
+    constexpr std::int64_t BASE = 900000000;
+    std::int64_t query_id = BASE;
+
+    bool full_parse_ok = false;
+    try {
+        std::size_t idx = 0;
+        long long v = std::stoll(received_gift_id, &idx, 10);
+        if (idx == received_gift_id.size() && v >= 0) {
+            query_id = BASE + static_cast<std::int64_t>(v);
+            full_parse_ok = true;
+        }
+    } catch (...) {
+    }
+
+    if (!full_parse_ok) {
+        const std::string& s = received_gift_id;
+
+        std::size_t j = s.size();
+        while (j > 0 && std::isdigit(static_cast<unsigned char>(s[j - 1]))) {
+            --j;
+        }
+        const std::size_t digits_len = s.size() - j;
+
+        if (digits_len > 0) {
+            std::string tail = s.substr(j, digits_len);
+            if (tail.size() > 6) {
+                tail = tail.substr(tail.size() - 6);
+            }
+            try {
+                std::int64_t suffix = std::stoll(tail);
+                query_id = BASE + suffix;
+            } catch (...) {
+            }
+        }
+    }
+
+    return UpgradeTemplate{received_gift_id, price, static_cast<std::uint64_t>(query_id)};
+}
+
+td::td_api::object_ptr<td::td_api::upgradeGift> UpgradeTemplate::build(const std::string &business_connection_id) const
+{
+    return td::td_api::make_object<td::td_api::upgradeGift>(business_connection_id, received_gift_id, false, price);
+}
@@ -0,0 +1,118 @@
+#include "work_pool.hpp"
+#include "request_trace.hpp"
+
+#include <spdlog/spdlog.h>
+#include <exception>
+
+WorkPool::WorkPool(std::size_t threads)
+{
+    threads = threads == 0 ? 1 : threads;
+    for (std::size_t i = 0; i < threads; ++i)
+    {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    for (std::size_t i = 0; i < threads; ++i)
+    {
+        threads_.emplace_back([this, i]
+                              { run(i); });
+    }
+}
+
+WorkPool::~WorkPool()
+{
+    {
+        std::lock_guard lk(sleep_mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto &t : threads_)
+    {
+        t.join();
+    }
+}
+
+void WorkPool::submit(WorkJob job)
+{
+    auto &w = *workers_[next_.fetch_add(1, std::memory_order_relaxed) % workers_.size()];
+    {
+        std::lock_guard lk(w.mutex);
+        w.jobs.push_back(std::move(job));
+    }
+    {
+        std::lock_guard lk(sleep_mutex_);
+        ++pending_;
+    }
+    submitted_.fetch_add(1, std::memory_order_relaxed);
+    cv_.notify_one();
+}
+
+bool WorkPool::take(std::size_t index, WorkJob &job)
+{
+    {
+        auto &own = *workers_[index];
+        std::lock_guard lk(own.mutex);
+        if (!own.jobs.empty())
+        {
+            job = std::move(own.jobs.front());
+            own.jobs.pop_front();
+            return true;
+        }
+    }
+    for (std::size_t k = 1; k < workers_.size(); ++k)
+    {
+        auto &victim = *workers_[(index + k) % workers_.size()];
+        std::lock_guard lk(victim.mutex);
+        if (!victim.jobs.empty())
+        {
+            job = std::move(victim.jobs.back());
+            victim.jobs.pop_back();
+            stolen_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkPool::run(std::size_t index)
+{
+    RequestTrace::name_thread("bulk_worker");
+    while (true)
+    {
+        {
+            std::unique_lock lk(sleep_mutex_);
+            cv_.wait(lk, [this]
+                     { return pending_ > 0 || stop_; });
+            if (pending_ == 0)
+            {
+                return; // stop_ и очереди пусты
+            }
+            --pending_;
+        }
+        // задачу уже «заняли» счётчиком — в какой-то из очередей она точно есть
+        WorkJob job;
+        while (!take(index, job))
+        {
+            std::this_thread::yield();
+        }
+        try
+        {
+            job();
+        }
+        catch (const std::exception &e)
+        {
+            spdlog::get("logger")->error("[pool] job failed: {}", e.what());
+        }
+        executed_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+WorkPool::Stats WorkPool::stats() const
+{
+    Stats s;
+    s.submitted = submitted_.load(std::memory_order_relaxed);
+    s.executed = executed_.load(std::memory_order_relaxed);
+    s.stolen = stolen_.load(std::memory_order_relaxed);
+    std::lock_guard lk(sleep_mutex_);
+    s.queued = pending_;
+    return s;
+}
@@ -0,0 +1,74 @@
+#include "test_main.hpp"
+#include "asset_index.hpp"
+
+#include <limits>
+
+namespace
+{
+    constexpr int kSide = AssetFingerprint::kSide;
+    constexpr std::uint32_t kGrey = 0xFF808080u;
+
+    std::vector<std::uint32_t> flat(std::uint32_t argb)
+    {
+        return std::vector<std::uint32_t>(static_cast<std::size_t>(kSide) * kSide, argb);
+    }
+
+    void paint(std::vector<std::uint32_t> &frame, int x0, int y0, int x1, int y1, std::uint32_t argb)
+    {
+        for (int y = y0; y < y1; ++y)
+        {
+            for (int x = x0; x < x1; ++x)
+            {
+                frame[static_cast<std::size_t>(y) * kSide + x] = argb;
+            }
+        }
+    }
+
+    AssetFingerprint fingerprint_of(const std::vector<std::uint32_t> &frame)
+    {
+        AssetFingerprint fp;
+        fp.total_frames = 60;
+        fp.fps = 60;
+        for (std::size_t k = 0; k < AssetFingerprint::kFrames; ++k)
+        {
+            fp.set_frame(k, frame);
+        }
+        return fp;
+    }
+
+    constexpr auto kNoMatch = std::numeric_limits<std::size_t>::max();
+} // namespace
+
+TEST(asset_identical_frames_match)
+{
+    const auto fp = fingerprint_of(flat(kGrey));
+    CHECK_EQ(fp.distance(fp), std::size_t(0));
+}
+
+TEST(asset_chroma_sees_top_half)
+{
+    // одинаковая яркость, разный цвет в верхней левой клетке 4x4
+    auto base = flat(kGrey);
+    auto red = base;
+    auto blue = base;
+    paint(red, 0, 0, kSide / 4, kSide / 4, 0xFFC04040u);
+    paint(blue, 0, 0, kSide / 4, kSide / 4, 0xFF4040C0u);
+    CHECK_EQ(fingerprint_of(red).distance(fingerprint_of(blue)), kNoMatch);
+    CHECK_EQ(fingerprint_of(base).distance(fingerprint_of(red)), kNoMatch);
+}
+
+TEST(asset_chroma_sees_bottom_half)
+{
+    auto base = flat(kGrey);
+    auto tinted = base;
+    paint(tinted, 3 * kSide / 4, 3 * kSide / 4, kSide, kSide, 0xFF40C040u);
+    CHECK_EQ(fingerprint_of(base).distance(fingerprint_of(tinted)), kNoMatch);
+}
+
+TEST(asset_small_colour_noise_still_matches)
+{
+    // пересжатие сдвигает цвет на единицы — это та же картинка
+    auto a = flat(kGrey);
+    auto b = flat(0xFF828081u);
+    CHECK(fingerprint_of(a).distance(fingerprint_of(b)) != kNoMatch);
+}
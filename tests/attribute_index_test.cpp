@@ -0,0 +1,54 @@
+#include "test_main.hpp"
+#include "attribute_index.hpp"
+
+namespace
+{
+    InventoryEntry upgraded(const std::string &id, td_api::int64 owner, const std::string &model, const std::string &backdrop)
+    {
+        InventoryEntry e;
+        e.received_gift_id = id;
+        e.owner = owner;
+        e.upgraded = true;
+        e.model = model;
+        e.backdrop = backdrop;
+        e.symbol = "Star";
+        return e;
+    }
+} // namespace
+
+TEST(attribute_query_and_remove)
+{
+    AttributeIndex index;
+    index.upsert(upgraded("a", 1, "Cat", "Black"));
+    index.upsert(upgraded("b", 1, "Dog", "Black"));
+    index.upsert(upgraded("c", 2, "Cat", "White"));
+    CHECK_EQ(index.size(), std::size_t(3));
+
+    AttributeQuery q;
+    q.model = "Cat";
+    std::size_t total = 0;
+    CHECK_EQ(index.query(q, &total).size(), std::size_t(2));
+
+    q.backdrop = "Black";
+    const auto hits = index.query(q, &total);
+    CHECK_EQ(total, std::size_t(1));
+    CHECK(hits.size() == 1 && hits[0].received_gift_id == "a");
+
+    // строка освобождается и переиспользуется, битмапы её больше не отдают
+    index.remove("a");
+    CHECK_EQ(index.query(q, &total).size(), std::size_t(0));
+    index.upsert(upgraded("d", 3, "Cat", "Black"));
+    const auto reused = index.query(q, &total);
+    CHECK(reused.size() == 1 && reused[0].received_gift_id == "d" && reused[0].owner == 3);
+    CHECK_EQ(index.size(), std::size_t(3));
+}
+
+TEST(attribute_query_parse)
+{
+    const auto q = parse_attribute_query("backdrop=Onyx Black symbol=Star limit=5");
+    CHECK(q.has_value());
+    CHECK(q->backdrop == "Onyx Black");
+    CHECK(q->symbol == "Star");
+    CHECK_EQ(q->limit, std::size_t(5));
+    CHECK(!parse_attribute_query("nonsense").has_value());
+}
@@ -0,0 +1,107 @@
+#include "test_main.hpp"
+#include "catalog_series.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <unistd.h>
+
+namespace
+{
+    std::string temp_path(const char *name)
+    {
+        const auto p = std::filesystem::temp_directory_path() / (std::string(name) + "." + std::to_string(::getpid()));
+        std::filesystem::remove(p);
+        return p.string();
+    }
+
+    CatalogSnapshot snapshot(std::int64_t time_ms, std::vector<CatalogPoint> gifts)
+    {
+        return CatalogSnapshot{time_ms, std::move(gifts)};
+    }
+
+    // деструктор писателя дописывает очередь
+    void write_session(const std::string &path, std::vector<CatalogSnapshot> snapshots)
+    {
+        CatalogSeriesWriter w;
+        CHECK(w.open(path));
+        for (auto &s : snapshots)
+        {
+            w.push(std::move(s));
+        }
+    }
+
+    void append_bytes(const std::string &path, std::initializer_list<unsigned char> bytes)
+    {
+        std::ofstream f(path, std::ios::binary | std::ios::app);
+        for (auto b : bytes)
+        {
+            f.put(static_cast<char>(b));
+        }
+    }
+} // namespace
+
+TEST(catalog_round_trip_two_sessions)
+{
+    const auto path = temp_path("catalog_round_trip");
+    write_session(path, {snapshot(1000, {{1, 10, 100, 50}, {2, 20, 0, 0}}),
+                         snapshot(2000, {{1, 11, 100, 49}, {2, 20, 0, 0}})});
+    // вторая сессия: в ключевом кадре подарка 2 нет, позже он приходит дельтой от нуля
+    write_session(path, {snapshot(3000, {{1, 12, 100, 48}}),
+                         snapshot(4000, {{1, 12, 100, 48}, {2, 25, 0, 0}})});
+
+    CatalogSeriesReader r;
+    CHECK(r.load(path));
+    CHECK(!r.truncated());
+    CHECK_EQ(r.frames(), std::size_t(4));
+
+    const auto &one = r.series().at(1);
+    CHECK_EQ(one.size(), std::size_t(3));
+    CHECK_EQ(one[1].time_ms, std::int64_t(2000));
+    CHECK_EQ(one[1].price, std::int64_t(11));
+    CHECK_EQ(one[1].remaining, std::int64_t(49));
+    CHECK_EQ(one[2].time_ms, std::int64_t(3000));
+    CHECK_EQ(one[2].price, std::int64_t(12));
+    CHECK_EQ(one[2].total, std::int64_t(100));
+
+    const auto &two = r.series().at(2);
+    CHECK_EQ(two.size(), std::size_t(2));
+    CHECK_EQ(two[1].time_ms, std::int64_t(4000));
+    CHECK_EQ(two[1].price, std::int64_t(25));
+    std::filesystem::remove(path);
+}
+
+TEST(catalog_open_trims_torn_tail)
+{
+    const auto path = temp_path("catalog_torn");
+    write_session(path, {snapshot(1000, {{1, 10, 100, 50}})});
+    append_bytes(path, {0x40, 0x01}); // длина 64, тела нет
+
+    CatalogSeriesReader torn;
+    CHECK(torn.load(path));
+    CHECK(torn.truncated());
+
+    write_session(path, {snapshot(2000, {{1, 9, 100, 40}})});
+    CatalogSeriesReader r;
+    CHECK(r.load(path));
+    CHECK(!r.truncated());
+    CHECK_EQ(r.frames(), std::size_t(2));
+    CHECK_EQ(r.series().at(1).back().price, std::int64_t(9));
+    std::filesystem::remove(path);
+}
+
+TEST(catalog_reader_stops_at_corrupt_body)
+{
+    const auto path = temp_path("catalog_corrupt");
+    write_session(path, {snapshot(1000, {{1, 10, 100, 50}})});
+    // целый по длине кадр: flags 0, dt 1, записей 5 — а данных на полторы
+    append_bytes(path, {0x06, 0x00, 0x02, 0x05, 0x02, 0x02, 0x02});
+    // следующий корректный по виду кадр уже не должен применяться
+    append_bytes(path, {0x07, 0x00, 0x02, 0x01, 0x02, 0x02, 0x00, 0x00});
+
+    CatalogSeriesReader r;
+    CHECK(r.load(path));
+    CHECK(r.truncated());
+    CHECK_EQ(r.frames(), std::size_t(1));
+    CHECK_EQ(r.series().at(1).size(), std::size_t(1));
+    std::filesystem::remove(path);
+}
@@ -0,0 +1,86 @@
+#include "test_main.hpp"
+#include "gift_inventory.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <unistd.h>
+
+namespace
+{
+    std::string temp_path(const char *name)
+    {
+        const auto p = std::filesystem::temp_directory_path() / (std::string(name) + "." + std::to_string(::getpid()));
+        std::filesystem::remove(p);
+        return p.string();
+    }
+
+    // заголовок GINVENT1: magic, version, count, strings_size
+    std::string header(std::uint32_t count, std::uint64_t strings_size)
+    {
+        std::string h(24, '\0');
+        std::memcpy(h.data(), "GINVENT1", 8);
+        const std::uint32_t version = 1;
+        std::memcpy(h.data() + 8, &version, 4);
+        std::memcpy(h.data() + 12, &count, 4);
+        std::memcpy(h.data() + 16, &strings_size, 8);
+        return h;
+    }
+
+    void write_raw(const std::string &path, const std::string &bytes)
+    {
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << bytes;
+    }
+} // namespace
+
+TEST(inventory_save_load_round_trip)
+{
+    const auto path = temp_path("inventory_round_trip");
+    {
+        GiftInventory inv;
+        CHECK(!inv.load(path));
+        InventoryEntry e;
+        e.received_gift_id = "42";
+        e.owner = -100123;
+        e.gift_id = 7;
+        e.upgraded = true;
+        e.model = "Cat";
+        e.backdrop = "Onyx Black";
+        e.symbol = "Star";
+        CHECK(inv.upsert(e));
+        CHECK(inv.save());
+        CHECK(!std::filesystem::exists(path + ".tmp"));
+    }
+    GiftInventory inv;
+    CHECK(inv.load(path));
+    CHECK_EQ(inv.size(), std::size_t(1));
+    const auto e = inv.find("42");
+    CHECK(e && e->owner == -100123 && e->backdrop == "Onyx Black" && e->upgraded);
+    std::filesystem::remove(path);
+}
+
+TEST(inventory_rejects_overflowing_sizes)
+{
+    const auto path = temp_path("inventory_overflow");
+    // 24 + 1 * 64 + strings_size переполняется ровно в длину файла (32 байта)
+    write_raw(path, header(1, ~std::uint64_t(0) - 55) + std::string(8, 'x'));
+    GiftInventory inv;
+    CHECK(!inv.load(path));
+    CHECK_EQ(inv.size(), std::size_t(0));
+    std::filesystem::remove(path);
+}
+
+TEST(inventory_ignores_strings_out_of_range)
+{
+    const auto path = temp_path("inventory_strings");
+    // одна запись, ссылки строк смотрят за конец блоба из 4 байт
+    std::string record(64, '\0');
+    const std::uint32_t refs[8] = {0, 4, 0xFFFFFFF0u, 0x20, 2, 0xFFFFFFFFu, 5, 0};
+    std::memcpy(record.data() + 32, refs, sizeof(refs));
+    write_raw(path, header(1, 4) + record + "abcd");
+    GiftInventory inv;
+    CHECK(inv.load(path));
+    const auto e = inv.find("abcd");
+    CHECK(e && e->model.empty() && e->backdrop.empty() && e->symbol.empty());
+    std::filesystem::remove(path);
+}
@@ -0,0 +1,45 @@
+#include "test_main.hpp"
+
+#include <spdlog/spdlog.h>
+#include <spdlog/sinks/null_sink.h>
+#include <cstring>
+
+namespace
+{
+    int g_failures = 0;
+} // namespace
+
+std::vector<tests::Case> &tests::registry()
+{
+    static std::vector<Case> cases;
+    return cases;
+}
+
+void tests::fail(const char *file, int line, const std::string &what)
+{
+    ++g_failures;
+    std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", file, line, what.c_str());
+}
+
+// tg_gifts_tests [имя] — все тесты или только те, в чьём имени есть подстрока
+int main(int argc, char **argv)
+{
+    // модули пишут в "logger"/"output" — в тестах это шум
+    spdlog::register_logger(std::make_shared<spdlog::logger>("logger", std::make_shared<spdlog::sinks::null_sink_mt>()));
+    spdlog::register_logger(std::make_shared<spdlog::logger>("output", std::make_shared<spdlog::sinks::null_sink_mt>()));
+
+    int run = 0;
+    for (const auto &c : tests::registry())
+    {
+        if (argc > 1 && !std::strstr(c.name, argv[1]))
+        {
+            continue;
+        }
+        const int before = g_failures;
+        c.fn();
+        ++run;
+        std::printf("%s %s\n", g_failures == before ? "ok  " : "FAIL", c.name);
+    }
+    std::printf("%d tests, %d failed checks\n", run, g_failures);
+    return g_failures == 0 && run > 0 ? 0 : 1;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Минимальный раннер без внешних зависимостей: TEST регистрирует функцию,
+// CHECK/CHECK_EQ считают провалы и печатают место, ctest смотрит на код возврата.
+namespace tests
+{
+    struct Case
+    {
+        const char *name;
+        std::function<void()> fn;
+    };
+
+    std::vector<Case> &registry();
+    void fail(const char *file, int line, const std::string &what);
+
+    struct Registrar
+    {
+        Registrar(const char *name, std::function<void()> fn) { registry().push_back({name, std::move(fn)}); }
+    };
+} // namespace tests
+
+#define TESTS_CONCAT_(a, b) a##b
+#define TESTS_CONCAT(a, b) TESTS_CONCAT_(a, b)
+#define TEST(name)                                                                      \
+    static void test_##name();                                                          \
+    static tests::Registrar TESTS_CONCAT(registrar_, name)(#name, &test_##name);        \
+    static void test_##name()
+
+#define CHECK(cond)                                     \
+    do                                                  \
+    {                                                   \
+        if (!(cond))                                    \
+            tests::fail(__FILE__, __LINE__, #cond);     \
+    } while (0)
+
+#define CHECK_EQ(a, b)                                                                                   \
+    do                                                                                                   \
+    {                                                                                                    \
+        const auto &va_ = (a);                                                                           \
+        const auto &vb_ = (b);                                                                           \
+        if (!(va_ == vb_))                                                                               \
+            tests::fail(__FILE__, __LINE__, std::string(#a " == " #b " (") + std::to_string(va_) + " vs " + \
+                                                std::to_string(vb_) + ")");                              \
+    } while (0)
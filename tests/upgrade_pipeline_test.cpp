@@ -0,0 +1,69 @@
+#include "test_main.hpp"
+#include "upgrade_pipeline.hpp"
+
+#include <chrono>
+#include <thread>
+
+namespace
+{
+    // ждёт, пока pred не станет true (pacer работает в своём потоке)
+    template <class Pred>
+    bool wait_until(Pred pred)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while (!pred())
+        {
+            if (std::chrono::steady_clock::now() > deadline)
+            {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+} // namespace
+
+TEST(pipeline_reset_releases_lost_requests)
+{
+    std::mutex mutex;
+    std::vector<std::uint64_t> sent;
+    UpgradePipeline pipeline([&](const UpgradeTemplate &, std::uint64_t request_id)
+                             {
+                                 std::lock_guard lk(mutex);
+                                 sent.push_back(request_id);
+                             });
+    auto templates = std::make_shared<std::vector<UpgradeTemplate>>();
+    templates->push_back(UpgradeTemplate{"1", 25, 900000001});
+    std::atomic<bool> running{true};
+    std::thread pacer([&] { pipeline.run(templates, 2, 0, running); });
+    auto sent_count = [&]
+    {
+        std::lock_guard lk(mutex);
+        return sent.size();
+    };
+
+    // depth 2: два запроса, ответов нет — полоса стоит
+    CHECK(wait_until([&] { return sent_count() == 2; }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK_EQ(sent_count(), std::size_t(2));
+
+    // клиент закрылся: слоты возвращаются, уходят два новых запроса
+    pipeline.reset_in_flight();
+    CHECK(wait_until([&] { return sent_count() == 4; }));
+    CHECK_EQ(pipeline.stats().expired, std::uint64_t(2));
+    CHECK_EQ(pipeline.stats().in_flight, std::size_t(2));
+
+    // ответ на потерянный запрос полосу не доливает, на живой — доливает
+    std::uint64_t lost, live;
+    {
+        std::lock_guard lk(mutex);
+        lost = sent[0];
+        live = sent[2];
+    }
+    CHECK_EQ(pipeline.on_response(lost), lost);
+    CHECK_EQ(pipeline.on_response(live), std::uint64_t(900000001));
+    CHECK(wait_until([&] { return sent_count() == 5; }));
+
+    running = false;
+    pacer.join();
+}
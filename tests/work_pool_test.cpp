@@ -0,0 +1,20 @@
+#include "test_main.hpp"
+#include "work_pool.hpp"
+
+#include <atomic>
+#include <memory>
+
+TEST(work_pool_runs_every_job)
+{
+    std::atomic<int> done{0};
+    {
+        WorkPool pool(3);
+        for (int i = 0; i < 1000; ++i)
+        {
+            // задача только перемещается — как ответ TDLib в обработчике
+            pool.submit([&done, p = std::make_unique<int>(i)]
+                        { done.fetch_add(1, std::memory_order_relaxed); });
+        }
+    } // деструктор дорабатывает очереди
+    CHECK_EQ(done.load(), 1000);
+}